@@ -0,0 +1,407 @@
+// Renders the bundled scenes and a few synthetic stress scenes along fixed
+// camera paths and reports frame times and throughput as JSON
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <glm/gtx/transform.hpp>
+#include "rasterizer.h"
+#include "scenefile.h"
+#include "jobs.h"
+#include "trace.h"
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace glm;
+
+using namespace std;
+
+
+// A scene to render: setup loads or builds it into a Rasterizer, and the
+// camera then orbits its center by orbit degrees over the frames
+struct BenchScene
+{
+    QString name;
+    function<bool(TextureCache&, Rasterizer&)> setup;
+    float orbit;
+};
+
+
+// A white square of cells by cells quads, side units wide at depth z, facing
+// the starting camera and drawn from both sides. Each vertex is pushed back by
+// a fixed pseudo-random amount up to bumps, so a bumpy grid cannot be
+// simplified into fewer triangles without visible error.
+static Polygon Grid(const QString& name, int cells, float side, float z, float bumps = 0.f)
+{
+    Polygon p(name);
+    p.m_cullMode = CullMode::None;
+
+    for(int y = 0; y <= cells; y++)
+    {
+        for(int x = 0; x <= cells; x++)
+        {
+            vec2 uv(float(x) / cells, float(y) / cells);
+            float depth = z - bumps * ((x * 7919 + y * 104729) % 97) / 96.f;
+            vec4 pos(side * (uv.x - 0.5f), side * (uv.y - 0.5f), depth, 1.f);
+            p.AddVertex(Vertex(pos, vec3(255.f, 255.f, 255.f), vec4(0.f, 0.f, 1.f, 0.f), uv));
+        }
+    }
+
+    for(int y = 0; y < cells; y++)
+    {
+        for(int x = 0; x < cells; x++)
+        {
+            unsigned int corner = x + (cells + 1) * y;
+            Triangle t0;
+            t0.m_indices[0] = corner;
+            t0.m_indices[1] = corner + 1;
+            t0.m_indices[2] = corner + cells + 2;
+            p.AddTriangle(t0);
+
+            Triangle t1;
+            t1.m_indices[0] = corner;
+            t1.m_indices[1] = corner + cells + 2;
+            t1.m_indices[2] = corner + cells + 1;
+            p.AddTriangle(t1);
+        }
+    }
+
+    return p;
+}
+
+// Starts rasterizer over with the Polygons, each drawn once where it is, in 3D
+static bool BuildScene(vector<Polygon> polygons, TextureCache& textureCache,
+                       Rasterizer& rasterizer)
+{
+    rasterizer = Rasterizer(std::move(polygons), &textureCache);
+    rasterizer.projection = Projection::Pinhole;
+    return true;
+}
+
+// The scenes run, the bundled ones read from scenesDir
+static vector<BenchScene> Scenes(const QDir& scenesDir)
+{
+    vector<BenchScene> scenes;
+
+    auto fileScene = [&](const QString& file, float orbit)
+    {
+        QString path = scenesDir.filePath(file);
+        BenchScene scene;
+        scene.name = file;
+        scene.setup = [path](TextureCache& textureCache, Rasterizer& rasterizer)
+        {
+            return QFile::exists(path) && LoadScene(path, textureCache, rasterizer);
+        };
+        scene.orbit = orbit;
+        scenes.push_back(scene);
+    };
+
+    // 3D scenes are orbited all the way around
+    QStringList solid = scenesDir.entryList(QStringList(QString("3D_*.json")), QDir::Files,
+                                            QDir::Name);
+    for(const QString& file : solid)
+    {
+        fileScene(file, 360.f);
+    }
+
+    // 2D scenes are drawn in pixel space, where the camera does nothing
+    QStringList flat = scenesDir.entryList(QStringList(QString("2D_*.json")), QDir::Files,
+                                           QDir::Name);
+    for(const QString& file : flat)
+    {
+        fileScene(file, 0.f);
+    }
+
+    // Small triangles a few pixels across filling most of the screen
+    BenchScene tiny;
+    tiny.name = QString("stress_tiny_triangles");
+    tiny.setup = [](TextureCache& textureCache, Rasterizer& rasterizer)
+    {
+        vector<Polygon> polygons;
+        polygons.push_back(Grid(QString("tiny"), 200, 8.f, 0.f, 0.05f));
+        return BuildScene(polygons, textureCache, rasterizer);
+    };
+    tiny.orbit = 20.f;
+    scenes.push_back(tiny);
+
+    // A handful of triangles, each covering a large part of the screen. The
+    // rasterizer drops triangles reaching behind the camera, so the grids
+    // are kept just large enough to fill the screen along the whole path.
+    BenchScene huge;
+    huge.name = QString("stress_huge_triangles");
+    huge.setup = [](TextureCache& textureCache, Rasterizer& rasterizer)
+    {
+        vector<Polygon> polygons;
+        polygons.push_back(Grid(QString("huge"), 2, 16.f, 0.f));
+        return BuildScene(polygons, textureCache, rasterizer);
+    };
+    huge.orbit = 20.f;
+    scenes.push_back(huge);
+
+    // Screen filling layers drawn back to front, so every layer passes the
+    // depth test and each pixel is shaded once per layer
+    BenchScene overdraw;
+    overdraw.name = QString("stress_overdraw");
+    overdraw.setup = [](TextureCache& textureCache, Rasterizer& rasterizer)
+    {
+        const int LAYERS = 32;
+        vector<Polygon> polygons;
+        for(int i = 0; i < LAYERS; i++)
+        {
+            polygons.push_back(Grid(QString("layer%1").arg(i), 1, 16.f, -0.1f * (LAYERS - 1 - i)));
+        }
+        return BuildScene(polygons, textureCache, rasterizer);
+    };
+    overdraw.orbit = 20.f;
+    scenes.push_back(overdraw);
+
+    return scenes;
+}
+
+
+// The cameras of a path turning the starting camera about the vertical axis
+// through the scene's center, from -degrees / 2 to +degrees / 2
+static vector<Camera> OrbitPath(const Rasterizer& rasterizer, float degrees, int frames)
+{
+    Bounds all;
+    const SceneGraph& scene = rasterizer.scene;
+    for(int i = 0; i < scene.NumNodes(); i++)
+    {
+        const SceneNode& node = scene.Node(i);
+        if(node.parent < 0 && !node.subtreeBounds.IsEmpty())
+        {
+            all.Add(node.subtreeBounds);
+        }
+    }
+    all.UpdateSphere();
+    vec3 center = all.IsEmpty() ? vec3(0.f) : all.center;
+
+    const Camera& start = rasterizer.camera;
+    vec4 offset = start.position - vec4(center, 1.f);
+
+    vector<Camera> cameras;
+    for(int i = 0; i < frames; i++)
+    {
+        float angle = frames > 1 ? degrees * (float(i) / (frames - 1) - 0.5f) : 0.f;
+        mat4 spin = glm::rotate(angle, vec3(0.f, 1.f, 0.f));
+
+        Camera c = start;
+        c.position = vec4(center, 1.f) + spin * offset;
+        c.forward = spin * start.forward;
+        c.right = spin * start.right;
+        c.up = spin * start.up;
+        cameras.push_back(c);
+    }
+    return cameras;
+}
+
+// The value below which fraction of the sorted times fall
+static double Percentile(const vector<double>& sorted, double fraction)
+{
+    if(sorted.empty())
+    {
+        return 0.0;
+    }
+    int rank = int(std::ceil(fraction * sorted.size())) - 1;
+    return sorted[glm::clamp(rank, 0, int(sorted.size()) - 1)];
+}
+
+// The most memory the process has held at once so far, in bytes, or -1
+// where the platform does not say
+static qint64 PeakMemoryBytes()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return -1;
+    }
+#ifdef Q_OS_MAC
+    return qint64(usage.ru_maxrss);
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#else
+    return -1;
+#endif
+}
+
+static double Milliseconds(chrono::steady_clock::duration d)
+{
+    return chrono::duration<double, milli>(d).count();
+}
+
+
+// Renders one scene along its path, first a frame at a time and then
+// through the frame pipeline, and returns what was measured
+static QJsonObject RunScene(const BenchScene& bench, int frames)
+{
+    QJsonObject result;
+    result["name"] = bench.name;
+
+    TextureCache textureCache;
+    Rasterizer rasterizer(vector<Polygon>(), &textureCache);
+
+    auto loadStart = chrono::steady_clock::now();
+    if(!bench.setup(textureCache, rasterizer))
+    {
+        result["error"] = QString("could not load the scene");
+        return result;
+    }
+    result["loadMs"] = Milliseconds(chrono::steady_clock::now() - loadStart);
+
+    vector<Camera> path = OrbitPath(rasterizer, bench.orbit, frames);
+
+    // The first frame also renders shadow maps and faults textures in, so
+    // it is reported on its own
+    rasterizer.camera = path[0];
+    auto firstStart = chrono::steady_clock::now();
+    rasterizer.RenderScene();
+    result["firstFrameMs"] = Milliseconds(chrono::steady_clock::now() - firstStart);
+
+    vector<double> times;
+    long long triangles = 0;
+    long long fragments = 0;
+    long long covered = 0;
+    QImage last;
+    for(const Camera& c : path)
+    {
+        rasterizer.camera = c;
+        auto start = chrono::steady_clock::now();
+        last = rasterizer.RenderScene();
+        times.push_back(Milliseconds(chrono::steady_clock::now() - start));
+
+        triangles += rasterizer.stats.trianglesSubmitted;
+        fragments += rasterizer.stats.fragmentsShaded;
+        covered += rasterizer.stats.pixelsCovered;
+    }
+
+    double total = 0.0;
+    for(double t : times)
+    {
+        total += t;
+    }
+    vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+
+    QJsonObject msPerFrame;
+    msPerFrame["mean"] = total / times.size();
+    msPerFrame["p50"] = Percentile(sorted, 0.5);
+    msPerFrame["p90"] = Percentile(sorted, 0.9);
+    msPerFrame["p99"] = Percentile(sorted, 0.99);
+    msPerFrame["max"] = sorted.back();
+    result["msPerFrame"] = msPerFrame;
+
+    double seconds = total / 1000.0;
+    result["framesPerSecond"] = times.size() / seconds;
+    result["trianglesPerFrame"] = double(triangles) / times.size();
+    result["trianglesPerSecond"] = triangles / seconds;
+    result["fragmentsPerSecond"] = fragments / seconds;
+    result["overdraw"] = covered > 0 ? double(fragments) / covered : 0.0;
+
+    // The same path again with geometry and raster of consecutive frames overlapped
+    auto pipeStart = chrono::steady_clock::now();
+    rasterizer.RenderPath(path, [](int, const QImage&) {});
+    result["pipelinedMsPerFrame"] = Milliseconds(chrono::steady_clock::now() - pipeStart)
+            / path.size();
+
+    result["peakMemoryBytes"] = PeakMemoryBytes();
+    result["textureResidentBytes"] = qint64(textureCache.ResidentBytes());
+    result["textureFaults"] = qint64(textureCache.NumFaults());
+
+    // Identical at any thread count, so renders can be compared across runs
+    QByteArray pixels(reinterpret_cast<const char*>(last.constBits()), last.byteCount());
+    result["lastFrameMd5"] = QString(QCryptographicHash::hash(pixels, QCryptographicHash::Md5)
+                                     .toHex());
+
+    return result;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString("Renders the bundled and synthetic scenes along "
+                                             "fixed camera paths and writes the timings as JSON."));
+    parser.addHelpOption();
+    QCommandLineOption scenesOption(QString("scenes"), QString("Folder of the scene files."),
+                                    QString("dir"), QString("../scenes"));
+    QCommandLineOption framesOption(QString("frames"), QString("Frames per camera path."),
+                                    QString("n"), QString("60"));
+    QCommandLineOption threadsOption(QString("threads"),
+                                     QString("Threads to render with, 0 for one per core."),
+                                     QString("n"), QString("0"));
+    QCommandLineOption outputOption(QString("output"),
+                                    QString("File to write the JSON to instead of stdout."),
+                                    QString("file"));
+    QCommandLineOption traceOption(QString("trace"),
+                                   QString("File to write a Chrome trace of the run to."),
+                                   QString("file"));
+    parser.addOption(scenesOption);
+    parser.addOption(framesOption);
+    parser.addOption(threadsOption);
+    parser.addOption(outputOption);
+    parser.addOption(traceOption);
+    parser.process(app);
+
+    if(parser.isSet(traceOption))
+    {
+        Trace::NameThread(QString("main"));
+        Trace::Enable(true);
+    }
+
+    int frames = std::max(parser.value(framesOption).toInt(), 1);
+    JobSystem::Shared().SetThreadCount(parser.value(threadsOption).toInt());
+
+    QJsonArray results;
+    for(const BenchScene& scene : Scenes(QDir(parser.value(scenesOption))))
+    {
+        cerr << "Rendering " << scene.name.toStdString() << endl;
+        results.append(RunScene(scene, frames));
+    }
+
+    if(parser.isSet(traceOption))
+    {
+        Trace::Enable(false);
+        if(!Trace::Save(parser.value(traceOption)))
+        {
+            cerr << "Could not write " << parser.value(traceOption).toStdString() << endl;
+        }
+    }
+
+    QJsonObject report;
+    report["threads"] = JobSystem::Shared().ThreadCount();
+    report["frames"] = frames;
+    report["scenes"] = results;
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if(parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly))
+        {
+            cerr << "Could not write " << parser.value(outputOption).toStdString() << endl;
+            return 1;
+        }
+        file.write(json);
+    }
+    else
+    {
+        cout << json.constData();
+    }
+
+    return 0;
+}
@@ -0,0 +1,11 @@
+QT       += core gui
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = RasterizeBenchmark
+TEMPLATE = app
+
+include(../renderer.pri)
+
+SOURCES += benchmark.cpp
@@ -0,0 +1,134 @@
+// Bounding volumes, and the camera frustum they are culled against
+
+#include "bounds.h"
+#include <cfloat>
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+Bounds::Bounds() : min(vec3(FLT_MAX)), max(vec3(-FLT_MAX)), center(vec3(0.f)), radius(-1.f)
+{}
+
+
+bool Bounds::IsEmpty() const
+{
+    return radius < 0.f;
+}
+
+
+// Grows the box to take in a point
+void Bounds::Add(const vec3& p)
+{
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+}
+
+// Grows the box to take in another box
+void Bounds::Add(const Bounds& b)
+{
+    if(b.IsEmpty())
+    {
+        return;
+    }
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+}
+
+// Fits the sphere around the box
+void Bounds::UpdateSphere()
+{
+    if(min[0] > max[0])
+    {
+        radius = -1.f;
+        return;
+    }
+    center = (min + max) * 0.5f;
+    radius = length(max - center);
+}
+
+
+// Whether the box contains the point
+bool Bounds::Contains(const vec3& p) const
+{
+    return p[0] >= min[0] && p[1] >= min[1] && p[2] >= min[2] &&
+            p[0] <= max[0] && p[1] <= max[1] && p[2] <= max[2];
+}
+
+
+// The box around this box's corners under m
+Bounds Bounds::Transformed(const mat4& m) const
+{
+    Bounds result;
+    if(IsEmpty())
+    {
+        return result;
+    }
+
+    for(int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3(i & 1 ? max[0] : min[0],
+                           i & 2 ? max[1] : min[1],
+                           i & 4 ? max[2] : min[2]);
+        result.Add(vec3(m * vec4(corner, 1.f)));
+    }
+    result.UpdateSphere();
+    return result;
+}
+
+
+Frustum::Frustum(const Camera& camera)
+{
+    vec3 pos = vec3(camera.position);
+    vec3 forward = vec3(camera.forward);
+    vec3 right = vec3(camera.right);
+    vec3 up = vec3(camera.up);
+
+    // The same scale getPerspProjMat gives x and y
+    float s = 1.f / std::tan(glm::radians(camera.fov) / 2.f);
+
+    vec3 normals[5] = {forward,
+                       normalize(forward - right * s),
+                       normalize(forward + right * s),
+                       normalize(forward - up * s),
+                       normalize(forward + up * s)};
+
+    for(int i = 0; i < 5; i++)
+    {
+        m_planes[i] = vec4(normals[i], -dot(normals[i], pos));
+    }
+}
+
+
+// Whether the bounds lie wholly outside the frustum
+bool Frustum::Excludes(const Bounds& b) const
+{
+    if(b.IsEmpty())
+    {
+        return true;
+    }
+
+    for(const vec4& plane : m_planes)
+    {
+        vec3 n = vec3(plane);
+
+        // The sphere is cheapest; the box's corner furthest along the
+        // plane's normal catches some that the sphere does not
+        if(dot(n, b.center) + plane[3] < -b.radius)
+        {
+            return true;
+        }
+
+        vec3 corner = vec3(n[0] >= 0.f ? b.max[0] : b.min[0],
+                           n[1] >= 0.f ? b.max[1] : b.min[1],
+                           n[2] >= 0.f ? b.max[2] : b.min[2]);
+        if(dot(n, corner) + plane[3] < 0.f)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,48 @@
+// Bounding volumes, and the camera frustum they are culled against
+
+#pragma once
+#include <glm/glm.hpp>
+#include "camera.h"
+
+// An axis aligned box and a sphere around the same points, in world space
+struct Bounds
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    glm::vec3 center;
+    float radius;   // Negative while the bounds hold no points
+
+    // Empty bounds
+    Bounds();
+
+    bool IsEmpty() const;
+
+    // Grows the box to take in a point or another box. Call UpdateSphere
+    // afterwards; the sphere is then the one around the box.
+    void Add(const glm::vec3& p);
+    void Add(const Bounds& b);
+    void UpdateSphere();
+
+    // Whether the box contains the point
+    bool Contains(const glm::vec3& p) const;
+
+    // The box around this box's corners under m, and the sphere around that
+    Bounds Transformed(const glm::mat4& m) const;
+};
+
+// The volume a pinhole Camera can see, as planes in world space. Only the
+// near side and the four edges of the screen are used; the rasterizer does
+// not clip against the far plane, so neither does culling.
+class Frustum
+{
+public:
+    Frustum(const Camera& camera);
+
+    // Whether the bounds lie wholly outside the frustum, so nothing in them can be seen
+    bool Excludes(const Bounds& b) const;
+
+private:
+    // Inward facing planes: a point p is inside when dot(n, p) + w >= 0
+    glm::vec4 m_planes[5];
+};
@@ -0,0 +1,235 @@
+// Bounding volume hierarchy over the meshlets of a mesh
+
+#include "bvh.h"
+#include "polygon.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Builds p's meshlets and the tree over them
+shared_ptr<MeshBVH> MeshBVH::Build(Polygon& p)
+{
+    shared_ptr<MeshBVH> bvh = make_shared<MeshBVH>();
+
+    bvh->m_meshlets = BuildMeshlets(p, bvh->m_meshletVertices);
+    if(bvh->m_meshlets.empty())
+    {
+        return bvh;
+    }
+
+    vector<int> order(bvh->m_meshlets.size());
+    for(unsigned int i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+
+    bvh->BuildNode(order, 0, order.size());
+
+    return bvh;
+}
+
+
+// Adds the node for meshlets begin to end - 1 of order and returns its index
+int MeshBVH::BuildNode(vector<int>& order, int begin, int end)
+{
+    int index = m_nodes.size();
+    m_nodes.push_back(BVHNode());
+
+    Bounds bounds;
+    Bounds centers;
+    for(int i = begin; i < end; i++)
+    {
+        bounds.Add(m_meshlets[order[i]].bounds);
+        centers.Add(m_meshlets[order[i]].bounds.center);
+    }
+    bounds.UpdateSphere();
+
+    int meshlet = -1;
+    int left = -1;
+    int right = -1;
+
+    if(end - begin == 1)
+    {
+        meshlet = order[begin];
+    }
+    else
+    {
+        // Split at the median of the meshlet centers along the longest axis
+        vec3 extent = centers.max - centers.min;
+        int axis = 0;
+        if(extent[1] > extent[axis])
+        {
+            axis = 1;
+        }
+        if(extent[2] > extent[axis])
+        {
+            axis = 2;
+        }
+
+        int mid = (begin + end) / 2;
+        nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                    [&](int a, int b)
+        {
+            return m_meshlets[a].bounds.center[axis] < m_meshlets[b].bounds.center[axis];
+        });
+
+        left = BuildNode(order, begin, mid);
+        right = BuildNode(order, mid, end);
+    }
+
+    // Children were pushed after this node, so it is only safe to fill in now
+    BVHNode& node = m_nodes[index];
+    node.bounds = bounds;
+    node.meshlet = meshlet;
+    node.left = left;
+    node.right = right;
+
+    return index;
+}
+
+
+// Refits the meshlets and every node's bounds to p's current vertex positions
+void MeshBVH::Refit(const Polygon& p)
+{
+    for(Meshlet& m : m_meshlets)
+    {
+        UpdateMeshletVolumes(p, m_meshletVertices, m);
+    }
+
+    // Children always come after their parent, so walking backwards
+    // updates them first
+    for(int i = int(m_nodes.size()) - 1; i >= 0; i--)
+    {
+        BVHNode& node = m_nodes[i];
+        node.bounds = Bounds();
+
+        if(node.IsLeaf())
+        {
+            node.bounds.Add(m_meshlets[node.meshlet].bounds);
+        }
+        else
+        {
+            node.bounds.Add(m_nodes[node.left].bounds);
+            node.bounds.Add(m_nodes[node.right].bounds);
+        }
+
+        node.bounds.UpdateSphere();
+    }
+}
+
+
+const vector<BVHNode>& MeshBVH::Nodes() const
+{
+    return m_nodes;
+}
+
+const vector<Meshlet>& MeshBVH::Meshlets() const
+{
+    return m_meshlets;
+}
+
+const vector<unsigned int>& MeshBVH::MeshletVertices() const
+{
+    return m_meshletVertices;
+}
+
+
+// Returns the distance along dir at which the ray enters the box, or a negative number
+float RayEntersBox(const Bounds& b, const vec3& origin, const vec3& invDir)
+{
+    if(b.IsEmpty())
+    {
+        return -1.f;
+    }
+
+    vec3 t0 = (b.min - origin) * invDir;
+    vec3 t1 = (b.max - origin) * invDir;
+    vec3 tNear = glm::min(t0, t1);
+    vec3 tFar = glm::max(t0, t1);
+
+    float enter = glm::max(glm::max(tNear[0], tNear[1]), glm::max(tNear[2], 0.f));
+    float exit = glm::min(glm::min(tFar[0], tFar[1]), tFar[2]);
+
+    return enter <= exit ? enter : -1.f;
+}
+
+
+// Whether the ray hits the triangle in front of its origin
+bool RayHitsTriangle(const vec3& origin, const vec3& dir, const vec3& v0,
+                     const vec3& v1, const vec3& v2, float& t)
+{
+    vec3 e1 = v1 - v0;
+    vec3 e2 = v2 - v0;
+
+    // Moller-Trumbore: solve for the hit's barycentric coordinates
+    vec3 pvec = cross(dir, e2);
+    float det = dot(e1, pvec);
+    if(std::abs(det) < 1e-12f)
+    {
+        return false;
+    }
+    float invDet = 1.f / det;
+
+    vec3 tvec = origin - v0;
+    float u = dot(tvec, pvec) * invDet;
+    if(u < 0.f || u > 1.f)
+    {
+        return false;
+    }
+
+    vec3 qvec = cross(tvec, e1);
+    float v = dot(dir, qvec) * invDet;
+    if(v < 0.f || u + v > 1.f)
+    {
+        return false;
+    }
+
+    t = dot(e2, qvec) * invDet;
+    return t > 0.f;
+}
+
+
+// Finds the nearest triangle of p hit by the ray
+bool MeshBVH::Raycast(const Polygon& p, const vec3& origin, const vec3& dir,
+                      float& t, int& triangle) const
+{
+    vec3 invDir = 1.f / dir;
+    t = FLT_MAX;
+    triangle = -1;
+
+    Traverse(origin, [&](const BVHNode& node)
+    {
+        // Nodes starting beyond the nearest hit so far cannot hold a nearer one
+        float enter = RayEntersBox(node.bounds, origin, invDir);
+        if(enter < 0.f || enter > t)
+        {
+            return false;
+        }
+
+        if(node.IsLeaf())
+        {
+            const Meshlet& m = m_meshlets[node.meshlet];
+            for(int i = m.firstTri; i < m.firstTri + m.triCount; i++)
+            {
+                const Triangle& tri = p.m_tris[i];
+
+                float hit;
+                if(RayHitsTriangle(origin, dir, vec3(p.m_verts[tri.m_indices[0]].m_pos),
+                                   vec3(p.m_verts[tri.m_indices[1]].m_pos),
+                                   vec3(p.m_verts[tri.m_indices[2]].m_pos), hit) && hit < t)
+                {
+                    t = hit;
+                    triangle = i;
+                }
+            }
+        }
+        return true;
+    });
+
+    return triangle >= 0;
+}
@@ -0,0 +1,108 @@
+// Bounding volume hierarchy over the meshlets of a mesh
+
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include "bounds.h"
+#include "meshlet.h"
+
+class Polygon;
+
+// Leaves hold one meshlet and have no children; inner nodes always have two
+struct BVHNode
+{
+    Bounds bounds;
+    int meshlet;
+    int left;
+    int right;
+
+    bool IsLeaf() const
+    {
+        return left < 0;
+    }
+};
+
+// Built once when a scene is loaded and shared by every copy of its
+// Polygon. Building groups the Polygon's triangles into meshlets and
+// reorders them so each meshlet is a contiguous run, which lets a visible
+// leaf be drawn as one run.
+class MeshBVH
+{
+public:
+    // Builds p's meshlets, then splits them at the median along the longest
+    // axis until every leaf holds one
+    static std::shared_ptr<MeshBVH> Build(Polygon& p);
+
+    // Refits the meshlets and every node's bounds to p's current vertex
+    // positions, keeping the tree's shape. Much cheaper than rebuilding
+    // after vertices move.
+    void Refit(const Polygon& p);
+
+    const std::vector<BVHNode>& Nodes() const;
+    const std::vector<Meshlet>& Meshlets() const;
+
+    // The vertex indices each meshlet's firstVertex and vertexCount refer to
+    const std::vector<unsigned int>& MeshletVertices() const;
+
+    // Visits nodes depth first, the child nearer to eye first, so leaves
+    // come out in rough front to back order. visit(node) returns false to
+    // skip the node's children.
+    template<class Visitor>
+    void Traverse(const glm::vec3& eye, Visitor visit) const
+    {
+        if(m_nodes.empty())
+        {
+            return;
+        }
+
+        // Median splits keep the depth near log2 of the leaf count
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while(top > 0)
+        {
+            const BVHNode& node = m_nodes[stack[--top]];
+            if(!visit(node) || node.IsLeaf())
+            {
+                continue;
+            }
+
+            // Push the further child first so the nearer is popped next
+            glm::vec3 toLeft = m_nodes[node.left].bounds.center - eye;
+            glm::vec3 toRight = m_nodes[node.right].bounds.center - eye;
+            if(dot(toLeft, toLeft) <= dot(toRight, toRight))
+            {
+                stack[top++] = node.right;
+                stack[top++] = node.left;
+            }
+            else
+            {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+    }
+
+    // Finds the nearest triangle of p hit by the ray, or returns false.
+    // t is the distance along dir, which need not be normalized.
+    bool Raycast(const Polygon& p, const glm::vec3& origin, const glm::vec3& dir,
+                 float& t, int& triangle) const;
+
+private:
+    // Adds the node for meshlets begin to end - 1 of order and returns its index
+    int BuildNode(std::vector<int>& order, int begin, int end);
+
+    std::vector<BVHNode> m_nodes;
+    std::vector<Meshlet> m_meshlets;
+    std::vector<unsigned int> m_meshletVertices;
+};
+
+// Returns the distance along dir at which the ray enters the box, or a
+// negative number if it misses
+float RayEntersBox(const Bounds& b, const glm::vec3& origin, const glm::vec3& invDir);
+
+// Whether the ray hits the triangle in front of its origin, and at what distance along dir
+bool RayHitsTriangle(const glm::vec3& origin, const glm::vec3& dir, const glm::vec3& v0,
+                     const glm::vec3& v1, const glm::vec3& v2, float& t);
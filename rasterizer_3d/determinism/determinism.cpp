@@ -0,0 +1,153 @@
+// Renders every scene in the scenes folder at 1, 2 and N threads, on its own
+// and along a short camera path, and checks that the images are the same
+// byte for byte
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QImage>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "rasterizer.h"
+#include "scenefile.h"
+#include "jobs.h"
+
+using namespace std;
+
+
+// Frames of the camera path rendered after the first frame
+static const int PATH_FRAMES = 8;
+
+// Loads a scene afresh, so its meshes are also prepared at the current
+// thread count, and renders its first frame with RenderScene, then a short
+// walk forward and to the left with RenderPath. Returns false if the scene
+// could not be loaded.
+static bool RenderFrames(const QString& path, vector<QImage>& images)
+{
+    TextureCache textureCache;
+    Rasterizer rasterizer(vector<Polygon>(), &textureCache);
+    if(!LoadScene(path, textureCache, rasterizer))
+    {
+        return false;
+    }
+    images.clear();
+    images.push_back(rasterizer.RenderScene());
+
+    vector<Camera> cameras;
+    Camera c = rasterizer.camera;
+    for(int i = 0; i < PATH_FRAMES; i++)
+    {
+        c.transForward(0.25f);
+        c.rotUp(3.f);
+        cameras.push_back(c);
+    }
+    rasterizer.RenderPath(cameras, [&](int, const QImage& image)
+    {
+        images.push_back(image);
+    });
+    return true;
+}
+
+// Whether two renders hold the same bytes
+static bool SameBytes(const QImage& a, const QImage& b)
+{
+    return a.format() == b.format() && a.size() == b.size() &&
+            std::equal(a.constBits(), a.constBits() + a.byteCount(), b.constBits());
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString("Renders every scene and a camera path through it "
+                                             "at 1, 2 and N threads and exits with 1 if any "
+                                             "images differ."));
+    parser.addHelpOption();
+    QCommandLineOption scenesOption(QString("scenes"), QString("Folder of the scene files."),
+                                    QString("dir"), QString("../scenes"));
+    QCommandLineOption threadsOption(QString("threads"),
+                                     QString("N, the most threads, 0 for one per core."),
+                                     QString("n"), QString("0"));
+    parser.addOption(scenesOption);
+    parser.addOption(threadsOption);
+    parser.process(app);
+
+    JobSystem& jobs = JobSystem::Shared();
+    jobs.SetThreadCount(parser.value(threadsOption).toInt());
+
+    vector<int> threadCounts;
+    threadCounts.push_back(1);
+    threadCounts.push_back(2);
+    threadCounts.push_back(jobs.ThreadCount());
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()),
+                       threadCounts.end());
+
+    QDir scenesDir(parser.value(scenesOption));
+    QStringList files = scenesDir.entryList(QStringList(QString("*.json")), QDir::Files,
+                                            QDir::Name);
+    if(files.isEmpty())
+    {
+        cerr << "No scene files in " << parser.value(scenesOption).toStdString() << endl;
+        return 1;
+    }
+
+    int failures = 0;
+    for(const QString& file : files)
+    {
+        QString path = scenesDir.filePath(file);
+        vector<QImage> first;
+        bool passed = true;
+
+        for(unsigned int i = 0; i < threadCounts.size() && passed; i++)
+        {
+            jobs.SetThreadCount(threadCounts[i]);
+
+            vector<QImage> images;
+            if(!RenderFrames(path, images))
+            {
+                cerr << file.toStdString() << ": could not load the scene" << endl;
+                passed = false;
+                continue;
+            }
+            if(i == 0)
+            {
+                first = images;
+                continue;
+            }
+
+            // Frame 0 is the RenderScene frame, the rest the path's
+            for(unsigned int frame = 0; frame < images.size() && passed; frame++)
+            {
+                if(!SameBytes(first[frame], images[frame]))
+                {
+                    cerr << file.toStdString() << ": frame " << frame << " at "
+                         << threadCounts[i] << " threads differs from " << threadCounts[0]
+                         << endl;
+                    passed = false;
+                }
+            }
+        }
+
+        if(passed)
+        {
+            cout << file.toStdString() << ": identical" << endl;
+        }
+        else
+        {
+            failures++;
+        }
+    }
+
+    cout << files.size() - failures << " of " << files.size() << " scenes identical at";
+    for(int threads : threadCounts)
+    {
+        cout << " " << threads;
+    }
+    cout << " threads" << endl;
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+// The order the scene's triangles are drawn in each frame
+
+#include "drawlist.h"
+#include <cfloat>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Sorts keys in ascending order, moving values along with them
+void RadixSort16(vector<uint16_t>& keys, vector<int>& values)
+{
+    vector<uint16_t> keysTemp(keys.size());
+    vector<int> valuesTemp(values.size());
+
+    for(int shift = 0; shift < 16; shift += 8)
+    {
+        // Count each digit, then turn the counts into starting offsets
+        unsigned int offsets[256] = {0};
+        for(uint16_t k : keys)
+        {
+            offsets[(k >> shift) & 0xff]++;
+        }
+
+        unsigned int sum = 0;
+        for(int d = 0; d < 256; d++)
+        {
+            unsigned int count = offsets[d];
+            offsets[d] = sum;
+            sum += count;
+        }
+
+        // Stable scatter, so the first pass's order survives the second
+        for(unsigned int i = 0; i < keys.size(); i++)
+        {
+            unsigned int dest = offsets[(keys[i] >> shift) & 0xff]++;
+            keysTemp[dest] = keys[i];
+            valuesTemp[dest] = values[i];
+        }
+
+        keys.swap(keysTemp);
+        values.swap(valuesTemp);
+    }
+}
+
+
+DrawList::DrawList() : m_calls()
+{}
+
+
+// Adds a draw of triangles firstTri up to lastTri
+void DrawList::Add(const Polygon& world, Polygon& screen, const Triangle* tris, int firstTri,
+                   int lastTri, const vec3& center, const mat4* transform)
+{
+    DrawCall d = {&world, &screen, tris, firstTri, lastTri, transform != nullptr,
+                  transform != nullptr ? *transform : mat4(1.f), center};
+    m_calls.push_back(d);
+}
+
+
+// Orders the draws nearest first by the distance to their centers
+void DrawList::SortFrontToBack(const vec4& camPos)
+{
+    int n = m_calls.size();
+    if(n < 2)
+    {
+        return;
+    }
+
+    vector<float> distances(n);
+    float nearest = FLT_MAX;
+    float furthest = 0.f;
+
+    for(int i = 0; i < n; i++)
+    {
+        distances[i] = length(m_calls[i].center - vec3(camPos));
+        nearest = glm::min(nearest, distances[i]);
+        furthest = glm::max(furthest, distances[i]);
+    }
+
+    // Spread the distances over the whole key range
+    float scale = furthest > nearest ? 65535.f / (furthest - nearest) : 0.f;
+
+    vector<uint16_t> keys(n);
+    vector<int> order(n);
+    for(int i = 0; i < n; i++)
+    {
+        keys[i] = uint16_t((distances[i] - nearest) * scale);
+        order[i] = i;
+    }
+
+    RadixSort16(keys, order);
+
+    vector<DrawCall> sorted(n);
+    for(int i = 0; i < n; i++)
+    {
+        sorted[i] = m_calls[order[i]];
+    }
+    m_calls.swap(sorted);
+}
+
+
+const vector<DrawCall>& DrawList::Calls() const
+{
+    return m_calls;
+}
@@ -0,0 +1,52 @@
+// The order the scene's triangles are drawn in each frame
+
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "polygon.h"
+
+// A run of consecutive triangles of one Polygon, drawn with that Polygon's variant
+struct DrawCall
+{
+    const Polygon* world;
+    Polygon* screen;
+
+    // The triangles firstTri and lastTri count in: world's own, or those of
+    // one of its levels of detail
+    const Triangle* tris;
+    int firstTri;
+    int lastTri;    // One past the last triangle drawn
+
+    // If placed, world is a mesh shared by all its instances and still in
+    // its own space, and transform takes it to world space
+    bool placed;
+    glm::mat4 transform;
+
+    // World space center of the triangles' bounds, used to sort the draws
+    glm::vec3 center;
+};
+
+// Sorts keys in ascending order, moving values along with them. Two
+// counting passes of 8 bits each, so it is linear in the number of keys.
+void RadixSort16(std::vector<uint16_t>& keys, std::vector<int>& values);
+
+class DrawList
+{
+public:
+    DrawList();
+
+    // Adds a draw of triangles firstTri up to lastTri of tris, centered on
+    // center. transform, if not null, places world, which is in its own space.
+    void Add(const Polygon& world, Polygon& screen, const Triangle* tris, int firstTri,
+             int lastTri, const glm::vec3& center, const glm::mat4* transform);
+
+    // Orders the draws nearest first, by the distance from camPos to each
+    // draw's center quantized to 16 bits
+    void SortFrontToBack(const glm::vec4& camPos);
+
+    const std::vector<DrawCall>& Calls() const;
+
+private:
+    std::vector<DrawCall> m_calls;
+};
@@ -0,0 +1,62 @@
+// Debug images showing where a frame spent its work, in place of the scene
+
+#include "heatmap.h"
+#include <algorithm>
+
+using namespace glm;
+
+using namespace std;
+
+
+QRgb HeatColor(float t)
+{
+    t = clamp(t, 0.f, 1.f);
+    if(t == 0.f)
+    {
+        return qRgb(0, 0, 0);
+    }
+
+    // Stops evenly spaced along t, blended between
+    const vec3 stops[] = {vec3(0.f, 0.f, 96.f), vec3(0.f, 0.f, 255.f), vec3(0.f, 255.f, 255.f),
+                          vec3(0.f, 255.f, 0.f), vec3(255.f, 255.f, 0.f), vec3(255.f, 0.f, 0.f)};
+    const int last = 5;
+
+    float s = t * last;
+    int i = std::min(int(s), last - 1);
+    vec3 c = mix(stops[i], stops[i + 1], s - i);
+    return qRgb(int(c.r), int(c.g), int(c.b));
+}
+
+
+void DrawCountHeatMap(const vector<int>& counts, QImage& image)
+{
+    ParallelFor(0, 512, 64, [&](int y)
+    {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for(int x = 0; x < 512; x++)
+        {
+            line[x] = HeatColor(float(counts[x + 512 * y]) / HEAT_MAX_COUNT);
+        }
+    });
+}
+
+
+void DrawTileHeatMap(const array<long long, TileBins::NUM_TILES>& tileNanos, QImage& image)
+{
+    long long slowest = *std::max_element(tileNanos.begin(), tileNanos.end());
+
+    ParallelFor(0, TileBins::NUM_TILES, 1, [&](int tile)
+    {
+        QRgb color = HeatColor(slowest > 0 ? float(tileNanos[tile]) / slowest : 0.f);
+
+        ScreenRect rect = TileBins::Rect(tile);
+        for(int y = rect.y0; y < rect.y1; y++)
+        {
+            QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+            for(int x = rect.x0; x < rect.x1; x++)
+            {
+                line[x] = color;
+            }
+        }
+    });
+}
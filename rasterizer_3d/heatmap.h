@@ -0,0 +1,21 @@
+// Debug images showing where a frame spent its work, in place of the scene
+
+#pragma once
+#include <QImage>
+#include <vector>
+#include "tiles.h"
+
+// Counts at or above this are drawn in the hottest color
+const int HEAT_MAX_COUNT = 8;
+
+// Black for 0, then blue, cyan, green, yellow and red at 1
+QRgb HeatColor(float t);
+
+// Colors every pixel by its count, from black for 0 to red for
+// HEAT_MAX_COUNT or more, so frames can be compared with each other
+void DrawCountHeatMap(const std::vector<int>& counts, QImage& image);
+
+// Colors every screen tile by the time it took to draw, red for the
+// slowest tile of the frame
+void DrawTileHeatMap(const std::array<long long, TileBins::NUM_TILES>& tileNanos,
+                     QImage& image);
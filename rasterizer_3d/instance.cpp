@@ -0,0 +1,102 @@
+// Placements of Polygons that are loaded once and drawn any number of times
+
+#include "instance.h"
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+Instance::Instance(int polygon, const mat4& transform)
+    : polygon(polygon), transform(transform), bounds()
+{}
+
+
+bool Instance::IsIdentity() const
+{
+    return transform == mat4(1.f);
+}
+
+
+// Fits bounds around the Polygon under transform
+void Instance::UpdateBounds(const Polygon& p)
+{
+    if(IsIdentity())
+    {
+        bounds = p.m_bounds;
+        return;
+    }
+
+    bounds = p.m_bounds.Transformed(transform);
+
+    // The Polygon's own sphere is usually tighter than the one around the
+    // moved box, so take whichever is smaller around the box's center
+    if(!bounds.IsEmpty())
+    {
+        vec3 center = vec3(transform * vec4(p.m_bounds.center, 1.f));
+        float radius = length(center - bounds.center) + p.m_bounds.radius * MaxScale();
+        bounds.radius = glm::min(bounds.radius, radius);
+    }
+}
+
+
+// The longest of the transformed axes
+float Instance::MaxScale() const
+{
+    return std::sqrt(glm::max(glm::max(dot(vec3(transform[0]), vec3(transform[0])),
+                                       dot(vec3(transform[1]), vec3(transform[1]))),
+                              dot(vec3(transform[2]), vec3(transform[2]))));
+}
+
+
+// Swaps the culled side under a mirroring transform
+CullMode PlacedCullMode(CullMode mode, const mat4& transform)
+{
+    if(determinant(mat3(transform)) >= 0.f || mode == CullMode::None)
+    {
+        return mode;
+    }
+    return mode == CullMode::Back ? CullMode::Front : CullMode::Back;
+}
+
+
+Placement::Placement(const mat4& transform)
+    : transform(transform), linear(mat3(transform)), normalMat(transpose(inverse(linear))),
+      mirrored(determinant(linear) < 0.f)
+{}
+
+
+// Moves a vertex into world space
+Vertex Placement::Place(const Vertex& v) const
+{
+    Vertex placed = v;
+    placed.m_pos = transform * v.m_pos;
+
+    vec3 normal = normalMat * vec3(v.m_normal);
+    if(length(normal) > 0.f)
+    {
+        placed.m_normal = vec4(normalize(normal), 0.f);
+    }
+
+    vec3 tangent = linear * vec3(v.m_tangent);
+    if(length(tangent) > 0.f)
+    {
+        placed.m_tangent = vec4(normalize(tangent), mirrored ? -v.m_tangent[3] : v.m_tangent[3]);
+    }
+    return placed;
+}
+
+
+// Moves a copy of an instance's Polygon into world space
+void PlaceInstance(Polygon& p, const mat4& transform)
+{
+    Placement placement(transform);
+    for(Vertex& v : p.m_verts)
+    {
+        v = placement.Place(v);
+    }
+
+    p.m_cullMode = PlacedCullMode(p.m_cullMode, transform);
+    p.m_bounds = p.m_bounds.Transformed(transform);
+}
@@ -0,0 +1,58 @@
+// Placements of Polygons that are loaded once and drawn any number of times
+
+#pragma once
+#include <glm/glm.hpp>
+#include "bounds.h"
+#include "polygon.h"
+
+// One placement of a Polygon. Every instance of a Polygon shares its
+// vertices, which stay in the Polygon's own space until the instance is
+// drawn, so a scene can hold thousands of copies of a prop for the price of
+// a matrix and a box each.
+struct Instance
+{
+    // Index of the Polygon in the Rasterizer's list
+    int polygon;
+
+    // Takes the Polygon's space to world space
+    glm::mat4 transform;
+
+    // The Polygon's bounds under transform, set by UpdateBounds
+    Bounds bounds;
+
+    Instance(int polygon, const glm::mat4& transform = glm::mat4(1.f));
+
+    // Whether transform leaves the Polygon where it is, so it can be drawn
+    // without being copied into place first
+    bool IsIdentity() const;
+
+    // Fits bounds around p, the instance's Polygon, under transform
+    void UpdateBounds(const Polygon& p);
+
+    // The most transform stretches any length
+    float MaxScale() const;
+};
+
+// An instance's transform with the matrices that move its normals and
+// tangents, worked out once per instance rather than once per vertex
+struct Placement
+{
+    glm::mat4 transform;
+    glm::mat3 linear;
+    glm::mat3 normalMat;
+    bool mirrored;
+
+    explicit Placement(const glm::mat4& transform);
+
+    // Moves a vertex of the instance's Polygon into world space. Normals and
+    // tangents are moved so they stay perpendicular to and along the surface.
+    Vertex Place(const Vertex& v) const;
+};
+
+// The side of a Polygon's triangles culled once transform has placed it:
+// mode, swapped if transform mirrors the Polygon and so reverses its winding
+CullMode PlacedCullMode(CullMode mode, const glm::mat4& transform);
+
+// Moves a copy of an instance's Polygon into world space, each vertex as
+// Placement::Place moves it, and the culled side as PlacedCullMode says.
+void PlaceInstance(Polygon& p, const glm::mat4& transform);
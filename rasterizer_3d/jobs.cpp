@@ -0,0 +1,266 @@
+// A pool of worker threads that share out work by stealing it from each other
+
+#include "jobs.h"
+#include <algorithm>
+#include "trace.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+
+// Which queue the calling thread pushes to and pops from first: its own if
+// it is a worker of pool, or the shared queue 0 otherwise
+static thread_local const JobSystem* t_pool = nullptr;
+static thread_local int t_queue = 0;
+
+
+JobSystem& JobSystem::Shared()
+{
+    static JobSystem shared;
+    return shared;
+}
+
+
+JobSystem::JobSystem(int threads)
+    : m_queues(), m_threads(), m_queued(0), m_sleepMutex(), m_wake(), m_stopping(false),
+      m_pinned(false)
+{
+    Start(threads);
+}
+
+JobSystem::~JobSystem()
+{
+    Stop();
+}
+
+
+void JobSystem::SetThreadCount(int threads)
+{
+    Stop();
+    Start(threads);
+}
+
+int JobSystem::ThreadCount() const
+{
+    return m_threads.size() + 1;
+}
+
+
+void JobSystem::SetAffinity(bool pinned)
+{
+    m_pinned = pinned;
+    ApplyAffinity();
+}
+
+bool JobSystem::Affinity() const
+{
+    return m_pinned;
+}
+
+
+// Starts threads - 1 workers, each with its own queue
+void JobSystem::Start(int threads)
+{
+    if(threads <= 0)
+    {
+        threads = std::max(int(thread::hardware_concurrency()), 1);
+    }
+
+    m_stopping = false;
+    m_queues.clear();
+    for(int i = 0; i < threads; i++)
+    {
+        m_queues.push_back(unique_ptr<Queue>(new Queue()));
+    }
+    for(int i = 1; i < threads; i++)
+    {
+        m_threads.push_back(thread(&JobSystem::WorkerLoop, this, i));
+    }
+    ApplyAffinity();
+}
+
+// Wakes every worker and waits for them to leave
+void JobSystem::Stop()
+{
+    {
+        lock_guard<mutex> lock(m_sleepMutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+
+    for(thread& t : m_threads)
+    {
+        t.join();
+    }
+    m_threads.clear();
+}
+
+
+// Queues a task on the calling thread's deque and wakes a worker to take it
+void JobSystem::Push(Task task)
+{
+    Queue& queue = *m_queues[t_pool == this ? t_queue : 0];
+    {
+        lock_guard<mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    m_queued++;
+
+    {
+        lock_guard<mutex> lock(m_sleepMutex);
+    }
+    m_wake.notify_one();
+}
+
+
+// Runs the calling thread's newest task, or steals another queue's oldest
+bool JobSystem::RunOne()
+{
+    int own = t_pool == this ? t_queue : 0;
+    int numQueues = m_queues.size();
+    Task task;
+    bool found = false;
+
+    for(int i = 0; i < numQueues && !found; i++)
+    {
+        Queue& queue = *m_queues[(own + i) % numQueues];
+        lock_guard<mutex> lock(queue.mutex);
+        if(queue.tasks.empty())
+        {
+            continue;
+        }
+
+        if(i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+
+    if(!found)
+    {
+        return false;
+    }
+    m_queued--;
+
+    {
+        TraceScope span("task");
+        task.run();
+    }
+
+    // The group may be gone as soon as its count reaches 0, so only the
+    // pool is touched after it
+    if(--task.group->m_unfinished == 0)
+    {
+        {
+            lock_guard<mutex> lock(m_sleepMutex);
+        }
+        m_wake.notify_all();
+    }
+    return true;
+}
+
+
+// Runs tasks until the pool stops, sleeping whenever there are none
+void JobSystem::WorkerLoop(int queue)
+{
+    t_pool = this;
+    t_queue = queue;
+    Trace::NameThread(QString("worker ") + QString::number(queue));
+
+    while(true)
+    {
+        if(RunOne())
+        {
+            continue;
+        }
+
+        unique_lock<mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [this]()
+        {
+            return m_stopping || m_queued > 0;
+        });
+        if(m_stopping)
+        {
+            return;
+        }
+    }
+}
+
+
+// Pins or frees every worker thread
+void JobSystem::ApplyAffinity()
+{
+#ifdef __linux__
+    int numCpus = std::max(int(thread::hardware_concurrency()), 1);
+    for(unsigned int i = 0; i < m_threads.size(); i++)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        if(m_pinned)
+        {
+            CPU_SET((i + 1) % numCpus, &cpus);
+        }
+        else
+        {
+            for(int c = 0; c < numCpus; c++)
+            {
+                CPU_SET(c, &cpus);
+            }
+        }
+        pthread_setaffinity_np(m_threads[i].native_handle(), sizeof(cpus), &cpus);
+    }
+#endif
+}
+
+
+TaskGroup::TaskGroup(JobSystem& jobs)
+    : m_jobs(jobs), m_unfinished(0)
+{}
+
+TaskGroup::~TaskGroup()
+{
+    Wait();
+}
+
+
+void TaskGroup::Run(function<void()> task)
+{
+    m_unfinished++;
+
+    JobSystem::Task t;
+    t.run = std::move(task);
+    t.group = this;
+    m_jobs.Push(std::move(t));
+}
+
+
+// Helps with queued work until the group's tasks are done, and sleeps
+// while there is none to help with
+void TaskGroup::Wait()
+{
+    while(m_unfinished > 0)
+    {
+        if(m_jobs.RunOne())
+        {
+            continue;
+        }
+
+        // The group's last tasks are running on other threads. Sleep until
+        // one of them finishes the group or more work is queued.
+        unique_lock<mutex> lock(m_jobs.m_sleepMutex);
+        m_jobs.m_wake.wait(lock, [this]()
+        {
+            return m_unfinished == 0 || m_jobs.m_queued > 0;
+        });
+    }
+}
@@ -0,0 +1,145 @@
+// A pool of worker threads that share out work by stealing it from each other
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Every worker keeps its own deque of tasks. A worker pushes and pops at
+// the back of its own, so it runs the work it just made while that work is
+// still in its cache, and an idle worker steals from the front of another's,
+// taking the oldest and usually largest piece. Threads that are not workers
+// push onto a deque of their own that every worker steals from.
+//
+// A thread waiting on a TaskGroup runs queued tasks instead of blocking, so
+// the waiting thread counts as one of the pool's threads, and groups can be
+// nested without tying up workers. Once nothing is left to run it sleeps
+// until the group finishes or more work is queued.
+class JobSystem
+{
+public:
+    // The one pool every parallel stage of the renderer and the loaders
+    // runs on, so overlapping loads and renders never oversubscribe the CPU
+    static JobSystem& Shared();
+
+    // Starts threads - 1 workers, the waiting thread being the last one.
+    // 0 starts one thread per hardware thread.
+    explicit JobSystem(int threads = 0);
+    ~JobSystem();
+
+    // Restarts the pool with a new number of threads. Only call while no
+    // task is queued or running.
+    void SetThreadCount(int threads);
+    int ThreadCount() const;
+
+    // Pins worker i to CPU i + 1, leaving CPU 0 to the thread driving the
+    // pool, or lets the OS move the workers again. Only has an effect on Linux.
+    void SetAffinity(bool pinned);
+    bool Affinity() const;
+
+private:
+    friend class TaskGroup;
+
+    struct Task
+    {
+        std::function<void()> run;
+        TaskGroup* group;
+    };
+
+    struct Queue
+    {
+        std::deque<Task> tasks;
+        std::mutex mutex;
+    };
+
+    void Start(int threads);
+    void Stop();
+
+    // Queues a task on the calling thread's deque
+    void Push(Task task);
+
+    // Runs one queued task, the calling thread's newest or another's
+    // oldest. Returns false if there was none.
+    bool RunOne();
+
+    void WorkerLoop(int queue);
+    void ApplyAffinity();
+
+    // Queue 0 is shared by threads that are not workers; worker i owns queue i + 1
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    // Tasks queued and not yet taken, and what idle workers, and threads
+    // waiting on a TaskGroup with nothing to run, sleep on
+    std::atomic<int> m_queued;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_stopping;
+
+    bool m_pinned;
+};
+
+
+// Tasks that are waited on together
+class TaskGroup
+{
+public:
+    explicit TaskGroup(JobSystem& jobs = JobSystem::Shared());
+
+    // Waits for any tasks still running
+    ~TaskGroup();
+
+    // Queues task to run on any of the pool's threads
+    void Run(std::function<void()> task);
+
+    // Returns once every task run in the group has finished, running queued
+    // tasks, of this group or any other, in the meantime
+    void Wait();
+
+private:
+    friend class JobSystem;
+
+    JobSystem& m_jobs;
+    std::atomic<int> m_unfinished;
+};
+
+
+// Calls body(i) for every i from begin up to end, grain at a time on the
+// pool's threads, and returns once all calls have finished. Runs on the
+// calling thread alone when the range fits in one grain or the pool has a
+// single thread. Calls may run in any order and at the same time, so for the
+// result not to depend on scheduling body(i) must only write what is i's own.
+template<class Body>
+void ParallelFor(int begin, int end, int grain, Body body)
+{
+    JobSystem& jobs = JobSystem::Shared();
+    if(end - begin <= grain || jobs.ThreadCount() == 1)
+    {
+        for(int i = begin; i < end; i++)
+        {
+            body(i);
+        }
+        return;
+    }
+
+    TaskGroup group(jobs);
+    for(int first = begin; first < end; first += grain)
+    {
+        int last = first + grain < end ? first + grain : end;
+        group.Run([&body, first, last]()
+        {
+            for(int i = first; i < last; i++)
+            {
+                body(i);
+            }
+        });
+    }
+    group.Wait();
+}
@@ -0,0 +1,172 @@
+// Point and spot lights, and the per tile light lists used to shade with them
+
+#include "light.h"
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+Light::Light() : type(LightType::Point), position(vec4(0.f, 0.f, 0.f, 1.f)),
+    direction(vec4(0.f, 0.f, -1.f, 0.f)), color(vec3(1.f)), intensity(1.f),
+    range(10.f), innerCos(1.f), outerCos(0.f), castsShadows(false), shadowBias(0.05f)
+{}
+
+
+// Returns how strongly this light reaches a point with the given normal
+float Light::Attenuate(const vec3& pos, const vec3& normal) const
+{
+    vec3 toLight = vec3(position) - pos;
+    float dist2 = dot(toLight, toLight);
+
+    if(dist2 >= range * range)
+    {
+        return 0.f;
+    }
+
+    float dist = std::sqrt(dist2);
+    toLight /= glm::max(dist, 1e-6f);
+
+    float diffuse = dot(normal, toLight);
+    if(diffuse <= 0.f)
+    {
+        return 0.f;
+    }
+
+    // Smooth falloff that reaches zero exactly at range
+    float falloff = 1.f - dist2 / (range * range);
+    falloff *= falloff;
+
+    if(type == LightType::Spot)
+    {
+        float cosAngle = dot(-toLight, vec3(direction));
+        falloff *= glm::smoothstep(outerCos, innerCos, cosAngle);
+    }
+
+    return diffuse * falloff;
+}
+
+
+// Returns how strongly the light at the camera lights a surface with the given normal
+float CameraLight(const vec3& normal, const vec3& lookDir)
+{
+    float scaleFactor = abs(dot(normal, lookDir));
+
+    // Add a bit of ambient lighting
+    scaleFactor += 0.2;
+
+    // Make the light brighter
+    scaleFactor *= 1.3;
+
+    return scaleFactor;
+}
+
+
+LightGrid::LightGrid() : m_offsets(TILES_X * TILES_Y + 1, 0), m_indices()
+{}
+
+
+// Bins the lights into tiles by the screen bounds of their spheres of influence
+void LightGrid::Build(const vector<Light>& lights, const Camera& camera, const mat4& viewMat,
+                      const mat4& projMat, bool conservative)
+{
+    // Pixel rectangle of tiles each light covers: x0, y0, x1, y1 inclusive
+    vector<ivec4> rects(lights.size());
+    vector<int> counts(TILES_X * TILES_Y, 0);
+
+    for(unsigned int i = 0; i < lights.size(); i++)
+    {
+        const Light& l = lights[i];
+        ivec4 rect = ivec4(0, 0, TILES_X - 1, TILES_Y - 1);
+
+        vec4 view = viewMat * l.position;
+        float r = l.range;
+
+        // Entirely behind the camera
+        if(view.z + r <= camera.nearClip)
+        {
+            rects[i] = ivec4(1, 1, 0, 0);
+            continue;
+        }
+
+        // A sphere crossing the near plane may cover any part of the screen
+        if(!conservative && view.z - r > camera.nearClip)
+        {
+            // The nearest depth of the sphere magnifies the extent furthest from the center
+            float nearZ = view.z - r;
+            float farZ = view.z + r;
+
+            float minX = view.x - r;
+            float maxX = view.x + r;
+            float minY = view.y - r;
+            float maxY = view.y + r;
+
+            minX = projMat[0][0] * minX / (minX < 0.f ? nearZ : farZ);
+            maxX = projMat[0][0] * maxX / (maxX > 0.f ? nearZ : farZ);
+            minY = projMat[1][1] * minY / (minY < 0.f ? nearZ : farZ);
+            maxY = projMat[1][1] * maxY / (maxY > 0.f ? nearZ : farZ);
+
+            // Convert to Pixel Space; y flips
+            float px0 = (minX + 1.f) * 256.f;
+            float px1 = (maxX + 1.f) * 256.f;
+            float py0 = (1.f - maxY) * 256.f;
+            float py1 = (1.f - minY) * 256.f;
+
+            // Off screen
+            if(px1 < 0.f || py1 < 0.f || px0 >= 512.f || py0 >= 512.f)
+            {
+                rects[i] = ivec4(1, 1, 0, 0);
+                continue;
+            }
+
+            px0 = glm::max(px0, 0.f);
+            py0 = glm::max(py0, 0.f);
+            px1 = glm::min(px1, 511.f);
+            py1 = glm::min(py1, 511.f);
+
+            rect = ivec4(int(px0) / TILE_SIZE, int(py0) / TILE_SIZE,
+                         int(px1) / TILE_SIZE, int(py1) / TILE_SIZE);
+        }
+
+        rects[i] = rect;
+
+        for(int ty = rect[1]; ty <= rect[3]; ty++)
+        {
+            for(int tx = rect[0]; tx <= rect[2]; tx++)
+            {
+                counts[tx + TILES_X * ty]++;
+            }
+        }
+    }
+
+    // Prefix sum the counts into offsets, then fill in the indices
+    m_offsets[0] = 0;
+    for(int i = 0; i < TILES_X * TILES_Y; i++)
+    {
+        m_offsets[i + 1] = m_offsets[i] + counts[i];
+        counts[i] = m_offsets[i];
+    }
+    m_indices.resize(m_offsets.back());
+
+    for(unsigned int i = 0; i < lights.size(); i++)
+    {
+        const ivec4& rect = rects[i];
+        for(int ty = rect[1]; ty <= rect[3]; ty++)
+        {
+            for(int tx = rect[0]; tx <= rect[2]; tx++)
+            {
+                m_indices[counts[tx + TILES_X * ty]++] = i;
+            }
+        }
+    }
+}
+
+
+// Returns the number of lights in the tile containing pixel (x, y)
+int LightGrid::LightsAt(int x, int y, const int*& first) const
+{
+    int tile = (x / TILE_SIZE) + TILES_X * (y / TILE_SIZE);
+    first = m_indices.data() + m_offsets[tile];
+    return m_offsets[tile + 1] - m_offsets[tile];
+}
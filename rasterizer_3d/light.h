@@ -0,0 +1,69 @@
+// Point and spot lights, and the per tile light lists used to shade with them
+
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "camera.h"
+
+enum class LightType
+{
+    Point,
+    Spot
+};
+
+// A light in world space. Its influence falls off smoothly to zero at range,
+// so no fragment further away than that needs to evaluate it.
+struct Light
+{
+    LightType type;
+    glm::vec4 position;
+    glm::vec4 direction;    // Spot lights only, the axis of the cone
+    glm::vec3 color;        // In [0, 1]
+    float intensity;
+    float range;
+    float innerCos;         // Spot lights only, cosines of the cone's half angles
+    float outerCos;
+
+    // Whether a ShadowMap is rendered for this light, and how much nearer than
+    // the stored depth a point must be before it counts as shadowed
+    bool castsShadows;
+    float shadowBias;
+
+    Light();
+
+    // Returns how strongly this light reaches a point with the given normal,
+    // before multiplying by color and intensity
+    float Attenuate(const glm::vec3& pos, const glm::vec3& normal) const;
+};
+
+// Returns how strongly the light at the camera, shining along lookDir, lights
+// a surface with the given normal. Both sides are lit, with a bit of ambient.
+float CameraLight(const glm::vec3& normal, const glm::vec3& lookDir);
+
+// Splits the screen into square tiles and, each frame, records which lights
+// can reach any pixel of each tile. Fragments then only evaluate the lights
+// of their own tile.
+class LightGrid
+{
+public:
+    // Width and height of a tile in pixels
+    static const int TILE_SIZE = 16;
+    static const int TILES_X = 512 / TILE_SIZE;
+    static const int TILES_Y = 512 / TILE_SIZE;
+
+    LightGrid();
+
+    // Bins the lights into tiles by the screen bounds of their spheres of influence.
+    // If conservative is set (e.g. for the fish eye lens), every light goes in every tile.
+    void Build(const std::vector<Light>& lights, const Camera& camera, const glm::mat4& viewMat,
+               const glm::mat4& projMat, bool conservative);
+
+    // Returns the number of lights in the tile containing pixel (x, y) and
+    // points first at their indices
+    int LightsAt(int x, int y, const int*& first) const;
+
+private:
+    // Light indices of tile i are m_indices[m_offsets[i]] to m_indices[m_offsets[i + 1] - 1]
+    std::vector<int> m_offsets;
+    std::vector<int> m_indices;
+};
@@ -0,0 +1,755 @@
+// Simplified levels of detail of a mesh, built by quadric error edge collapses
+
+#include "lod.h"
+#include "meshopt.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix
+// stored by its upper triangle, and the total weight of the planes
+struct Quadric
+{
+    double a[10];
+    double weight;
+
+    Quadric() : weight(0.0)
+    {
+        std::fill(a, a + 10, 0.0);
+    }
+
+    // Adds the plane dot(n, p) + d = 0, weighted
+    void AddPlane(const dvec3& n, double d, double w)
+    {
+        double p[4] = {n[0], n[1], n[2], d};
+        int k = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            for(int j = i; j < 4; j++)
+            {
+                a[k++] += w * p[i] * p[j];
+            }
+        }
+        weight += w;
+    }
+
+    void Add(const Quadric& q)
+    {
+        for(int k = 0; k < 10; k++)
+        {
+            a[k] += q.a[k];
+        }
+        weight += q.weight;
+    }
+
+    // Weighted squared distance from p to the planes
+    double Error(const vec3& p) const
+    {
+        double v[4] = {p[0], p[1], p[2], 1.0};
+        double e = 0.0;
+        int k = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            for(int j = i; j < 4; j++)
+            {
+                e += (i == j ? 1.0 : 2.0) * a[k++] * v[i] * v[j];
+            }
+        }
+        return e;
+    }
+
+    // Root mean square distance from p to the planes, by weight
+    double Distance(const vec3& p) const
+    {
+        return weight > 0.0 ? std::sqrt(glm::max(Error(p), 0.0) / weight) : 0.0;
+    }
+};
+
+
+// Moving welded vertex u onto v, queued by how far it moves the surface
+struct Collapse
+{
+    double cost;
+    double distance;
+    int u;
+    int v;
+    unsigned int uStamp;
+    unsigned int vStamp;
+
+    bool operator>(const Collapse& c) const
+    {
+        return cost > c.cost;
+    }
+};
+
+
+// Edge collapse over a Polygon whose vertices may be split at seams. Vertices
+// at the same position are welded into one, so the surface stays closed; each
+// triangle corner keeps its own Vertex, for its normal and UV.
+class Simplifier
+{
+public:
+    Simplifier(const Polygon& p) : m_p(p), m_numLive(0), m_error(0.0)
+    {
+        // Weld vertices that share a position
+        map<vector<float>, int> welds;
+        m_weldOf.resize(p.m_verts.size());
+        for(unsigned int i = 0; i < p.m_verts.size(); i++)
+        {
+            const vec4& pos = p.m_verts[i].m_pos;
+            vector<float> key = {pos[0], pos[1], pos[2]};
+            auto found = welds.find(key);
+            if(found == welds.end())
+            {
+                found = welds.insert(make_pair(key, int(m_pos.size()))).first;
+                m_pos.push_back(vec3(pos));
+                m_copies.push_back(vector<unsigned int>());
+            }
+            m_weldOf[i] = found->second;
+            m_copies[found->second].push_back(i);
+        }
+
+        int numWelds = m_pos.size();
+        m_quadrics.resize(numWelds);
+        m_trisOf.resize(numWelds);
+        m_stamps.assign(numWelds, 0);
+        m_alive.assign(numWelds, true);
+        m_locked.assign(numWelds, false);
+
+        for(const Triangle& t : p.m_tris)
+        {
+            int index = m_corners.size() / 3;
+            for(int c = 0; c < 3; c++)
+            {
+                m_corners.push_back(t.m_indices[c]);
+                m_trisOf[m_weldOf[t.m_indices[c]]].push_back(index);
+            }
+            m_live.push_back(!IsDegenerate(index));
+            m_numLive += m_live.back() ? 1 : 0;
+
+            // Each plane counts in proportion to the area it spans
+            vec3 n = cross(Pos(index, 1) - Pos(index, 0), Pos(index, 2) - Pos(index, 0));
+            double area = 0.5 * length(n);
+            if(area > 0.0)
+            {
+                dvec3 unit = dvec3(normalize(n));
+                double d = -dot(unit, dvec3(Pos(index, 0)));
+                for(int c = 0; c < 3; c++)
+                {
+                    m_quadrics[Weld(index, c)].AddPlane(unit, d, area);
+                }
+            }
+        }
+
+        // Vertices on an open edge stay put, so borders do not shrink
+        map<pair<int, int>, int> edgeUses;
+        for(unsigned int t = 0; t < m_live.size(); t++)
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+            for(int c = 0; c < 3; c++)
+            {
+                int a = Weld(t, c);
+                int b = Weld(t, (c + 1) % 3);
+                edgeUses[make_pair(glm::min(a, b), glm::max(a, b))]++;
+            }
+        }
+        for(const auto& e : edgeUses)
+        {
+            if(e.second == 1)
+            {
+                m_locked[e.first.first] = true;
+                m_locked[e.first.second] = true;
+            }
+        }
+
+        for(int w = 0; w < numWelds; w++)
+        {
+            QueueEdges(w);
+        }
+    }
+
+    int NumLive() const
+    {
+        return m_numLive;
+    }
+
+    // Performs the cheapest valid collapse. Returns false when none is left.
+    bool CollapseNext()
+    {
+        while(!m_queue.empty())
+        {
+            Collapse c = m_queue.top();
+            m_queue.pop();
+
+            if(!m_alive[c.u] || !m_alive[c.v] || m_stamps[c.u] != c.uStamp ||
+                    m_stamps[c.v] != c.vStamp || !IsValid(c.u, c.v))
+            {
+                continue;
+            }
+
+            Apply(c.u, c.v);
+            m_error = glm::max(m_error, c.distance);
+            return true;
+        }
+        return false;
+    }
+
+    // The live triangles, and the vertices they use
+    LodLevel Snapshot() const
+    {
+        LodLevel level;
+        level.error = float(m_error);
+        vector<bool> used(m_p.m_verts.size(), false);
+
+        for(unsigned int t = 0; t < m_live.size(); t++)
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+
+            Triangle tri = Triangle();
+            for(int c = 0; c < 3; c++)
+            {
+                tri.m_indices[c] = m_corners[t * 3 + c];
+                used[tri.m_indices[c]] = true;
+            }
+            level.tris.push_back(tri);
+        }
+
+        for(unsigned int i = 0; i < used.size(); i++)
+        {
+            if(used[i])
+            {
+                level.vertices.push_back(i);
+            }
+        }
+        return level;
+    }
+
+private:
+    int Weld(int tri, int corner) const
+    {
+        return m_weldOf[m_corners[tri * 3 + corner]];
+    }
+
+    vec3 Pos(int tri, int corner) const
+    {
+        return m_pos[Weld(tri, corner)];
+    }
+
+    bool IsDegenerate(int tri) const
+    {
+        return Weld(tri, 0) == Weld(tri, 1) || Weld(tri, 1) == Weld(tri, 2) ||
+                Weld(tri, 2) == Weld(tri, 0);
+    }
+
+    // Queues both directions of every edge around w
+    void QueueEdges(int w)
+    {
+        for(int t : m_trisOf[w])
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+            for(int c = 0; c < 3; c++)
+            {
+                int other = Weld(t, c);
+                if(other != w)
+                {
+                    Queue(w, other);
+                    Queue(other, w);
+                }
+            }
+        }
+    }
+
+    void Queue(int u, int v)
+    {
+        if(m_locked[u])
+        {
+            return;
+        }
+        Quadric q = m_quadrics[u];
+        q.Add(m_quadrics[v]);
+
+        Collapse c = {q.Error(m_pos[v]), q.Distance(m_pos[v]), u, v, m_stamps[u], m_stamps[v]};
+        m_queue.push(c);
+    }
+
+    // The welded vertices sharing a live triangle with w
+    vector<int> Neighbours(int w) const
+    {
+        vector<int> result;
+        for(int t : m_trisOf[w])
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+            for(int c = 0; c < 3; c++)
+            {
+                int other = Weld(t, c);
+                if(other != w && std::find(result.begin(), result.end(), other) == result.end())
+                {
+                    result.push_back(other);
+                }
+            }
+        }
+        return result;
+    }
+
+    // Whether two corners have the same normal and UV
+    bool SameAttributes(unsigned int a, unsigned int b) const
+    {
+        return m_p.m_verts[a].m_uv == m_p.m_verts[b].m_uv &&
+                m_p.m_verts[a].m_normal == m_p.m_verts[b].m_normal;
+    }
+
+    // The corner of live triangle t at welded vertex w
+    unsigned int CornerAt(int t, int w) const
+    {
+        for(int c = 0; c < 3; c++)
+        {
+            if(Weld(t, c) == w)
+            {
+                return m_corners[t * 3 + c];
+            }
+        }
+        return m_corners[t * 3];
+    }
+
+    // Whether the triangles around w disagree on its normal or UV
+    bool IsSeam(int w) const
+    {
+        int first = -1;
+        for(int t : m_trisOf[w])
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+            unsigned int corner = CornerAt(t, w);
+            if(first < 0)
+            {
+                first = corner;
+            }
+            else if(!SameAttributes(first, corner))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether the triangles on either side of edge (a, b) disagree on the
+    // attributes at either end, or there are not two of them
+    bool IsSeamEdge(int a, int b) const
+    {
+        int sides[2];
+        int numSides = 0;
+        for(int t : m_trisOf[a])
+        {
+            if(!m_live[t] || (Weld(t, 0) != b && Weld(t, 1) != b && Weld(t, 2) != b))
+            {
+                continue;
+            }
+            if(numSides == 2)
+            {
+                return true;
+            }
+            sides[numSides++] = t;
+        }
+        if(numSides != 2)
+        {
+            return true;
+        }
+        return !SameAttributes(CornerAt(sides[0], a), CornerAt(sides[1], a)) ||
+                !SameAttributes(CornerAt(sides[0], b), CornerAt(sides[1], b));
+    }
+
+    // Whether moving u onto v keeps the surface manifold and flips no triangle
+    bool IsValid(int u, int v) const
+    {
+        vector<int> nu = Neighbours(u);
+        vector<int> nv = Neighbours(v);
+        if(std::find(nu.begin(), nu.end(), v) == nu.end())
+        {
+            return false;
+        }
+
+        // An edge between two triangles has exactly two vertices opposite it;
+        // sharing more neighbours would pinch the surface
+        int shared = 0;
+        for(int n : nu)
+        {
+            if(std::find(nv.begin(), nv.end(), n) != nv.end())
+            {
+                shared++;
+            }
+        }
+        if(shared > 2)
+        {
+            return false;
+        }
+
+        // A vertex on a UV or normal seam may only slide along the seam, and
+        // only if it is not where seams meet, so both sides keep their mapping
+        if(IsSeam(u))
+        {
+            int seamEdges = 0;
+            for(int n : nu)
+            {
+                seamEdges += IsSeamEdge(u, n) ? 1 : 0;
+            }
+            if(seamEdges != 2 || !IsSeamEdge(u, v))
+            {
+                return false;
+            }
+        }
+
+        for(int t : m_trisOf[u])
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+
+            vec3 p[3];
+            bool hasV = false;
+            for(int c = 0; c < 3; c++)
+            {
+                int w = Weld(t, c);
+                hasV = hasV || w == v;
+                p[c] = m_pos[w == u ? v : w];
+            }
+            if(hasV)
+            {
+                continue;
+            }
+
+            vec3 before = cross(Pos(t, 1) - Pos(t, 0), Pos(t, 2) - Pos(t, 0));
+            vec3 after = cross(p[1] - p[0], p[2] - p[0]);
+            if(dot(before, after) <= 0.2f * length(before) * length(after))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // The copy of welded vertex v whose attributes best continue corner's
+    unsigned int NearestCopy(unsigned int corner, int v) const
+    {
+        const Vertex& from = m_p.m_verts[corner];
+        unsigned int best = m_copies[v][0];
+        float bestDist = -1.f;
+
+        for(unsigned int copy : m_copies[v])
+        {
+            const Vertex& to = m_p.m_verts[copy];
+            vec2 duv = to.m_uv - from.m_uv;
+            vec3 dn = vec3(to.m_normal - from.m_normal);
+            float dist = dot(duv, duv) + 0.1f * dot(dn, dn);
+            if(bestDist < 0.f || dist < bestDist)
+            {
+                best = copy;
+                bestDist = dist;
+            }
+        }
+        return best;
+    }
+
+    void Apply(int u, int v)
+    {
+        for(int t : m_trisOf[u])
+        {
+            if(!m_live[t])
+            {
+                continue;
+            }
+
+            bool hasV = false;
+            for(int c = 0; c < 3; c++)
+            {
+                hasV = hasV || Weld(t, c) == v;
+            }
+            if(hasV)
+            {
+                m_live[t] = false;
+                m_numLive--;
+                continue;
+            }
+
+            for(int c = 0; c < 3; c++)
+            {
+                unsigned int& corner = m_corners[t * 3 + c];
+                if(m_weldOf[corner] == u)
+                {
+                    corner = NearestCopy(corner, v);
+                }
+            }
+            m_trisOf[v].push_back(t);
+        }
+
+        m_alive[u] = false;
+        m_trisOf[u].clear();
+        m_quadrics[v].Add(m_quadrics[u]);
+        m_stamps[v]++;
+
+        QueueEdges(v);
+    }
+
+    const Polygon& m_p;
+
+    // Per welded vertex
+    vector<vec3> m_pos;
+    vector<vector<unsigned int>> m_copies;
+    vector<Quadric> m_quadrics;
+    vector<vector<int>> m_trisOf;
+    vector<unsigned int> m_stamps;
+    vector<bool> m_alive;
+    vector<bool> m_locked;
+
+    vector<int> m_weldOf;
+
+    // Three Vertex indices per triangle
+    vector<unsigned int> m_corners;
+    vector<bool> m_live;
+    int m_numLive;
+
+    // Furthest any collapse so far has moved the surface from the original
+    double m_error;
+
+    priority_queue<Collapse, vector<Collapse>, greater<Collapse>> m_queue;
+};
+
+
+// Simplifies p level by level until too few triangles are left
+shared_ptr<LodChain> LodChain::Build(const Polygon& p)
+{
+    shared_ptr<LodChain> chain = make_shared<LodChain>();
+    chain->m_fullTriangles = p.m_tris.size();
+
+    Simplifier simplifier(p);
+    int target = simplifier.NumLive() / 2;
+
+    while(target >= MIN_TRIANGLES)
+    {
+        bool progress = true;
+        while(simplifier.NumLive() > target && progress)
+        {
+            progress = simplifier.CollapseNext();
+        }
+
+        // Keep a level only if it is meaningfully smaller than the last
+        int last = chain->m_levels.empty() ? chain->m_fullTriangles
+                                           : chain->m_levels.back().tris.size();
+        if(simplifier.NumLive() <= last * 3 / 4)
+        {
+            LodLevel level = simplifier.Snapshot();
+            OptimizeVertexCache(level.tris, p.m_verts.size());
+            OptimizeOverdraw(level.tris, p.m_verts);
+            chain->m_levels.push_back(level);
+        }
+
+        if(!progress)
+        {
+            break;
+        }
+        target /= 2;
+    }
+
+    return chain;
+}
+
+
+// Reads the chain cached next to the mesh file, or builds and caches it
+shared_ptr<LodChain> LodChain::Load(const Polygon& p, const QString& meshPath)
+{
+    QFileInfo info(meshPath);
+    qint64 meshSize = info.size();
+    qint64 meshTime = info.lastModified().toMSecsSinceEpoch();
+    QString cachePath = meshPath;
+    cachePath.append(QString(".lod"));
+
+    shared_ptr<LodChain> chain = make_shared<LodChain>();
+    if(chain->Read(cachePath, meshSize, meshTime, p))
+    {
+        return chain;
+    }
+
+    chain = Build(p);
+    chain->Write(cachePath, meshSize, meshTime, p);
+    return chain;
+}
+
+
+int LodChain::NumLevels() const
+{
+    return m_levels.size() + 1;
+}
+
+const LodLevel& LodChain::Level(int level) const
+{
+    return m_levels[level - 1];
+}
+
+
+// Picks the coarsest level whose error stays under MAX_PIXEL_ERROR on screen
+int LodChain::Select(const Bounds& bounds, const vec3& eye, float lodScale) const
+{
+    // The nearest the surface can be, so no part of it strays further
+    float dist = length(bounds.center - eye) - bounds.radius;
+    if(bounds.IsEmpty() || dist <= 0.f || lodScale <= 0.f)
+    {
+        return 0;
+    }
+
+    // Levels are in order of growing error
+    float allowed = MAX_PIXEL_ERROR * dist / lodScale;
+    int level = 0;
+    while(level + 1 < NumLevels() && Level(level + 1).error <= allowed)
+    {
+        level++;
+    }
+    return level;
+}
+
+
+// Cache file layout: a header of int64 values, then for every level its
+// triangle and vertex counts and its error, followed by their indices
+static const qint64 LOD_MAGIC = 0x31444f4cLL;   // "LOD1"
+
+bool LodChain::Read(const QString& cachePath, qint64 meshSize, qint64 meshTime,
+                    const Polygon& p)
+{
+    QFile file(cachePath);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    qint64 header[6];
+    if(file.read(reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header) ||
+            header[0] != LOD_MAGIC || header[1] != meshSize || header[2] != meshTime ||
+            header[3] != qint64(p.m_verts.size()) || header[4] != qint64(p.m_tris.size()))
+    {
+        return false;
+    }
+
+    // Build keeps at most one level each time it halves the triangle count,
+    // so a corrupt level count is caught before anything is allocated
+    qint64 maxLevels = 0;
+    for(qint64 target = p.m_tris.size() / 2; target >= MIN_TRIANGLES; target /= 2)
+    {
+        maxLevels++;
+    }
+    if(header[5] < 0 || header[5] > maxLevels)
+    {
+        return false;
+    }
+
+    m_fullTriangles = p.m_tris.size();
+    m_levels.resize(header[5]);
+
+    for(LodLevel& level : m_levels)
+    {
+        qint64 counts[2];
+        if(file.read(reinterpret_cast<char*>(counts), sizeof(counts)) != sizeof(counts) ||
+                counts[0] < 0 || counts[0] > qint64(p.m_tris.size()) ||
+                counts[1] < 0 || counts[1] > qint64(p.m_verts.size()))
+        {
+            m_levels.clear();
+            return false;
+        }
+        if(file.read(reinterpret_cast<char*>(&level.error), sizeof(float)) != sizeof(float) ||
+                !(level.error >= 0.f))
+        {
+            m_levels.clear();
+            return false;
+        }
+
+        vector<unsigned int> indices(counts[0] * 3);
+        level.vertices.resize(counts[1]);
+        qint64 indexBytes = indices.size() * sizeof(unsigned int);
+        qint64 vertexBytes = level.vertices.size() * sizeof(unsigned int);
+        if(file.read(reinterpret_cast<char*>(indices.data()), indexBytes) != indexBytes ||
+                file.read(reinterpret_cast<char*>(level.vertices.data()), vertexBytes) != vertexBytes)
+        {
+            m_levels.clear();
+            return false;
+        }
+
+        level.tris.resize(counts[0]);
+        for(unsigned int t = 0; t < level.tris.size(); t++)
+        {
+            level.tris[t] = Triangle();
+            for(int c = 0; c < 3; c++)
+            {
+                // A corrupt file must not index past the vertices
+                if(indices[t * 3 + c] >= p.m_verts.size())
+                {
+                    m_levels.clear();
+                    return false;
+                }
+                level.tris[t].m_indices[c] = indices[t * 3 + c];
+            }
+        }
+        for(unsigned int v : level.vertices)
+        {
+            if(v >= p.m_verts.size())
+            {
+                m_levels.clear();
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void LodChain::Write(const QString& cachePath, qint64 meshSize, qint64 meshTime,
+                     const Polygon& p) const
+{
+    QFile file(cachePath);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return;
+    }
+
+    qint64 header[6] = {LOD_MAGIC, meshSize, meshTime, qint64(p.m_verts.size()),
+                        qint64(p.m_tris.size()), qint64(m_levels.size())};
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    for(const LodLevel& level : m_levels)
+    {
+        qint64 counts[2] = {qint64(level.tris.size()), qint64(level.vertices.size())};
+        file.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+        file.write(reinterpret_cast<const char*>(&level.error), sizeof(float));
+
+        vector<unsigned int> indices;
+        indices.reserve(level.tris.size() * 3);
+        for(const Triangle& t : level.tris)
+        {
+            indices.insert(indices.end(), t.m_indices, t.m_indices + 3);
+        }
+        file.write(reinterpret_cast<const char*>(indices.data()),
+                   indices.size() * sizeof(unsigned int));
+        file.write(reinterpret_cast<const char*>(level.vertices.data()),
+                   level.vertices.size() * sizeof(unsigned int));
+    }
+}
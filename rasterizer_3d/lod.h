@@ -0,0 +1,59 @@
+// Simplified levels of detail of a mesh, built by quadric error edge collapses
+
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include <QString>
+#include "polygon.h"
+
+// One simplified version of a Polygon. It reuses the Polygon's vertices, so
+// only its triangles and the vertices they use are kept. error is about how
+// far, in world units, its surface strays from the Polygon's.
+struct LodLevel
+{
+    std::vector<Triangle> tris;
+    std::vector<unsigned int> vertices;
+    float error;
+};
+
+// The levels of detail of one Polygon, each with about half the triangles of
+// the one before. Level 0 is the Polygon itself.
+class LodChain
+{
+public:
+    // No level is simplified below this many triangles
+    static const int MIN_TRIANGLES = 64;
+
+    // Most a drawn level's surface may stray from the full mesh, in pixels
+    static constexpr float MAX_PIXEL_ERROR = 0.5f;
+
+    // Simplifies p by collapsing the edges whose removal moves the surface
+    // least, keeping a level each time the triangle count halves
+    static std::shared_ptr<LodChain> Build(const Polygon& p);
+
+    // Reads the chain cached next to the mesh file at meshPath, or builds
+    // it and writes the cache if there is none or the mesh has changed
+    static std::shared_ptr<LodChain> Load(const Polygon& p, const QString& meshPath);
+
+    // Number of levels, counting the Polygon itself as level 0
+    int NumLevels() const;
+
+    // A simplified level, from 1 to NumLevels() - 1
+    const LodLevel& Level(int level) const;
+
+    // Picks the level to draw for bounds seen from eye, where lodScale is
+    // the pixels covered by one unit of length one unit away
+    int Select(const Bounds& bounds, const glm::vec3& eye, float lodScale) const;
+
+private:
+    // Reads or writes the cache file, stamped with the mesh file's size and
+    // time so a changed mesh is simplified again
+    bool Read(const QString& cachePath, qint64 meshSize, qint64 meshTime,
+              const Polygon& p);
+    void Write(const QString& cachePath, qint64 meshSize, qint64 meshTime,
+               const Polygon& p) const;
+
+    int m_fullTriangles;
+    std::vector<LodLevel> m_levels;
+};
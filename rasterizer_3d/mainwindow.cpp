@@ -5,15 +5,15 @@
 #include <QPixmap>
 #include <QFileDialog>
 #include <QTextStream>
-#include <QJsonObject>
-#include <QJsonDocument>
-#include <QJsonArray>
 #include <iostream>
 #include <QApplication>
 #include <QKeyEvent>
 #include <QImageWriter>
 #include <QDebug>
-#include <tiny_obj_loader.h>
+#include <QElapsedTimer>
+#include <QPainter>
+#include "scenefile.h"
+#include "trace.h"
 
 //Poke around in this file if you want, but it's virtually uncommented!
 //You won't need to modify anything in here to complete the assignment.
@@ -63,20 +63,97 @@ void MainWindow::keyPressEvent(QKeyEvent *e)
 
         //Rotate Clockwise about Forward Vector
         case Qt::Key_X : rasterizer.camera.rotForward(-5.f);  break;
+
+        //Switch between the scene's lights and the camera light
+        case Qt::Key_L :
+            if(rasterizer.lighting == Lighting::SceneLights)
+            {
+                rasterizer.lighting = Lighting::Lambert;
+            }
+            else if(rasterizer.lights.size() > 0)
+            {
+                rasterizer.lighting = Lighting::SceneLights;
+            }
+            break;
+
+        //Switch between the pinhole and fish eye lenses
+        case Qt::Key_F :
+            if(rasterizer.projection == Projection::Pinhole)
+            {
+                rasterizer.projection = Projection::FishEye;
+            }
+            else if(rasterizer.projection == Projection::FishEye)
+            {
+                rasterizer.projection = Projection::Pinhole;
+            }
+            break;
+
+        //Turn the depth pre-pass on or off
+        case Qt::Key_P : rasterizer.depthPrepass = !rasterizer.depthPrepass;  break;
+
+        //Turn front to back ordering on or off
+        case Qt::Key_O : rasterizer.sortFrontToBack = !rasterizer.sortFrontToBack;  break;
+
+        //Turn occlusion culling on or off
+        case Qt::Key_C : rasterizer.occlusionCulling = !rasterizer.occlusionCulling;  break;
+
+        //Cycle through the shaded image and the depth test, shading and
+        //tile time heat maps
+        case Qt::Key_H :
+            if(rasterizer.outputFormat == OutputFormat::Color)
+            {
+                rasterizer.outputFormat = OutputFormat::DepthTests;
+            }
+            else if(rasterizer.outputFormat == OutputFormat::DepthTests)
+            {
+                rasterizer.outputFormat = OutputFormat::Shading;
+            }
+            else if(rasterizer.outputFormat == OutputFormat::Shading)
+            {
+                rasterizer.outputFormat = OutputFormat::TileTime;
+            }
+            else
+            {
+                rasterizer.outputFormat = OutputFormat::Color;
+            }
+            break;
+
+        //Show or hide the render statistics over the image
+        case Qt::Key_I : show_stats = !show_stats;  break;
+
+        //Start recording a trace, or stop and save it
+        case Qt::Key_T :
+            if(!Trace::Enabled())
+            {
+                Trace::Enable(true);
+            }
+            else
+            {
+                Trace::Enable(false);
+                QString filename = QFileDialog::getSaveFileName(0, QString("Save Trace"), QString("../.."), QString("*.json"));
+                if(!filename.isEmpty() && !Trace::Save(filename))
+                {
+                    qDebug() << "Could not write" << filename;
+                }
+            }
+            break;
     }
 
-    rendered_image = rasterizer.RenderScene();
-    DisplayQImage(rendered_image);
+    RenderAndDisplay();
 }
 
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
-    rasterizer(std::vector<Polygon>())
+    textureCache(),
+    rasterizer(std::vector<Polygon>(), &textureCache),
+    show_stats(false),
+    frame_ms(0.0)
 {
     ui->setupUi(this);
     setFocusPolicy(Qt::StrongFocus);
+    Trace::NameThread(QString("main"));
 }
 
 MainWindow::~MainWindow()
@@ -86,158 +163,47 @@ MainWindow::~MainWindow()
 
 void MainWindow::DisplayQImage(QImage &i)
 {
+    TraceScope span("present");
     QPixmap pixmap(QPixmap::fromImage(i));
     graphics_scene.addPixmap(pixmap);
     graphics_scene.setSceneRect(pixmap.rect());
     ui->scene_display->setScene(&graphics_scene);
 }
 
-void MainWindow::on_actionLoad_Scene_triggered()
+//Renders the scene and shows it, with the frame time and render statistics
+//drawn over it if they are turned on. rendered_image is kept without them.
+void MainWindow::RenderAndDisplay()
 {
-    std::vector<Polygon> polygons;
+    QElapsedTimer timer;
+    timer.start();
+    rendered_image = rasterizer.RenderScene();
+    frame_ms = timer.nsecsElapsed() / 1e6;
 
-    QString filename = QFileDialog::getOpenFileName(0, QString("Load Scene File"), QDir::currentPath().append(QString("../..")), QString("*.json"));
-    int i = filename.length() - 1;
-    while(QString::compare(filename.at(i), QChar('/')) != 0)
+    if(!show_stats)
     {
-        i--;
-    }
-    QStringRef local_path = filename.leftRef(i+1);
-
-    QFile file(filename);
-    if(!file.open(QIODevice::ReadOnly)){
-        qWarning("Could not open the JSON file.");
+        DisplayQImage(rendered_image);
         return;
     }
-    QByteArray file_data = file.readAll();
 
-    QJsonDocument jdoc(QJsonDocument::fromJson(file_data));
-    //Read the mesh data in the file
-    QJsonArray objects = jdoc.object()["objects"].toArray();
-    for(int i = 0; i < objects.size(); i++)
-    {
-        std::vector<glm::vec4> vert_pos;
-        std::vector<glm::vec3> vert_col;
-        QJsonObject obj = objects[i].toObject();
-        QString type = obj["type"].toString();
-        //Custom Polygon case
-        if(QString::compare(type, QString("custom")) == 0)
-        {
-            QString name = obj["name"].toString();
-            QJsonArray pos = obj["vertexPos"].toArray();
-            for(int j = 0; j < pos.size(); j++)
-            {
-                QJsonArray arr = pos[j].toArray();
-                glm::vec4 p(arr[0].toDouble(), arr[1].toDouble(), arr[2].toDouble(), 1);
-                vert_pos.push_back(p);
-            }
-            QJsonArray col = obj["vertexCol"].toArray();
-            for(int j = 0; j < col.size(); j++)
-            {
-                QJsonArray arr = col[j].toArray();
-                glm::vec3 c(arr[0].toDouble(), arr[1].toDouble(), arr[2].toDouble());
-                vert_col.push_back(c);
-            }
-            Polygon p(name, vert_pos, vert_col);
-            polygons.push_back(p);
-        }
-        //Regular Polygon case
-        else if(QString::compare(type, QString("regular")) == 0)
-        {
-            QString name = obj["name"].toString();
-            int sides = obj["sides"].toInt();
-            QJsonArray colorA = obj["color"].toArray();
-            glm::vec3 color(colorA[0].toDouble(), colorA[1].toDouble(), colorA[2].toDouble());
-            QJsonArray posA = obj["pos"].toArray();
-            glm::vec4 pos(posA[0].toDouble(), posA[1].toDouble(), posA[2].toDouble(),1);
-            float rot = obj["rot"].toDouble();
-            QJsonArray scaleA = obj["scale"].toArray();
-            glm::vec4 scale(scaleA[0].toDouble(), scaleA[1].toDouble(), scaleA[2].toDouble(),1);
-            Polygon p(name, sides, color, pos, rot, scale);
-            polygons.push_back(p);
-        }
-        //OBJ file case
-        else if(QString::compare(type, QString("obj")) == 0)
-        {
-            QString name = obj["name"].toString();
-            QString filename = local_path.toString().append(obj["filename"].toString());
-            Polygon p = LoadOBJ(filename, name);
-            p.SetTexture(new QImage(local_path.toString().append(obj["texture"].toString())));
-            if(obj.contains(QString("normalMap")))
-            {
-                p.SetNormalMap(new QImage(local_path.toString().append(obj["normalMap"].toString())));
-            }
-            polygons.push_back(p);
-        }
-    }
-
-    rasterizer = Rasterizer(polygons);
-
-    rendered_image = rasterizer.RenderScene();
-    DisplayQImage(rendered_image);
+    QImage shown = rendered_image.copy();
+    QString text = QString("frame %1 ms\n").arg(frame_ms, 0, 'f', 1) + rasterizer.stats.Summary();
+    QPainter painter(&shown);
+    painter.fillRect(0, 0, 512, 86, QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(6, 4, 500, 82, Qt::AlignLeft | Qt::AlignTop, text);
+    painter.end();
+    DisplayQImage(shown);
 }
 
-
-Polygon MainWindow::LoadOBJ(const QString &file, const QString &polyName)
+void MainWindow::on_actionLoad_Scene_triggered()
 {
-    Polygon p(polyName);
-    QString filepath = file;
-    std::vector<tinyobj::shape_t> shapes; std::vector<tinyobj::material_t> materials;
-    std::string errors = tinyobj::LoadObj(shapes, materials, filepath.toStdString().c_str());
-    std::cout << errors << std::endl;
-    if(errors.size() == 0)
-    {
-        int min_idx = 0;
-        //Read the information from the vector of shape_ts
-        for(unsigned int i = 0; i < shapes.size(); i++)
-        {
-            std::vector<glm::vec4> pos, nor;
-            std::vector<glm::vec2> uv;
-            std::vector<float> &positions = shapes[i].mesh.positions;
-            std::vector<float> &normals = shapes[i].mesh.normals;
-            std::vector<float> &uvs = shapes[i].mesh.texcoords;
-            for(unsigned int j = 0; j < positions.size()/3; j++)
-            {
-                pos.push_back(glm::vec4(positions[j*3], positions[j*3+1], positions[j*3+2],1));
-            }
-            for(unsigned int j = 0; j < normals.size()/3; j++)
-            {
-                nor.push_back(glm::vec4(normals[j*3], normals[j*3+1], normals[j*3+2],0));
-            }
-            for(unsigned int j = 0; j < uvs.size()/2; j++)
-            {
-                uv.push_back(glm::vec2(uvs[j*2], uvs[j*2+1]));
-            }
-            for(unsigned int j = 0; j < pos.size(); j++)
-            {
-                p.AddVertex(Vertex(pos[j], glm::vec3(255,255,255), nor[j], uv[j]));
-
-                /* Add vertex coloration for debugging purposes
-                p.AddVertex(Vertex(pos[j], glm::vec3(((float)rand() / RAND_MAX) * 255,
-                                                     (float)rand() / RAND_MAX * 255,
-                                   (float)rand() / RAND_MAX * 255), nor[j], uv[j])); */
-
-            }
-
-            std::vector<unsigned int> indices = shapes[i].mesh.indices;
-            for(unsigned int j = 0; j < indices.size(); j += 3)
-            {
-                Triangle t;
-                t.m_indices[0] = indices[j] + min_idx;
-                t.m_indices[1] = indices[j+1] + min_idx;
-                t.m_indices[2] = indices[j+2] + min_idx;
-                p.AddTriangle(t);
-            }
-
-            min_idx += pos.size();
-        }
-    }
-    else
+    QString filename = QFileDialog::getOpenFileName(0, QString("Load Scene File"), QDir::currentPath().append(QString("../..")), QString("*.json"));
+    if(!LoadScene(filename, textureCache, rasterizer))
     {
-        //An error loading the OBJ occurred!
-        std::cout << errors << std::endl;
+        return;
     }
-    return p;
+
+    RenderAndDisplay();
 }
 
 
@@ -280,12 +246,12 @@ void MainWindow::on_actionEquilateral_Triangle_triggered()
     }
     p.AddTriangle(t); */
 
-    std::vector<Polygon> vec; vec.push_back(p);
+    //Swap the triangle into the existing scene rather than building a new one
+    rasterizer.ClearScene();
+    rasterizer.scene.AddNode(-1, glm::mat4(1.f), rasterizer.AddPolygon(p));
+    rasterizer.projection = Projection::Flat2D;
 
-    rasterizer = Rasterizer(vec);
-
-    rendered_image = rasterizer.RenderScene();
-    DisplayQImage(rendered_image);
+    RenderAndDisplay();
 }
 
 void MainWindow::on_actionQuit_Esc_triggered()
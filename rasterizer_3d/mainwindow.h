@@ -8,6 +8,7 @@
 #include <QGraphicsScene>
 #include <polygon.h>
 #include <rasterizer.h>
+#include <texture.h>
 
 namespace Ui {
 class MainWindow;
@@ -25,6 +26,8 @@ public:
 
     void keyPressEvent(QKeyEvent *e);
 
+    void RenderAndDisplay();
+
 private slots:
     void on_actionLoad_Scene_triggered();
 
@@ -36,7 +39,6 @@ private slots:
 
 private:
     Ui::MainWindow *ui;
-    Polygon LoadOBJ(const QString &file, const QString &polyName);
 
     //This is used to display the QImage produced by RenderScene in the GUI
     QGraphicsScene graphics_scene;
@@ -44,9 +46,17 @@ private:
     //This is the image rendered by your program when it loads a scene
     QImage rendered_image;
 
+    //Owns the texels of every texture the loaded scenes use. Declared before
+    //the rasterizer so it outlives the Polygons that reference it.
+    TextureCache textureCache;
+
     //The instance of the Rasterizer used to render our scene
     Rasterizer rasterizer;
 
+    //Whether the last frame's time and render statistics are drawn over it
+    bool show_stats;
+    double frame_ms;
+
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,255 @@
+// Small clusters of a mesh's triangles that can be culled with one test each
+
+#include "meshlet.h"
+#include "polygon.h"
+#include "meshopt.h"
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Whether every triangle faces away from eye
+bool Meshlet::IsBackFacing(const vec3& eye) const
+{
+    // The whole sphere must be on the back side of the cone, which holds
+    // for any point inside it when the angle to the axis is small enough
+    vec3 toCenter = bounds.center - eye;
+    return dot(toCenter, coneAxis) >= coneCutoff * length(toCenter) + bounds.radius;
+}
+
+
+// Groups p's triangles into meshlets and reorders p.m_tris to match
+vector<Meshlet> BuildMeshlets(Polygon& p, vector<unsigned int>& vertices)
+{
+    int numTris = p.m_tris.size();
+    int numVerts = p.m_verts.size();
+
+    // Triangles around each vertex, as offsets into one list
+    vector<int> offsets(numVerts + 1, 0);
+    for(const Triangle& t : p.m_tris)
+    {
+        for(unsigned int index : t.m_indices)
+        {
+            offsets[index + 1]++;
+        }
+    }
+    for(int v = 0; v < numVerts; v++)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<int> adjacent(offsets[numVerts]);
+    vector<int> filled(offsets.begin(), offsets.end() - 1);
+    for(int i = 0; i < numTris; i++)
+    {
+        for(unsigned int index : p.m_tris[i].m_indices)
+        {
+            adjacent[filled[index]++] = i;
+        }
+    }
+
+    vector<Meshlet> meshlets;
+    vector<bool> assigned(numTris, false);
+    vector<int> order;
+    order.reserve(numTris);
+    vertices.clear();
+
+    // The meshlet each vertex was last added to
+    vector<int> owner(numVerts, -1);
+    vector<int> candidates;
+
+    for(int seed = 0; seed < numTris; seed++)
+    {
+        if(assigned[seed])
+        {
+            continue;
+        }
+
+        Meshlet m;
+        m.firstTri = order.size();
+        m.triCount = 0;
+        m.firstVertex = vertices.size();
+        m.vertexCount = 0;
+        int id = meshlets.size();
+
+        candidates.clear();
+        int next = seed;
+
+        while(next >= 0)
+        {
+            assigned[next] = true;
+            order.push_back(next);
+            m.triCount++;
+
+            for(unsigned int index : p.m_tris[next].m_indices)
+            {
+                if(owner[index] == id)
+                {
+                    continue;
+                }
+                owner[index] = id;
+                vertices.push_back(index);
+                m.vertexCount++;
+
+                for(int a = offsets[index]; a < offsets[index + 1]; a++)
+                {
+                    if(!assigned[adjacent[a]])
+                    {
+                        candidates.push_back(adjacent[a]);
+                    }
+                }
+            }
+
+            if(m.triCount == Meshlet::MAX_TRIANGLES)
+            {
+                break;
+            }
+
+            // Take the neighbour that adds the fewest new vertices, earliest
+            // found first so the meshlet grows outwards evenly
+            next = -1;
+            int fewest = 4;
+            int kept = 0;
+            for(int c : candidates)
+            {
+                if(assigned[c])
+                {
+                    continue;
+                }
+                candidates[kept++] = c;
+
+                int added = 0;
+                for(unsigned int index : p.m_tris[c].m_indices)
+                {
+                    if(owner[index] != id)
+                    {
+                        added++;
+                    }
+                }
+
+                if(added < fewest && m.vertexCount + added <= Meshlet::MAX_VERTICES)
+                {
+                    fewest = added;
+                    next = c;
+                }
+            }
+            candidates.resize(kept);
+        }
+
+        meshlets.push_back(m);
+    }
+
+    vector<Triangle> sorted(numTris);
+    for(int i = 0; i < numTris; i++)
+    {
+        sorted[i] = p.m_tris[order[i]];
+    }
+    p.m_tris.swap(sorted);
+
+    // Growing the meshlets scatters the order the loader chose for the
+    // vertex cache and for overdraw, so each meshlet's run is ordered again
+    // on its own, numbered by the meshlet's vertices to keep the work small
+    vector<int> local(numVerts, -1);
+    for(const Meshlet& m : meshlets)
+    {
+        vector<Vertex> meshletVerts;
+        for(int v = 0; v < m.vertexCount; v++)
+        {
+            local[vertices[m.firstVertex + v]] = v;
+            meshletVerts.push_back(p.m_verts[vertices[m.firstVertex + v]]);
+        }
+
+        vector<Triangle> run(p.m_tris.begin() + m.firstTri,
+                             p.m_tris.begin() + m.firstTri + m.triCount);
+        for(Triangle& t : run)
+        {
+            for(unsigned int& index : t.m_indices)
+            {
+                index = local[index];
+            }
+        }
+
+        OptimizeVertexCache(run, m.vertexCount);
+        OptimizeOverdraw(run, meshletVerts);
+
+        for(int i = 0; i < m.triCount; i++)
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                p.m_tris[m.firstTri + i].m_indices[k] = vertices[m.firstVertex +
+                                                                 run[i].m_indices[k]];
+            }
+        }
+    }
+
+    for(Meshlet& m : meshlets)
+    {
+        UpdateMeshletVolumes(p, vertices, m);
+    }
+
+    return meshlets;
+}
+
+
+// Refits a meshlet's bounds and normal cone to p's current vertex positions
+void UpdateMeshletVolumes(const Polygon& p, const vector<unsigned int>& vertices, Meshlet& m)
+{
+    m.bounds = Bounds();
+    for(int i = m.firstVertex; i < m.firstVertex + m.vertexCount; i++)
+    {
+        m.bounds.Add(vec3(p.m_verts[vertices[i]].m_pos));
+    }
+    m.bounds.UpdateSphere();
+
+    // Face normals, turned to agree with the vertex normals, since those are
+    // what decide which side of a triangle is its front
+    vector<vec3> normals;
+    normals.reserve(m.triCount);
+    vec3 sum = vec3(0.f);
+
+    for(int i = m.firstTri; i < m.firstTri + m.triCount; i++)
+    {
+        const Vertex& v0 = p.m_verts[p.m_tris[i].m_indices[0]];
+        const Vertex& v1 = p.m_verts[p.m_tris[i].m_indices[1]];
+        const Vertex& v2 = p.m_verts[p.m_tris[i].m_indices[2]];
+
+        vec3 n = cross(vec3(v1.m_pos - v0.m_pos), vec3(v2.m_pos - v0.m_pos));
+        float len = length(n);
+        if(len <= 0.f)
+        {
+            continue;
+        }
+        n /= len;
+
+        if(dot(n, vec3(v0.m_normal + v1.m_normal + v2.m_normal)) < 0.f)
+        {
+            n = -n;
+        }
+
+        normals.push_back(n);
+        sum += n;
+    }
+
+    m.coneAxis = vec3(0.f, 0.f, 1.f);
+    m.coneCutoff = 1.f;
+
+    float sumLength = length(sum);
+    if(normals.empty() || sumLength <= 0.f)
+    {
+        return;
+    }
+    m.coneAxis = sum / sumLength;
+
+    float minDot = 1.f;
+    for(const vec3& n : normals)
+    {
+        minDot = glm::min(minDot, dot(n, m.coneAxis));
+    }
+
+    // Past about 84 degrees the cone hardly ever rejects anything
+    if(minDot > 0.1f)
+    {
+        m.coneCutoff = std::sqrt(1.f - minDot * minDot);
+    }
+}
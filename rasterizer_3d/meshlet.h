@@ -0,0 +1,45 @@
+// Small clusters of a mesh's triangles that can be culled with one test each
+
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "bounds.h"
+
+class Polygon;
+
+// At most MAX_VERTICES vertices and MAX_TRIANGLES triangles of one Polygon,
+// with the bounds and normal cone needed to reject all of them at once
+struct Meshlet
+{
+    static const int MAX_VERTICES = 64;
+    static const int MAX_TRIANGLES = 124;
+
+    // The meshlet's run of the Polygon's m_tris
+    int firstTri;
+    int triCount;
+
+    // Its run of the vertex index list BuildMeshlets fills in
+    int firstVertex;
+    int vertexCount;
+
+    Bounds bounds;
+
+    // Every face normal lies within the cone around coneAxis. coneCutoff is
+    // the sine of the cone's half angle, or 1 if it is too wide to ever cull.
+    glm::vec3 coneAxis;
+    float coneCutoff;
+
+    // Whether every triangle faces away from eye, wherever it is on screen
+    bool IsBackFacing(const glm::vec3& eye) const;
+};
+
+// Groups p's triangles into meshlets, growing each from a seed through the
+// triangles that share its vertices, and reorders p.m_tris so every meshlet is
+// a contiguous run, ordered within itself for the vertex cache and overdraw
+// as OptimizeMesh orders a whole mesh. vertices receives each meshlet's
+// distinct vertex indices.
+std::vector<Meshlet> BuildMeshlets(Polygon& p, std::vector<unsigned int>& vertices);
+
+// Refits a meshlet's bounds and normal cone to p's current vertex positions
+void UpdateMeshletVolumes(const Polygon& p, const std::vector<unsigned int>& vertices,
+                          Meshlet& m);
@@ -0,0 +1,343 @@
+// Load time reordering of a mesh's triangles and vertices, so drawing it
+// touches each vertex as few times and as close together as possible
+
+#include "meshopt.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Size of the most recently used vertex cache the triangle order is tuned for
+static const int CACHE_SIZE = 32;
+
+
+// Every attribute of a Vertex, for telling identical ones apart
+static vector<float> VertexKey(const Vertex& v)
+{
+    return {v.m_pos[0], v.m_pos[1], v.m_pos[2], v.m_pos[3],
+            v.m_color[0], v.m_color[1], v.m_color[2],
+            v.m_normal[0], v.m_normal[1], v.m_normal[2], v.m_normal[3],
+            v.m_uv[0], v.m_uv[1],
+            v.m_tangent[0], v.m_tangent[1], v.m_tangent[2], v.m_tangent[3]};
+}
+
+
+// Merges vertices whose every attribute is equal
+void WeldVertices(Polygon& p)
+{
+    map<vector<float>, unsigned int> unique;
+    vector<unsigned int> remap(p.m_verts.size());
+    vector<Vertex> welded;
+    welded.reserve(p.m_verts.size());
+
+    for(unsigned int i = 0; i < p.m_verts.size(); i++)
+    {
+        auto found = unique.insert(make_pair(VertexKey(p.m_verts[i]), welded.size()));
+        if(found.second)
+        {
+            welded.push_back(p.m_verts[i]);
+        }
+        remap[i] = found.first->second;
+    }
+
+    for(Triangle& t : p.m_tris)
+    {
+        for(unsigned int& index : t.m_indices)
+        {
+            index = remap[index];
+        }
+    }
+    p.m_verts.swap(welded);
+}
+
+
+// How much drawing a triangle next gains from one of its vertices: more if
+// the vertex is near the front of the cache, and more if few triangles are
+// left to use it, so lone triangles are not left behind
+static float VertexScore(int cachePos, int remaining)
+{
+    if(remaining == 0)
+    {
+        return -1.f;
+    }
+
+    float score = 0.f;
+    if(cachePos >= 0)
+    {
+        // The last triangle's own vertices score the same, whichever order
+        // they came in
+        if(cachePos < 3)
+        {
+            score = 0.75f;
+        }
+        else
+        {
+            score = std::pow(1.f - float(cachePos - 3) / (CACHE_SIZE - 3), 1.5f);
+        }
+    }
+    return score + 2.f / std::sqrt(float(remaining));
+}
+
+
+// Greedily draws the best scoring triangle among those using cached vertices
+void OptimizeVertexCache(vector<Triangle>& tris, int numVerts)
+{
+    int numTris = tris.size();
+    if(numTris == 0)
+    {
+        return;
+    }
+
+    // Triangles around each vertex, as offsets into one list. Each vertex's
+    // undrawn triangles are kept at the front of its run.
+    vector<int> offsets(numVerts + 1, 0);
+    for(const Triangle& t : tris)
+    {
+        for(unsigned int index : t.m_indices)
+        {
+            offsets[index + 1]++;
+        }
+    }
+    for(int v = 0; v < numVerts; v++)
+    {
+        offsets[v + 1] += offsets[v];
+    }
+    vector<int> adjacent(offsets[numVerts]);
+    vector<int> remaining(numVerts, 0);
+    for(int i = 0; i < numTris; i++)
+    {
+        for(unsigned int index : tris[i].m_indices)
+        {
+            adjacent[offsets[index] + remaining[index]++] = i;
+        }
+    }
+
+    vector<int> cachePos(numVerts, -1);
+    vector<float> vertScores(numVerts);
+    for(int v = 0; v < numVerts; v++)
+    {
+        vertScores[v] = VertexScore(-1, remaining[v]);
+    }
+
+    vector<float> triScores(numTris);
+    vector<bool> drawn(numTris, false);
+    int best = 0;
+    for(int i = 0; i < numTris; i++)
+    {
+        const unsigned int* idx = tris[i].m_indices;
+        triScores[i] = vertScores[idx[0]] + vertScores[idx[1]] + vertScores[idx[2]];
+        if(triScores[i] > triScores[best])
+        {
+            best = i;
+        }
+    }
+
+    vector<int> order;
+    order.reserve(numTris);
+    vector<int> cache;
+    vector<int> next;
+    int firstUndrawn = 0;
+
+    while(int(order.size()) < numTris)
+    {
+        // Nothing in the cache has a triangle left, so start afresh
+        if(best < 0)
+        {
+            while(drawn[firstUndrawn])
+            {
+                firstUndrawn++;
+            }
+            best = firstUndrawn;
+        }
+
+        drawn[best] = true;
+        order.push_back(best);
+
+        // The drawn triangle's vertices move to the front of the cache
+        next.clear();
+        for(unsigned int index : tris[best].m_indices)
+        {
+            int v = index;
+            int* run = &adjacent[offsets[v]];
+            int* live = std::find(run, run + remaining[v], best);
+            std::swap(*live, run[remaining[v] - 1]);
+            remaining[v]--;
+
+            if(std::find(next.begin(), next.end(), v) == next.end())
+            {
+                next.push_back(v);
+            }
+        }
+        for(int v : cache)
+        {
+            if(std::find(next.begin(), next.end(), v) == next.end())
+            {
+                next.push_back(v);
+            }
+        }
+
+        for(unsigned int i = 0; i < next.size(); i++)
+        {
+            int v = next[i];
+            cachePos[v] = int(i) < CACHE_SIZE ? int(i) : -1;
+            vertScores[v] = VertexScore(cachePos[v], remaining[v]);
+        }
+
+        // Only the triangles around vertices whose score changed need
+        // rescoring, and the next best is among them
+        best = -1;
+        float bestScore = -1.f;
+        for(int v : next)
+        {
+            for(int a = offsets[v]; a < offsets[v] + remaining[v]; a++)
+            {
+                int t = adjacent[a];
+                const unsigned int* idx = tris[t].m_indices;
+                triScores[t] = vertScores[idx[0]] + vertScores[idx[1]] + vertScores[idx[2]];
+                if(triScores[t] > bestScore)
+                {
+                    best = t;
+                    bestScore = triScores[t];
+                }
+            }
+        }
+
+        if(int(next.size()) > CACHE_SIZE)
+        {
+            next.resize(CACHE_SIZE);
+        }
+        cache.swap(next);
+    }
+
+    vector<Triangle> sorted(numTris);
+    for(int i = 0; i < numTris; i++)
+    {
+        sorted[i] = tris[order[i]];
+    }
+    tris.swap(sorted);
+}
+
+
+// Sorts the runs of cache ordered triangles, outward facing ones first
+void OptimizeOverdraw(vector<Triangle>& tris, const vector<Vertex>& verts)
+{
+    // A run ends wherever the order starts afresh, at a triangle none of
+    // whose vertices are still in the cache. Reordering whole runs then
+    // costs no more cache misses than it saves in overdraw.
+    vector<int> runStarts;
+    vector<int> loadedAt(verts.size(), -CACHE_SIZE - 1);
+    int loads = 0;
+
+    for(unsigned int i = 0; i < tris.size(); i++)
+    {
+        int misses = 0;
+        for(unsigned int index : tris[i].m_indices)
+        {
+            if(loads - loadedAt[index] > CACHE_SIZE)
+            {
+                loadedAt[index] = loads++;
+                misses++;
+            }
+        }
+        if(misses == 3 || i == 0)
+        {
+            runStarts.push_back(i);
+        }
+    }
+    runStarts.push_back(tris.size());
+
+    // Area weighted face normals and centers of each run and of the mesh
+    int numRuns = runStarts.size() - 1;
+    vector<vec3> normals(numRuns, vec3(0.f));
+    vector<vec3> centers(numRuns, vec3(0.f));
+    vector<float> areas(numRuns, 0.f);
+    vec3 meshCenter = vec3(0.f);
+    float meshArea = 0.f;
+
+    for(int r = 0; r < numRuns; r++)
+    {
+        for(int i = runStarts[r]; i < runStarts[r + 1]; i++)
+        {
+            vec3 p0 = vec3(verts[tris[i].m_indices[0]].m_pos);
+            vec3 p1 = vec3(verts[tris[i].m_indices[1]].m_pos);
+            vec3 p2 = vec3(verts[tris[i].m_indices[2]].m_pos);
+            vec3 n = cross(p1 - p0, p2 - p0);
+            float area = length(n);
+
+            normals[r] += n;
+            centers[r] += area * (p0 + p1 + p2) / 3.f;
+            areas[r] += area;
+        }
+        meshCenter += centers[r];
+        meshArea += areas[r];
+    }
+    if(!(meshArea > 0.f))
+    {
+        return;
+    }
+    meshCenter /= meshArea;
+
+    // How far a run faces away from the middle of the mesh
+    vector<float> outwards(numRuns, 0.f);
+    for(int r = 0; r < numRuns; r++)
+    {
+        if(areas[r] > 0.f && length(normals[r]) > 0.f)
+        {
+            outwards[r] = dot(centers[r] / areas[r] - meshCenter, normalize(normals[r]));
+        }
+    }
+
+    vector<int> runs(numRuns);
+    for(int r = 0; r < numRuns; r++)
+    {
+        runs[r] = r;
+    }
+    std::stable_sort(runs.begin(), runs.end(), [&](int a, int b)
+    {
+        return outwards[a] > outwards[b];
+    });
+
+    vector<Triangle> sorted;
+    sorted.reserve(tris.size());
+    for(int r : runs)
+    {
+        sorted.insert(sorted.end(), tris.begin() + runStarts[r], tris.begin() + runStarts[r + 1]);
+    }
+    tris.swap(sorted);
+}
+
+
+// Renumbers the vertices in the order the triangles first use them
+void OptimizeVertexFetch(Polygon& p)
+{
+    vector<int> remap(p.m_verts.size(), -1);
+    vector<Vertex> ordered;
+    ordered.reserve(p.m_verts.size());
+
+    for(Triangle& t : p.m_tris)
+    {
+        for(unsigned int& index : t.m_indices)
+        {
+            if(remap[index] < 0)
+            {
+                remap[index] = ordered.size();
+                ordered.push_back(p.m_verts[index]);
+            }
+            index = remap[index];
+        }
+    }
+    p.m_verts.swap(ordered);
+}
+
+
+void OptimizeMesh(Polygon& p)
+{
+    WeldVertices(p);
+    OptimizeVertexCache(p.m_tris, p.m_verts.size());
+    OptimizeOverdraw(p.m_tris, p.m_verts);
+    OptimizeVertexFetch(p);
+}
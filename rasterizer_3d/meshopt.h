@@ -0,0 +1,28 @@
+// Load time reordering of a mesh's triangles and vertices, so drawing it
+// touches each vertex as few times and as close together as possible
+
+#pragma once
+#include <vector>
+#include "polygon.h"
+
+// Merges vertices whose every attribute is equal, so triangles that share a
+// corner share its Vertex and it is projected only once
+void WeldVertices(Polygon& p);
+
+// Orders triangles so each reuses the vertices of the ones just before it,
+// following Forsyth's linear-speed vertex cache optimization
+void OptimizeVertexCache(std::vector<Triangle>& tris, int numVerts);
+
+// Splits cache ordered triangles into runs where the order starts afresh
+// and sorts the runs so those facing out of the mesh come first, keeping
+// the order within each run. Outward faces tend to hide the rest, so fewer
+// fragments are shaded only to be drawn over.
+void OptimizeOverdraw(std::vector<Triangle>& tris, const std::vector<Vertex>& verts);
+
+// Renumbers the vertices in the order the triangles first use them and
+// drops the unused ones, so vertices are read front to back
+void OptimizeVertexFetch(Polygon& p);
+
+// All of the above, in order. Called on every mesh as it is loaded, before
+// anything records its vertex or triangle indices.
+void OptimizeMesh(Polygon& p);
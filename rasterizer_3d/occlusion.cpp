@@ -0,0 +1,197 @@
+// Low resolution depth buffer of a few large occluders, and the test of
+// bounds against it
+
+#include "occlusion.h"
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+using namespace glm;
+
+using namespace std;
+
+
+OcclusionBuffer::OcclusionBuffer()
+    : m_compositionMat(), m_camPos(), m_camForward(), m_nearClip(0.f), m_nearDepth(0.f),
+      m_written(false), m_numOccluded(0), m_depth()
+{
+    m_depth.fill(FLT_MAX);
+}
+
+
+// Empties the buffer, ready for occluders seen through camera
+void OcclusionBuffer::Begin(const Camera& camera, const mat4& compositionMat, float nearDepth)
+{
+    m_compositionMat = compositionMat;
+    m_camPos = vec3(camera.position);
+    m_camForward = vec3(camera.forward);
+    m_nearClip = camera.nearClip;
+    m_nearDepth = nearDepth;
+    m_written = false;
+    m_numOccluded = 0;
+    m_depth.fill(FLT_MAX);
+}
+
+
+// The row or column of cells holding a pixel coordinate, clamped to the
+// buffer. Clamped as a float, since points near the camera's plane can land
+// arbitrarily far off screen.
+static int CellAt(float pixel)
+{
+    return int(glm::clamp(std::floor(pixel / OcclusionBuffer::CELL), 0.f,
+                          float(OcclusionBuffer::SIZE - 1)));
+}
+
+
+// Takes a world space point to pixel space, the same way PinholeProjection does
+bool OcclusionBuffer::Project(const vec3& p, vec2& pixel) const
+{
+    if(dot(p - m_camPos, m_camForward) <= m_nearClip)
+    {
+        return false;
+    }
+
+    vec4 pos = m_compositionMat * vec4(p, 1.f);
+    pos /= pos[3];
+
+    pixel = vec2((pos[0] + 1.f) * 256, (1 - pos[1]) * 256);
+    return true;
+}
+
+
+// Rasterizes an occluder into the buffer
+void OcclusionBuffer::AddOccluder(const Occluder& o)
+{
+    vec3 dists = vec3(length(o.v0 - m_camPos), length(o.v1 - m_camPos),
+                      length(o.v2 - m_camPos));
+    if(glm::min(glm::min(dists[0], dists[1]), dists[2]) < m_nearDepth)
+    {
+        return;
+    }
+
+    vec2 p0, p1, p2;
+    if(!Project(o.v0, p0) || !Project(o.v1, p1) || !Project(o.v2, p2))
+    {
+        return;
+    }
+
+    // Twice the signed area, as in triangle setup, where negative means front facing
+    float area = (p1[0] - p0[0]) * (p2[1] - p0[1]) - (p1[1] - p0[1]) * (p2[0] - p0[0]);
+    if(!(std::abs(area) > 0.f))
+    {
+        return;
+    }
+    if(o.cull != CullMode::None && (area < 0.f) == (o.cull == CullMode::Front))
+    {
+        return;
+    }
+
+    // Wind the triangle one way so inside is where every edge function is positive
+    if(area < 0.f)
+    {
+        std::swap(p1, p2);
+    }
+
+    float furthest = glm::max(glm::max(dists[0], dists[1]), dists[2]);
+
+    vec2 lo = glm::min(glm::min(p0, p1), p2);
+    vec2 hi = glm::max(glm::max(p0, p1), p2);
+    int cx0 = CellAt(lo[0]);
+    int cy0 = CellAt(lo[1]);
+    int cx1 = CellAt(hi[0]);
+    int cy1 = CellAt(hi[1]);
+
+    const vec2 corners[4] = {vec2(0.f, 0.f), vec2(CELL, 0.f), vec2(0.f, CELL), vec2(CELL, CELL)};
+    const vec2 from[3] = {p0, p1, p2};
+    const vec2 to[3] = {p1, p2, p0};
+
+    for(int cy = cy0; cy <= cy1; cy++)
+    {
+        for(int cx = cx0; cx <= cx1; cx++)
+        {
+            // The triangle is convex, so it covers the cell if it holds all four corners
+            vec2 origin = vec2(cx * CELL, cy * CELL);
+            bool covered = true;
+            for(int e = 0; e < 3 && covered; e++)
+            {
+                vec2 edge = to[e] - from[e];
+                for(const vec2& c : corners)
+                {
+                    vec2 rel = origin + c - from[e];
+                    if(edge[0] * rel[1] - edge[1] * rel[0] < 0.f)
+                    {
+                        covered = false;
+                        break;
+                    }
+                }
+            }
+
+            if(covered)
+            {
+                float& cell = m_depth[cx + SIZE * cy];
+                cell = glm::min(cell, furthest);
+                m_written = true;
+            }
+        }
+    }
+}
+
+
+// Whether the occluders hide everything within the bounds
+bool OcclusionBuffer::Occludes(const Bounds& b)
+{
+    if(!m_written || b.IsEmpty())
+    {
+        return false;
+    }
+
+    // Distance to the nearest point of the box
+    vec3 outside = glm::max(glm::max(b.min - m_camPos, m_camPos - b.max), vec3(0.f));
+    float nearest = length(outside);
+
+    // Screen rectangle of the box's corners
+    vec2 lo = vec2(FLT_MAX);
+    vec2 hi = vec2(-FLT_MAX);
+
+    for(int i = 0; i < 8; i++)
+    {
+        vec3 corner = vec3(i & 1 ? b.max[0] : b.min[0],
+                           i & 2 ? b.max[1] : b.min[1],
+                           i & 4 ? b.max[2] : b.min[2]);
+
+        // Boxes reaching the near plane have no meaningful rectangle
+        vec2 p;
+        if(!Project(corner, p))
+        {
+            return false;
+        }
+
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+
+    int cx0 = CellAt(lo[0]);
+    int cy0 = CellAt(lo[1]);
+    int cx1 = CellAt(hi[0]);
+    int cy1 = CellAt(hi[1]);
+
+    for(int cy = cy0; cy <= cy1; cy++)
+    {
+        for(int cx = cx0; cx <= cx1; cx++)
+        {
+            if(m_depth[cx + SIZE * cy] >= nearest)
+            {
+                return false;
+            }
+        }
+    }
+
+    m_numOccluded++;
+    return true;
+}
+
+
+int OcclusionBuffer::NumOccluded() const
+{
+    return m_numOccluded;
+}
@@ -0,0 +1,74 @@
+// Low resolution depth buffer of a few large occluders, and the test of
+// bounds against it
+
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include "bounds.h"
+#include "camera.h"
+#include "polygon.h"
+
+// A world space triangle drawn into the OcclusionBuffer, culled the way its
+// Polygon's triangles are
+struct Occluder
+{
+    glm::vec3 v0;
+    glm::vec3 v1;
+    glm::vec3 v2;
+    CullMode cull;
+};
+
+// One cell per 4 x 4 pixels of the pinhole camera's screen. Each cell holds a
+// depth beyond which everything in it is certainly hidden: an occluder only
+// writes the cells it covers completely, and writes its furthest depth, so
+// the buffer can never hide anything that is actually visible.
+//
+// Depths are distances from the camera, like the rasterizer's. Its depth at
+// any point of a triangle lies between the distances of the triangle's
+// vertices, so an occluder's furthest vertex and a box's nearest point are
+// what get compared.
+class OcclusionBuffer
+{
+public:
+    static const int SIZE = 128;
+    static const int CELL = 512 / SIZE;
+
+    // Most triangles Rasterizer draws into the buffer each frame, besides
+    // those of Polygons marked as occluders
+    static const int MAX_OCCLUDERS = 256;
+
+    OcclusionBuffer();
+
+    // Empties the buffer, ready for occluders seen through camera, whose
+    // projection and view matrices make up compositionMat. Fragments nearer
+    // than nearDepth are dropped by the rasterizer.
+    void Begin(const Camera& camera, const glm::mat4& compositionMat, float nearDepth);
+
+    // Rasterizes an occluder into the buffer, unless the rasterizer would
+    // cull it or drop any of its fragments as too near
+    void AddOccluder(const Occluder& o);
+
+    // Whether the occluders hide everything within the bounds. Counts the
+    // bounds it hides, for measuring.
+    bool Occludes(const Bounds& b);
+
+    // How many bounds Occludes has hidden since Begin
+    int NumOccluded() const;
+
+private:
+    // Takes a world space point to pixel space. Returns false if it is not in
+    // front of the camera's near plane.
+    bool Project(const glm::vec3& p, glm::vec2& pixel) const;
+
+    glm::mat4 m_compositionMat;
+    glm::vec3 m_camPos;
+    glm::vec3 m_camForward;
+    float m_nearClip;
+    float m_nearDepth;
+
+    // Whether any cell has been written since Begin
+    bool m_written;
+    int m_numOccluded;
+
+    std::array<float, SIZE * SIZE> m_depth;
+};
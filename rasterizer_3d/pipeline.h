@@ -0,0 +1,988 @@
+// Compile-time variants of the rasterization pipeline.
+//
+// RasterizeTriangle is instantiated once for every combination of projection,
+// texturing, lighting and output policy that RenderScene can ask for, so the
+// per-fragment loop of each variant contains none of the others' branches.
+// Rasterizer's DrawTiles hands each tile's runs of set up triangles to
+// DrawTriangles, picking the variant once per run from the settings and
+// the Polygon being drawn.
+
+#pragma once
+#include <glm/glm.hpp>
+#include <QImage>
+#include <array>
+#include <cmath>
+#include "polygon.h"
+#include "instance.h"
+#include "segment.h"
+#include "renderstats.h"
+#include "camera.h"
+#include "shader.h"
+#include "light.h"
+#include "shadowmap.h"
+#include "jobs.h"
+
+// Everything a variant needs to know about the frame being drawn
+struct FrameState
+{
+    glm::mat4 viewMat;
+    glm::mat4 compositionMat;
+    glm::vec4 camPos;
+    glm::vec4 camForward;
+
+    // Fractional focal length used by the fish eye lens
+    float focalLength;
+
+    // Fragments nearer to the camera than this are dropped
+    float nearDepth;
+
+    // Pixels covered by one unit of length one unit from the camera, used to
+    // pick levels of detail. 0 always draws full detail.
+    float lodScale;
+
+    std::array<float, 262144>* depth;
+    QImage* image;
+
+    // Scene lights and the lists of them reaching each screen tile
+    const std::vector<Light>* lights;
+    const LightGrid* lightGrid;
+    float ambient;
+
+    // One per light, empty for lights that cast no shadows
+    const std::vector<ShadowMap>* shadowMaps;
+
+    // Counts the fragments tested and shaded, if set
+    RenderStats* stats;
+
+    // For the heat map views, if set: depth tests and fragments shaded at
+    // every pixel, and the nanoseconds spent drawing every screen tile
+    int* depthTests;
+    int* shadeCounts;
+    long long* tileNanos;
+};
+
+
+// Projection policies
+
+// Vertices are already in pixel space; each triangle is drawn at the
+// depth of its first vertex
+struct Flat2DProjection
+{
+    static float ClearDepth()
+    {
+        return 1.f;
+    }
+
+    static glm::vec4 Project(const glm::vec4& pos, const FrameState&)
+    {
+        return pos;
+    }
+
+    // Same as the pinhole camera's, as y already runs down the screen
+    static bool IsFrontFacing(float signedArea)
+    {
+        return signedArea < 0.f;
+    }
+
+    static bool IsClipped(const Vertex&, const Vertex&, const Vertex&, const FrameState&)
+    {
+        return false;
+    }
+
+    static glm::vec3 VertDepths(const Vertex&, const Vertex&, const Vertex&)
+    {
+        return glm::vec3(1.f);
+    }
+
+    static glm::vec4 Depth(const Polygon&, const glm::vec3&, const glm::vec3&, const Vertex& v0)
+    {
+        return glm::vec4(1.f, 1.f, 1.f, v0.m_pos[2]);
+    }
+
+    // There is no perspective to correct for
+    static glm::vec3 PerspWeights(const glm::vec3& vertWeights, const glm::vec4&)
+    {
+        return vertWeights;
+    }
+
+    static bool InRange(float, const FrameState&)
+    {
+        return true;
+    }
+};
+
+// Shared by the 3D lenses: depth is the perspective correct distance from the camera.
+// Project leaves each vertex's distance along the camera's forward axis in z
+// and its distance from the camera in w, so triangle setup reads them rather
+// than working them out again for every triangle sharing the vertex.
+struct CameraProjection
+{
+    static float ClearDepth()
+    {
+        return 1000.f;
+    }
+
+    // Meshes wind their front faces counter-clockwise, which the flip of y
+    // into pixel space turns into a negative signed area
+    static bool IsFrontFacing(float signedArea)
+    {
+        return signedArea < 0.f;
+    }
+
+    // Triangles are not clipped against the screen; see PinholeProjection
+    static bool IsClipped(const Vertex&, const Vertex&, const Vertex&, const FrameState&)
+    {
+        return false;
+    }
+
+    // Takes pixel space vertices
+    static glm::vec3 VertDepths(const Vertex& v0, const Vertex& v1, const Vertex& v2)
+    {
+        return glm::vec3(v0.m_pos[3], v1.m_pos[3], v2.m_pos[3]);
+    }
+
+    static glm::vec4 Depth(const Polygon& screen, const glm::vec3& vertWeights,
+                           const glm::vec3& vertDepths, const Vertex&)
+    {
+        return screen.interpZDepth(vertWeights, vertDepths);
+    }
+
+    // Screen space weights scaled so attributes interpolate correctly in 3D
+    static glm::vec3 PerspWeights(const glm::vec3& vertWeights, const glm::vec4& depthVec)
+    {
+        return depthVec[3] * glm::vec3(vertWeights[0] / depthVec[0],
+                                       vertWeights[1] / depthVec[1],
+                                       vertWeights[2] / depthVec[2]);
+    }
+
+    // Too close to camera
+    static bool InRange(float zDepth, const FrameState& f)
+    {
+        return zDepth >= f.nearDepth;
+    }
+};
+
+// Normal Pinhole camera
+struct PinholeProjection : public CameraProjection
+{
+    static glm::vec4 Project(const glm::vec4& world, const FrameState& f)
+    {
+        // Multiply verts by the matrices
+        glm::vec4 pos = f.compositionMat * world;
+
+        // Divide by W
+        pos /= pos[3];
+
+        // Convert to Pixel Space
+        pos[0] = (pos[0] + 1.f) * 256;
+        pos[1] = (1 - pos[1]) * 256;
+
+        pos[2] = dot(world - f.camPos, f.camForward);
+        pos[3] = glm::length(world - f.camPos);
+
+        return pos;
+    }
+
+    // A vertex behind the camera would project mirrored onto the screen, so
+    // the whole triangle is left out. Takes pixel space vertices.
+    static bool IsClipped(const Vertex& v0, const Vertex& v1, const Vertex& v2, const FrameState&)
+    {
+        return v0.m_pos[2] <= 0.f || v1.m_pos[2] <= 0.f || v2.m_pos[2] <= 0.f;
+    }
+};
+
+// Fish Eye lens (Equidistant F Theta camera)
+struct FishEyeProjection : public CameraProjection
+{
+    // The lens mirrors the image left to right, and with it the winding
+    static bool IsFrontFacing(float signedArea)
+    {
+        return signedArea > 0.f;
+    }
+
+    static glm::vec4 Project(const glm::vec4& world, const FrameState& f)
+    {
+        glm::vec4 pos = world;
+
+        glm::vec4 camSpace = f.viewMat * world;
+
+        camSpace = normalize(camSpace);
+
+        double phi = atan2(camSpace.y, camSpace.x);
+        double length = std::sqrt(camSpace.x * camSpace.x + camSpace.y * camSpace.y);
+        double theta = asin(length);
+
+        //Equidistant projection
+        double r = f.focalLength * theta;
+
+        double x = -r * cos(phi);
+        double y = -r * sin(phi);
+
+        // Convert to pixel space
+        x += 0.5;
+        y += 0.5;
+        pos[0] = x * 512.0;
+        pos[1] = y * 512.0;
+
+        pos[2] = dot(world - f.camPos, f.camForward);
+        pos[3] = glm::length(world - f.camPos);
+
+        return pos;
+    }
+};
+
+
+// Twice the triangle's signed area in pixel space, as Polygon::tArea2D
+// measures it. Negative when the triangle winds counter-clockwise as displayed.
+inline float SignedArea2D(const glm::vec4& p0, const glm::vec4& p1, const glm::vec4& p2)
+{
+    return (p2[0] - p1[0]) * (p0[1] - p1[1]) - (p0[0] - p1[0]) * (p2[1] - p1[1]);
+}
+
+// Whether a triangle of the given signed area is thrown away under mode
+template<class Proj>
+bool IsCulled(float signedArea, CullMode mode)
+{
+    if(mode == CullMode::None)
+    {
+        return false;
+    }
+    return Proj::IsFrontFacing(signedArea) == (mode == CullMode::Front);
+}
+
+// The pixels a draw is limited to: columns x0 up to x1 and rows y0 up to y1
+struct ScreenRect
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+
+// Screen space barycentric weights of one triangle. The edges are set up once
+// per triangle, so a pixel costs a few multiplies instead of three triangle areas.
+struct BarySetup
+{
+    // signedArea is SignedArea2D of the same vertices
+    BarySetup(const glm::vec4& p0, const glm::vec4& p1, const glm::vec4& p2, float signedArea)
+        : o0(p1), o1(p2), o2(p0), e0(p2 - p1), e1(p0 - p2), e2(p1 - p0)
+    {
+        invArea = 1.f / std::abs(signedArea);
+    }
+
+    // Same weights as Polygon::baryInterp2D
+    glm::vec3 Weights(float x, float y) const
+    {
+        return glm::vec3(std::abs((x - o0[0]) * e0[1] - e0[0] * (y - o0[1])),
+                         std::abs((x - o1[0]) * e1[1] - e1[0] * (y - o1[1])),
+                         std::abs((x - o2[0]) * e2[1] - e2[0] * (y - o2[1]))) * invArea;
+    }
+
+    // Each weight is the area spanned by the pixel and the edge from o to o + e
+    glm::vec2 o0, o1, o2;
+    glm::vec2 e0, e1, e2;
+    float invArea;
+};
+
+
+// The triangle being shaded, as seen by the texturing and lighting policies
+struct TriangleRef
+{
+    Polygon* screen;
+
+    // Screen space vertices
+    const Vertex* v0;
+    const Vertex* v1;
+    const Vertex* v2;
+
+    // World space positions of the same vertices
+    glm::vec4 worldPos0;
+    glm::vec4 worldPos1;
+    glm::vec4 worldPos2;
+
+    // Mip level picked once for the whole triangle
+    float texLod;
+
+    // Sampler of the Polygon's texture, set by shading policies that read it
+    TextureSampler* texture;
+};
+
+// A fragment that passed the depth test
+struct FragmentRef
+{
+    int x;
+    int y;
+
+    // Screen space barycentric weights
+    glm::vec3 vertWeights;
+
+    // Distances to the vertices, and the fragment's depth in w
+    glm::vec4 depthVec;
+
+    // Weights for interpolating world space attributes
+    glm::vec3 perspWeights;
+};
+
+
+// Texturing policies. FETCHES is the number of texture lookups made for
+// each fragment.
+
+// Vertex colors interpolated in screen space
+struct VertexColorTexturing
+{
+    static const int FETCHES = 0;
+
+    static float Lod(const TriangleRef&, const Triangle&)
+    {
+        return 0.f;
+    }
+
+    static glm::vec3 Color(const TriangleRef& tri, const FragmentRef& frag)
+    {
+        return tri.v0->m_color * frag.vertWeights[0] + tri.v1->m_color * frag.vertWeights[1] +
+                tri.v2->m_color * frag.vertWeights[2];
+    }
+};
+
+// Polygons without a texture are white
+struct UntexturedTexturing
+{
+    static const int FETCHES = 0;
+
+    static float Lod(const TriangleRef&, const Triangle&)
+    {
+        return 0.f;
+    }
+
+    static glm::vec3 Color(const TriangleRef&, const FragmentRef&)
+    {
+        return glm::vec3(255.f, 255.f, 255.f);
+    }
+};
+
+// Perspective correct UV lookup into the Polygon's texture
+struct TexturedTexturing
+{
+    static const int FETCHES = 1;
+
+    static float Lod(const TriangleRef& tri, const Triangle& t)
+    {
+        return tri.screen->calcTexLod(t, tri.v0->m_pos, tri.v1->m_pos, tri.v2->m_pos,
+                                      tri.screen->mp_texture.get());
+    }
+
+    static glm::vec3 Color(const TriangleRef& tri, const FragmentRef& frag)
+    {
+        return tri.screen->baryInterpUVs(frag.vertWeights, frag.depthVec, *tri.v0, *tri.v1, *tri.v2,
+                                         *tri.texture, tri.texLod);
+    }
+};
+
+
+// Lighting policies. Normal mapped Polygons are not lit by these but by
+// the batched shaders; see DrawWithTexturing in rasterizer.cpp.
+
+struct UnlitLighting
+{
+    static glm::vec3 Apply(const glm::vec3& color, const TriangleRef&, const FragmentRef&,
+                           const FrameState&)
+    {
+        return color;
+    }
+};
+
+// Color Clamping, shared by the lit variants
+inline glm::vec3 ClampColor(glm::vec3 color)
+{
+    if(color[0] > 255.f)
+    {
+        color /= (color[0] / 255.f);
+    }
+    if(color[1] > 255.f)
+    {
+        color /= (color[1] / 255.f);
+    }
+    if(color[2] > 255.f)
+    {
+        color /= (color[2] / 255.f);
+    }
+    return color;
+}
+
+// Lambertian lighting from the camera's direction using interpolated vertex normals
+struct LambertLighting
+{
+    static glm::vec3 Apply(const glm::vec3& color, const TriangleRef& tri, const FragmentRef& frag,
+                           const FrameState& f)
+    {
+        glm::vec4 normal = tri.screen->baryInterpSurfaceNormal(frag.vertWeights, frag.depthVec,
+                                                               *tri.v0, *tri.v1, *tri.v2);
+        return ClampColor(color * CameraLight(glm::vec3(normal), glm::vec3(f.camForward)));
+    }
+};
+
+// The scene's point and spot lights. Each fragment only evaluates the
+// lights the LightGrid binned into its screen tile.
+struct SceneLighting
+{
+    static glm::vec3 Apply(const glm::vec3& color, const TriangleRef& tri, const FragmentRef& frag,
+                           const FrameState& f)
+    {
+        glm::vec3 normal = glm::vec3(tri.screen->baryInterpSurfaceNormal(
+                                         frag.vertWeights, frag.depthVec, *tri.v0, *tri.v1, *tri.v2));
+
+        glm::vec3 worldPos = glm::vec3(tri.worldPos0 * frag.perspWeights[0] +
+                                       tri.worldPos1 * frag.perspWeights[1] +
+                                       tri.worldPos2 * frag.perspWeights[2]);
+
+        glm::vec3 light = AccumulateLights(worldPos, normal, glm::vec3(f.camPos), f.ambient,
+                                           *f.lights, *f.lightGrid, *f.shadowMaps,
+                                           frag.x, frag.y);
+        return ClampColor(color * light);
+    }
+};
+
+
+// Output policies
+
+// Writes the shaded color
+struct ColorOutput
+{
+    static void Write(QRgb* line, int x, const glm::vec3& color, float)
+    {
+        line[x] = qRgb(color[0], color[1], color[2]);
+    }
+};
+
+// Writes the fragment's depth as a shade of gray, nearer is brighter
+struct DepthOutput
+{
+    static void Write(QRgb* line, int x, const glm::vec3&, float zDepth)
+    {
+        float shade = 255.f * glm::clamp(1.f / glm::max(zDepth, 1e-6f), 0.f, 1.f);
+        line[x] = qRgb(shade, shade, shade);
+    }
+};
+
+
+// Shading policies. A shading policy is told when each triangle begins and
+// ends and receives every fragment that passes the depth test.
+
+// Shades each fragment as it arrives with the built in texturing and lighting
+template<class Proj, class Tex, class Light, class Out>
+class FixedShading
+{
+public:
+    FixedShading(const FrameState& f)
+        : m_f(f), mp_tri(nullptr), m_shaded(0), m_texture()
+    {}
+
+    void BeginTriangle(TriangleRef& tri, const Triangle& t)
+    {
+        // Pick the mip level once for the whole triangle
+        tri.texLod = Tex::Lod(tri, t);
+
+        // The sampler keeps the tiles it pins from one triangle to the next
+        // while the Polygon stays the same
+        m_texture.Reset(tri.screen->mp_texture.get());
+        tri.texture = &m_texture;
+        mp_tri = &tri;
+    }
+
+    void Shade(int x, int y, const glm::vec3& vertWeights, const glm::vec4& depthVec)
+    {
+        FragmentRef frag = {x, y, vertWeights, depthVec, Proj::PerspWeights(vertWeights, depthVec)};
+
+        glm::vec3 color = Tex::Color(*mp_tri, frag);
+
+        color = Light::Apply(color, *mp_tri, frag, m_f);
+
+        Out::Write(reinterpret_cast<QRgb*>(m_f.image->scanLine(y)), x, color, depthVec[3]);
+        m_shaded++;
+
+        if(m_f.shadeCounts != nullptr)
+        {
+            m_f.shadeCounts[x + 512 * y]++;
+        }
+    }
+
+    void EndTriangle()
+    {
+        if(m_f.stats != nullptr)
+        {
+            m_f.stats->fragmentsShaded += m_shaded;
+            m_f.stats->textureFetches += m_shaded * Tex::FETCHES;
+        }
+        m_shaded = 0;
+    }
+
+private:
+    const FrameState& m_f;
+    const TriangleRef* mp_tri;
+
+    // Fragments shaded since the triangle began
+    long long m_shaded;
+
+    TextureSampler m_texture;
+};
+
+// Shades nothing and writes no color, so only the depth buffer is filled in.
+// Used for shadow maps and any other depth only pass.
+struct DepthOnlyShading
+{
+    void BeginTriangle(TriangleRef&, const Triangle&)
+    {}
+
+    void Shade(int, int, const glm::vec3&, const glm::vec4&)
+    {}
+
+    void EndTriangle()
+    {}
+};
+
+// Collects fragments into a FragmentBatch and hands full batches, and the
+// remainder at the end of each triangle, to a user supplied Shader
+template<class Proj, class Out>
+class BatchedShading
+{
+public:
+    BatchedShading(const FrameState& f, const Shader& shader)
+        : m_f(f), m_shader(shader), m_uniforms(), m_batch(), mp_v0(nullptr),
+          mp_v1(nullptr), mp_v2(nullptr), m_worldPos0(), m_worldPos1(), m_worldPos2()
+    {
+        m_batch.count = 0;
+        m_uniforms.viewMat = f.viewMat;
+        m_uniforms.camPos = f.camPos;
+        m_uniforms.camForward = f.camForward;
+        m_uniforms.lights = f.lights;
+        m_uniforms.lightGrid = f.lightGrid;
+        m_uniforms.ambient = f.ambient;
+        m_uniforms.shadowMaps = f.shadowMaps;
+    }
+
+    void BeginTriangle(TriangleRef& tri, const Triangle& t)
+    {
+        Polygon& screen = *tri.screen;
+        const glm::vec4& p0 = tri.v0->m_pos;
+        const glm::vec4& p1 = tri.v1->m_pos;
+        const glm::vec4& p2 = tri.v2->m_pos;
+
+        m_uniforms.texture = screen.mp_texture.get();
+        m_uniforms.normalMap = screen.mp_normalMap.get();
+        m_uniforms.texLod = screen.calcTexLod(t, p0, p1, p2, m_uniforms.texture);
+        m_uniforms.normLod = screen.calcTexLod(t, p0, p1, p2, m_uniforms.normalMap);
+
+        mp_v0 = tri.v0;
+        mp_v1 = tri.v1;
+        mp_v2 = tri.v2;
+        m_worldPos0 = tri.worldPos0;
+        m_worldPos1 = tri.worldPos1;
+        m_worldPos2 = tri.worldPos2;
+    }
+
+    void Shade(int x, int y, const glm::vec3& vertWeights, const glm::vec4& depthVec)
+    {
+        // Only the weights are stored now; attributes are interpolated for
+        // the whole batch at once when it is flushed
+        glm::vec3 w = Proj::PerspWeights(vertWeights, depthVec);
+
+        int i = m_batch.count++;
+        m_batch.x[i] = x;
+        m_batch.y[i] = y;
+        m_batch.depth[i] = depthVec[3];
+        m_w0[i] = w[0];
+        m_w1[i] = w[1];
+        m_w2[i] = w[2];
+
+        if(m_f.shadeCounts != nullptr)
+        {
+            m_f.shadeCounts[x + 512 * y]++;
+        }
+
+        if(m_batch.count == FragmentBatch::SIZE)
+        {
+            Flush();
+        }
+    }
+
+    void EndTriangle()
+    {
+        Flush();
+    }
+
+private:
+    // Interpolates one attribute across the batch
+    void Interp(float a0, float a1, float a2, float* out)
+    {
+        for(int i = 0; i < m_batch.count; i++)
+        {
+            out[i] = a0 * m_w0[i] + a1 * m_w1[i] + a2 * m_w2[i];
+        }
+    }
+
+    void Flush()
+    {
+        if(m_batch.count == 0)
+        {
+            return;
+        }
+
+        const Vertex& v0 = *mp_v0;
+        const Vertex& v1 = *mp_v1;
+        const Vertex& v2 = *mp_v2;
+
+        Interp(m_worldPos0[0], m_worldPos1[0], m_worldPos2[0], m_batch.px);
+        Interp(m_worldPos0[1], m_worldPos1[1], m_worldPos2[1], m_batch.py);
+        Interp(m_worldPos0[2], m_worldPos1[2], m_worldPos2[2], m_batch.pz);
+        Interp(v0.m_uv[0], v1.m_uv[0], v2.m_uv[0], m_batch.u);
+        Interp(v0.m_uv[1], v1.m_uv[1], v2.m_uv[1], m_batch.v);
+        Interp(v0.m_normal[0], v1.m_normal[0], v2.m_normal[0], m_batch.nx);
+        Interp(v0.m_normal[1], v1.m_normal[1], v2.m_normal[1], m_batch.ny);
+        Interp(v0.m_normal[2], v1.m_normal[2], v2.m_normal[2], m_batch.nz);
+        Interp(v0.m_tangent[0], v1.m_tangent[0], v2.m_tangent[0], m_batch.tx);
+        Interp(v0.m_tangent[1], v1.m_tangent[1], v2.m_tangent[1], m_batch.ty);
+        Interp(v0.m_tangent[2], v1.m_tangent[2], v2.m_tangent[2], m_batch.tz);
+        Interp(v0.m_tangent[3], v1.m_tangent[3], v2.m_tangent[3], m_batch.tw);
+        Interp(v0.m_color[0], v1.m_color[0], v2.m_color[0], m_batch.r);
+        Interp(v0.m_color[1], v1.m_color[1], v2.m_color[1], m_batch.g);
+        Interp(v0.m_color[2], v1.m_color[2], v2.m_color[2], m_batch.b);
+
+        if(m_shader.fragment)
+        {
+            m_shader.fragment(m_batch, m_uniforms);
+        }
+        else
+        {
+            for(int i = 0; i < m_batch.count; i++)
+            {
+                m_batch.outR[i] = m_batch.r[i];
+                m_batch.outG[i] = m_batch.g[i];
+                m_batch.outB[i] = m_batch.b[i];
+            }
+        }
+
+        // Counted as one lookup per fragment from each texture the shader
+        // is given, which is what the built in shaders do
+        if(m_f.stats != nullptr)
+        {
+            m_f.stats->fragmentsShaded += m_batch.count;
+            m_f.stats->textureFetches += m_batch.count * ((m_uniforms.texture != nullptr) +
+                                                          (m_uniforms.normalMap != nullptr));
+        }
+
+        for(int i = 0; i < m_batch.count; i++)
+        {
+            glm::vec3 color = glm::clamp(glm::vec3(m_batch.outR[i], m_batch.outG[i], m_batch.outB[i]),
+                                         0.f, 255.f);
+            Out::Write(reinterpret_cast<QRgb*>(m_f.image->scanLine(m_batch.y[i])),
+                       m_batch.x[i], color, m_batch.depth[i]);
+        }
+
+        m_batch.count = 0;
+    }
+
+    const FrameState& m_f;
+    const Shader& m_shader;
+    ShaderUniforms m_uniforms;
+    FragmentBatch m_batch;
+
+    // Perspective correct weights of the batched fragments
+    float m_w0[FragmentBatch::SIZE];
+    float m_w1[FragmentBatch::SIZE];
+    float m_w2[FragmentBatch::SIZE];
+
+    // The triangle the batch belongs to, and its world space positions
+    const Vertex* mp_v0;
+    const Vertex* mp_v1;
+    const Vertex* mp_v2;
+    glm::vec4 m_worldPos0;
+    glm::vec4 m_worldPos1;
+    glm::vec4 m_worldPos2;
+};
+
+
+// Runs a vertex shader over the Polygon's vertices in batches
+inline void ShadeVertices(Polygon& p, const Shader& shader, const FrameState& f)
+{
+    ShaderUniforms uniforms = ShaderUniforms();
+    uniforms.viewMat = f.viewMat;
+    uniforms.camPos = f.camPos;
+    uniforms.camForward = f.camForward;
+    uniforms.texture = p.mp_texture.get();
+    uniforms.normalMap = p.mp_normalMap.get();
+    uniforms.lights = f.lights;
+    uniforms.lightGrid = f.lightGrid;
+    uniforms.ambient = f.ambient;
+    uniforms.shadowMaps = f.shadowMaps;
+
+    VertexBatch batch;
+
+    for(unsigned int first = 0; first < p.m_verts.size(); first += VertexBatch::SIZE)
+    {
+        batch.count = glm::min(int(p.m_verts.size() - first), VertexBatch::SIZE);
+
+        for(int i = 0; i < batch.count; i++)
+        {
+            const Vertex& v = p.m_verts[first + i];
+            batch.px[i] = v.m_pos[0];
+            batch.py[i] = v.m_pos[1];
+            batch.pz[i] = v.m_pos[2];
+            batch.nx[i] = v.m_normal[0];
+            batch.ny[i] = v.m_normal[1];
+            batch.nz[i] = v.m_normal[2];
+            batch.u[i] = v.m_uv[0];
+            batch.v[i] = v.m_uv[1];
+            batch.r[i] = v.m_color[0];
+            batch.g[i] = v.m_color[1];
+            batch.b[i] = v.m_color[2];
+        }
+
+        shader.vertex(batch, uniforms);
+
+        for(int i = 0; i < batch.count; i++)
+        {
+            Vertex& v = p.m_verts[first + i];
+            v.m_pos = glm::vec4(batch.px[i], batch.py[i], batch.pz[i], 1.f);
+            v.m_normal = glm::vec4(batch.nx[i], batch.ny[i], batch.nz[i], 0.f);
+            v.m_uv = glm::vec2(batch.u[i], batch.v[i]);
+            v.m_color = glm::vec3(batch.r[i], batch.g[i], batch.b[i]);
+        }
+    }
+}
+
+
+// Vertices projected by one task; projection is cheap, so each task needs
+// many to be worth queuing
+const int PROJECT_GRAIN = 1024;
+
+// The transform step: writes the listed vertices of mesh, or all of them if
+// indices is null, into screen, which has room for every vertex of mesh,
+// placed by placement unless it is null and then taken to pixel space. An
+// instance's mesh is read where it is, never copied first. No vertex may be
+// listed twice.
+template<class Proj>
+void TransformVertices(const Polygon& mesh, const Placement* placement, Polygon& screen,
+                       const unsigned int* indices, int count, const FrameState& f)
+{
+    ParallelFor(0, count, PROJECT_GRAIN, [&](int i)
+    {
+        unsigned int v = indices != nullptr ? indices[i] : i;
+        Vertex& out = screen.m_verts[v];
+        out = placement != nullptr ? placement->Place(mesh.m_verts[v]) : mesh.m_verts[v];
+        out.m_pos = Proj::Project(out.m_pos, f);
+    });
+}
+
+// What triangle setup works out for a triangle it keeps, so a triangle
+// drawn in several tiles is only set up once
+struct TriangleSetup
+{
+    Triangle t;         // With its bounding box filled in
+    float signedArea;   // SignedArea2D of its projected vertices
+};
+
+// Triangle setup: everything that can be rejected is, before a single row
+// is visited, reading only the three projected vertices. Returns false for
+// a rejected triangle, or fills in t, a copy of tri with its bounding box,
+// and its signed area.
+template<class Proj>
+bool SetupTriangle(Polygon& screen, const Triangle& tri, const FrameState& f, Triangle& t,
+                   float& signedArea)
+{
+    t = tri;
+
+    const Vertex& vert0 = screen.m_verts[t.m_indices[0]];
+    const Vertex& vert1 = screen.m_verts[t.m_indices[1]];
+    const Vertex& vert2 = screen.m_verts[t.m_indices[2]];
+
+    // The !(> 0) also catches NaN positions.
+    signedArea = SignedArea2D(vert0.m_pos, vert1.m_pos, vert2.m_pos);
+    if(!(std::abs(signedArea) > 0.f) || IsCulled<Proj>(signedArea, screen.m_cullMode) ||
+            Proj::IsClipped(vert0, vert1, vert2, f))
+    {
+        return false;
+    }
+
+    // The rows and columns visited are those of pixel centers inside the
+    // box, so an empty box means the triangle covers no pixel center
+    screen.calcBoundingBox(t);
+    return t.xLeft < t.xRight && t.yUpper < t.yLower;
+}
+
+// Rasterizes a triangle SetupTriangle kept, of a Polygon already taken to
+// pixel space, with the given variant, touching only the pixels inside rect.
+// world holds the same Polygon in world space, or in its own space if
+// transform is set to place it.
+template<class Proj, class Shading>
+void RasterizeTriangle(const Polygon& world, Polygon& screen, const glm::mat4* transform,
+                       const Triangle& t, float signedArea, const ScreenRect& rect,
+                       FrameState& f, Shading& shading)
+{
+    std::array<float, 262144>& currentScreen = *f.depth;
+
+    int yFirst = glm::max(t.yUpper, rect.y0);
+    int yLast = glm::min(glm::min(t.yLower, 512), rect.y1);
+    int xFirst = glm::max(t.xLeft, rect.x0);
+    int xLast = glm::min(glm::min(t.xRight, 512), rect.x1) - 1;
+    if(yFirst >= yLast || xFirst > xLast)
+    {
+        return;
+    }
+
+    const Vertex& vert0 = screen.m_verts[t.m_indices[0]];
+    const Vertex& vert1 = screen.m_verts[t.m_indices[1]];
+    const Vertex& vert2 = screen.m_verts[t.m_indices[2]];
+
+    // Distances to the camera, worked out once per vertex by Project
+    glm::vec3 vertDepths = Proj::VertDepths(vert0, vert1, vert2);
+
+    TriangleRef tri;
+    tri.screen = &screen;
+    tri.v0 = &vert0;
+    tri.v1 = &vert1;
+    tri.v2 = &vert2;
+    tri.worldPos0 = world.m_verts[t.m_indices[0]].m_pos;
+    tri.worldPos1 = world.m_verts[t.m_indices[1]].m_pos;
+    tri.worldPos2 = world.m_verts[t.m_indices[2]].m_pos;
+    if(transform != nullptr)
+    {
+        tri.worldPos0 = *transform * tri.worldPos0;
+        tri.worldPos1 = *transform * tri.worldPos1;
+        tri.worldPos2 = *transform * tri.worldPos2;
+    }
+    tri.texture = nullptr;
+
+    shading.BeginTriangle(tri, t);
+
+    BarySetup bary(vert0.m_pos, vert1.m_pos, vert2.m_pos, signedArea);
+
+    Segment s0(vert0.m_pos, vert1.m_pos);
+    Segment s1(vert1.m_pos, vert2.m_pos);
+    Segment s2(vert2.m_pos, vert0.m_pos);
+
+    long long tested = 0;
+    long long passed = 0;
+
+    // Iterate through each pixel
+    for(int y = yFirst; y < yLast; y++)
+    {
+        float x0 = -1.f;
+        float x1 = -1.f;
+        float x2 = -1.f;
+
+        float enter = -1.f;
+        float exit = -1.f;
+
+        int numIntersections = 0;
+
+        if(s0.getIntersection((float)y, x0))
+        {
+            numIntersections++;
+        }
+        if(s1.getIntersection((float)y, x1))
+        {
+            numIntersections++;
+        }
+        if(s2.getIntersection((float)y, x2))
+        {
+            numIntersections++;
+        }
+
+        // A single intersection touches the triangle at a point; nothing to fill
+        if(numIntersections < 2)
+        {
+            continue;
+        }
+
+        if(x0 == -1.f)
+        {
+            enter = x1;
+            exit = x2;
+        }
+        else
+        {
+            enter = x0;
+            if(x1 == -1.f)
+            {
+                exit = x2;
+            }
+            else
+            {
+                exit = x1;
+            }
+        }
+
+        if(exit < enter)
+        {
+            float temp = exit;
+            exit = enter;
+            enter = temp;
+        }
+
+        // Also rejects NaN intersections from degenerate edges
+        if(!(enter <= exit))
+        {
+            continue;
+        }
+
+        // The span of pixels inside the triangle on this row
+        int xStart = int(glm::max(float(xFirst), std::ceil(enter)));
+        int xEnd = int(glm::min(float(xLast), std::floor(exit)));
+
+        for(int x = xStart; x <= xEnd; x++)
+        {
+            glm::vec3 vertWeights = bary.Weights(float(x), float(y));
+
+            glm::vec4 depthVec = Proj::Depth(screen, vertWeights, vertDepths, vert0);
+            float zDepth = depthVec[3];
+
+            if(!Proj::InRange(zDepth, f))
+            {
+                continue;
+            }
+
+            // Ties go to the fragment drawn last. Each tile draws its
+            // triangles in the order they were submitted, whichever thread
+            // it runs on, so equal depths resolve the same way at any thread
+            // count. After a depth pre-pass only the fragment equal to the
+            // stored depth gets through.
+            tested++;
+            if(f.depthTests != nullptr)
+            {
+                f.depthTests[x + 512 * y]++;
+            }
+
+            if(zDepth <= currentScreen[x + 512 * y])
+            {
+                currentScreen[x + 512 * y] = zDepth;
+                passed++;
+
+                shading.Shade(x, y, vertWeights, depthVec);
+            }
+        }
+    }
+
+    shading.EndTriangle();
+
+    if(f.stats != nullptr)
+    {
+        f.stats->fragmentsTested += tested;
+        f.stats->fragmentsPassed += passed;
+    }
+}
+
+// Rasterizes the listed triangles, already set up, in order, inside rect only.
+// transform, if set, places world as in RasterizeTriangle.
+template<class Proj, class Shading>
+void DrawTriangles(const Polygon& world, Polygon& screen, const glm::mat4* transform,
+                   const TriangleSetup* tris, int count, const ScreenRect& rect,
+                   FrameState& f, Shading& shading)
+{
+    for(int i = 0; i < count; i++)
+    {
+        RasterizeTriangle<Proj>(world, screen, transform, tris[i].t, tris[i].signedArea, rect,
+                                f, shading);
+    }
+}
+
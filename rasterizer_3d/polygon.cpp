@@ -14,7 +14,9 @@ using namespace glm;
 
 // Creates a polygon from the input list of vertex positions and colors
 Polygon::Polygon(const QString& name, const std::vector<glm::vec4>& pos, const std::vector<glm::vec3>& col)
-    : m_tris(), m_verts(), m_name(name), mp_texture(nullptr), mp_normalMap(nullptr)
+    : m_tris(), m_verts(), m_name(name), mp_texture(nullptr), mp_normalMap(nullptr),
+      mp_shader(nullptr), m_bounds(), mp_bvh(nullptr), m_cullMode(CullMode::None),
+      m_occluder(false), mp_occluderProxy(nullptr), mp_lods(nullptr)
 {
     for(unsigned int i = 0; i < pos.size(); i++)
     {
@@ -27,7 +29,9 @@ Polygon::Polygon(const QString& name, const std::vector<glm::vec4>& pos, const s
 // All of its vertices are of color "color", and the polygon is centered at "pos".
 // It is rotated about its center by "rot" degrees, and is scaled from its center by "scale" units
 Polygon::Polygon(const QString& name, int sides, glm::vec3 color, glm::vec4 pos, float rot, glm::vec4 scale)
-    : m_tris(), m_verts(), m_name(name), mp_texture(nullptr), mp_normalMap(nullptr)
+    : m_tris(), m_verts(), m_name(name), mp_texture(nullptr), mp_normalMap(nullptr),
+      mp_shader(nullptr), m_bounds(), mp_bvh(nullptr), m_cullMode(CullMode::None),
+      m_occluder(false), mp_occluderProxy(nullptr), mp_lods(nullptr)
 {
     glm::vec4 v(0.f, 1.f, 0.f, 1.f);
     float angle = 360.f / sides;
@@ -46,31 +50,17 @@ Polygon::Polygon(const QString& name, int sides, glm::vec3 color, glm::vec4 pos,
 
 
 Polygon::Polygon(const QString &name)
-    : m_tris(), m_verts(), m_name(name), mp_texture(nullptr), mp_normalMap(nullptr)
+    : m_tris(), m_verts(), m_name(name), mp_texture(nullptr), mp_normalMap(nullptr),
+      mp_shader(nullptr), m_bounds(), mp_bvh(nullptr), m_cullMode(CullMode::Back),
+      m_occluder(false), mp_occluderProxy(nullptr), mp_lods(nullptr)
 {}
 
 Polygon::Polygon()
-    : m_tris(), m_verts(), m_name("Polygon"), mp_texture(nullptr), mp_normalMap(nullptr)
+    : m_tris(), m_verts(), m_name("Polygon"), mp_texture(nullptr), mp_normalMap(nullptr),
+      mp_shader(nullptr), m_bounds(), mp_bvh(nullptr), m_cullMode(CullMode::Back),
+      m_occluder(false), mp_occluderProxy(nullptr), mp_lods(nullptr)
 {}
 
-Polygon::Polygon(const Polygon& p)
-    : m_tris(p.m_tris), m_verts(p.m_verts), m_name(p.m_name), mp_texture(nullptr), mp_normalMap(nullptr)
-{
-    if(p.mp_texture != nullptr)
-    {
-        mp_texture = new QImage(*p.mp_texture);
-    }
-    if(p.mp_normalMap != nullptr)
-    {
-        mp_normalMap = new QImage(*p.mp_normalMap);
-    }
-}
-
-Polygon::~Polygon()
-{
-    delete mp_texture;
-}
-
 
 // Member Functions
 
@@ -91,6 +81,99 @@ void Polygon::Triangulate()
 }
 
 
+// Calculates every vertex's tangent from the positions and UVs of the
+// triangles around it
+void Polygon::ComputeTangents()
+{
+    vector<vec3> tangents(m_verts.size(), vec3(0.f));
+    vector<vec3> bitangents(m_verts.size(), vec3(0.f));
+
+    // Accumulate each triangle's UV axes onto its vertices
+    for(const Triangle& t : m_tris)
+    {
+        const Vertex& v0 = m_verts[t.m_indices[0]];
+        const Vertex& v1 = m_verts[t.m_indices[1]];
+        const Vertex& v2 = m_verts[t.m_indices[2]];
+
+        vec3 edge1 = vec3(v1.m_pos - v0.m_pos);
+        vec3 edge2 = vec3(v2.m_pos - v0.m_pos);
+        vec2 dUV1 = v1.m_uv - v0.m_uv;
+        vec2 dUV2 = v2.m_uv - v0.m_uv;
+
+        float det = dUV1[0] * dUV2[1] - dUV2[0] * dUV1[1];
+
+        // UVs are degenerate on this triangle
+        if(std::abs(det) < 1e-12f)
+        {
+            continue;
+        }
+
+        vec3 tangent = (edge1 * dUV2[1] - edge2 * dUV1[1]) / det;
+        vec3 bitangent = (edge2 * dUV1[0] - edge1 * dUV2[0]) / det;
+
+        for(int i = 0; i < 3; i++)
+        {
+            tangents[t.m_indices[i]] += tangent;
+            bitangents[t.m_indices[i]] += bitangent;
+        }
+    }
+
+    // Make each tangent perpendicular to its vertex normal
+    for(unsigned int i = 0; i < m_verts.size(); i++)
+    {
+        vec3 normal = vec3(m_verts[i].m_normal);
+        vec3 tangent = tangents[i] - normal * dot(normal, tangents[i]);
+
+        if(length(tangent) < 1e-6f)
+        {
+            // No usable UVs; any direction perpendicular to the normal will do
+            tangent = std::abs(normal[0]) < 0.9f ? cross(normal, vec3(1.f, 0.f, 0.f))
+                                                : cross(normal, vec3(0.f, 1.f, 0.f));
+        }
+        tangent = normalize(tangent);
+
+        float handedness = dot(cross(normal, tangent), bitangents[i]) < 0.f ? -1.f : 1.f;
+
+        m_verts[i].m_tangent = vec4(tangent, handedness);
+    }
+}
+
+bool Polygon::HasTangents() const
+{
+    for(const Vertex& v : m_verts)
+    {
+        if(v.m_tangent[3] == 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Fits m_bounds around the vertices
+void Polygon::ComputeBounds()
+{
+    m_bounds = Bounds();
+    for(const Vertex& v : m_verts)
+    {
+        m_bounds.Add(vec3(v.m_pos));
+    }
+    m_bounds.UpdateSphere();
+
+    // The sphere around the box is loose; shrink it to the furthest vertex
+    if(!m_bounds.IsEmpty())
+    {
+        float radius = 0.f;
+        for(const Vertex& v : m_verts)
+        {
+            radius = glm::max(radius, length(vec3(v.m_pos) - m_bounds.center));
+        }
+        m_bounds.radius = radius;
+    }
+}
+
+
 // Calculate the x and y bounds of the triangle, store in Triangle struct
 void Polygon::calcBoundingBox(Triangle& t)
 {
@@ -125,7 +208,7 @@ void Polygon::calcBoundingBox(Triangle& t)
 
 // Return a vector of influences of vectors on an interior point of
 // a triangle using Barycentric interpolation
-vector<float> Polygon::baryInterp2D(const Triangle& t, const vec4& interiorPt)
+vec3 Polygon::baryInterp2D(const Triangle& t, const vec4& interiorPt) const
 {
     vec4 vert1 = m_verts[t.m_indices[0]].m_pos;
     vec4 vert2 = m_verts[t.m_indices[1]].m_pos;
@@ -140,18 +223,15 @@ vector<float> Polygon::baryInterp2D(const Triangle& t, const vec4& interiorPt)
     s2 /= totalArea;
     s3 /= totalArea;
 
-    std::vector<float> vertWeights  = vector<float>();
-    vertWeights.push_back(s1);
-    vertWeights.push_back(s2);
-    vertWeights.push_back(s3);
-
-    return vertWeights;
+    return vec3(s1, s2, s3);
 }
 
 
-// Returns the color corresponding to the appropriate UV value at this point
-vec3 Polygon::baryInterpUVs(const vector<float>& vertWeights, const vec4& depthVec,
-                            const Vertex& v1, const Vertex& v2, const Vertex& v3, QImage* i)
+// Returns the color corresponding to the appropriate UV value at this point,
+// read from mip level lod of the texture
+vec3 Polygon::baryInterpUVs(const vec3& vertWeights, const vec4& depthVec,
+                            const Vertex& v1, const Vertex& v2, const Vertex& v3,
+                            TextureSampler& texture, float lod)
 {
     vec2 c = depthVec[3] * (((v1.m_uv * vertWeights[0]) / depthVec[0]) +
             ((v2.m_uv * vertWeights[1]) / depthVec[1]) +
@@ -161,40 +241,58 @@ vec3 Polygon::baryInterpUVs(const vector<float>& vertWeights, const vec4& depthV
     {
         return vec3(0.f, 0.f, 0.f);
     }
-    return GetImageColor(c, i);
+    return texture.Sample(c, lod);
 }
 
 
-// Returns a scalar multiple to attenuate color to simulate Lambertian lighting
-float Polygon::baryInterpNormals(const vector<float>& vertWeights, const vec4& depthVec,
-                                 const Vertex& v0, const Vertex& v1, const Vertex& v2,
-                                 const vec4& lookVec)
+// Returns the mip level to sample the given texture at for this triangle,
+// given the screen space positions of its vertices
+float Polygon::calcTexLod(const Triangle& t, const vec4& screenPos0,
+                          const vec4& screenPos1, const vec4& screenPos2,
+                          const Texture* texture) const
 {
-    vec4 c = depthVec[3] * (((v0.m_normal * vertWeights[0]) / depthVec[0]) +
-            ((v1.m_normal * vertWeights[1]) / depthVec[1]) +
-            ((v2.m_normal * vertWeights[2]) / depthVec[2]));
+    if(texture == nullptr)
+    {
+        return 0.f;
+    }
 
-    float scaleFactor = abs(dot(normalize(c), lookVec));
+    const Vertex& v0 = m_verts[t.m_indices[0]];
+    const Vertex& v1 = m_verts[t.m_indices[1]];
+    const Vertex& v2 = m_verts[t.m_indices[2]];
 
-    // Add a bit of ambient lighting
-    scaleFactor += 0.2;
+    // Compare the texel area the triangle covers to its pixel area
+    vec2 texSize = vec2(texture->Width(), texture->Height());
+    float texelArea = tArea2D(vec4(v0.m_uv * texSize, 0.f, 1.f),
+                              vec4(v1.m_uv * texSize, 0.f, 1.f),
+                              vec4(v2.m_uv * texSize, 0.f, 1.f));
+    float screenArea = tArea2D(screenPos0, screenPos1, screenPos2);
 
-    // Make the light brighter
-    scaleFactor *= 1.3;
+    return texture->CalcLod(texelArea, screenArea);
+}
 
-    return scaleFactor;
+
+// Returns the perspective correct surface normal at this point
+vec4 Polygon::baryInterpSurfaceNormal(const vec3& vertWeights, const vec4& depthVec,
+                                      const Vertex& v0, const Vertex& v1, const Vertex& v2)
+{
+    vec3 w = depthVec[3] * vec3(vertWeights[0] / depthVec[0],
+                                vertWeights[1] / depthVec[1],
+                                vertWeights[2] / depthVec[2]);
+
+    vec3 normal = normalize(vec3(v0.m_normal) * w[0] + vec3(v1.m_normal) * w[1] +
+                            vec3(v2.m_normal) * w[2]);
+
+    return vec4(normal, 0.f);
 }
 
 
 // Returns a vector of zDepth information of the fragment being considered (in cameraSpace)
-vec4 Polygon::interpZDepth(const vector<float>& vertWeights, const Triangle& t,
-                           const vec4& worldPos0, const vec4& worldPos1, const vec4& worldPos2,
-                           const vec4& interiorPt, const vec4& camPos)
+vec4 Polygon::interpZDepth(const vec3& vertWeights, const vec3& vertDepths) const
 {
     float zDepth = 0.f;
-    float z1 = glm::length(camPos - worldPos0);
-    float z2 = glm::length(camPos - worldPos1);
-    float z3 = glm::length(camPos - worldPos2);
+    float z1 = vertDepths[0];
+    float z2 = vertDepths[1];
+    float z3 = vertDepths[2];
 
     float zTemp = (vertWeights[0] / z1) + (vertWeights[1] / z2) + (vertWeights[2] / z3);
 
@@ -205,7 +303,7 @@ vec4 Polygon::interpZDepth(const vector<float>& vertWeights, const Triangle& t,
 
 
 // Helper function to calculate the area of a triangle given three vectors
-float Polygon::tArea2D(const vec4& pt1, const vec4& pt2, const vec4& pt3)
+float Polygon::tArea2D(const vec4& pt1, const vec4& pt2, const vec4& pt3) const
 {
     vec3 newPt1 = vec3(pt1[0], pt1[1], 0.f);
     vec3 newPt2 = vec3(pt2[0], pt2[1], 0.f);
@@ -216,7 +314,7 @@ float Polygon::tArea2D(const vec4& pt1, const vec4& pt2, const vec4& pt3)
 
 
 // Helper function to calculate the area of a triangle given three vectors
-float Polygon::tArea3D(const vec4& pt1, const vec4& pt2, const vec4& pt3)
+float Polygon::tArea3D(const vec4& pt1, const vec4& pt2, const vec4& pt3) const
 {
     vec3 newPt1 = vec3(pt1[0], pt1[1], pt1[2]);
     vec3 newPt2 = vec3(pt2[0], pt2[1], pt2[2]);
@@ -227,12 +325,12 @@ float Polygon::tArea3D(const vec4& pt1, const vec4& pt2, const vec4& pt3)
 
 
 
-void Polygon::SetTexture(QImage* i)
+void Polygon::SetTexture(std::shared_ptr<Texture> i)
 {
     mp_texture = i;
 }
 
-void Polygon::SetNormalMap(QImage* i)
+void Polygon::SetNormalMap(std::shared_ptr<Texture> i)
 {
     mp_normalMap = i;
 }
@@ -274,22 +372,3 @@ Vertex Polygon::VertAt(unsigned int i) const
 {
     return m_verts[i];
 }
-
-glm::vec3 GetImageColor(const glm::vec2 &uv_coord, const QImage* const image)
-{
-
-    if(image)
-    {
-        int X = glm::min(image->width() * uv_coord.x, image->width() - 1.0f);
-        int Y = glm::min(image->height() * (1.0f - uv_coord.y), image->height() - 1.0f);
-
-        if(X < 0.f  || Y < 0.f)
-        {
-            return vec3(128.f, 128.f, 128.f);
-        }
-
-        QColor color = image->pixel(X, Y);
-        return glm::vec3(color.red(), color.green(), color.blue());
-    }
-    return glm::vec3(255.f, 255.f, 255.f);
-}
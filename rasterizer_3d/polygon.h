@@ -6,6 +6,13 @@
 #include <QString>
 #include <QImage>
 #include <QColor>
+#include <memory>
+#include "texture.h"
+#include "shader.h"
+#include "bounds.h"
+#include "bvh.h"
+
+class LodChain;
 
 // A Vertex is a point in space that defines one corner of a polygon.
 // Each Vertex has several attributes that determine how they contribute to the
@@ -14,11 +21,13 @@ struct Vertex
 {
     glm::vec4 m_pos;    // The position of the vertex. In hw02, this is in pixel space.
     glm::vec3 m_color;  // The color of the vertex. X corresponds to Red, Y corresponds to Green, and Z corresponds to Blue.
-    glm::vec4 m_normal; // The surface normal of the vertex (not yet used)
-    glm::vec2 m_uv;     // The texture coordinates of the vertex (not yet used)
+    glm::vec4 m_normal; // The surface normal of the vertex
+    glm::vec2 m_uv;     // The texture coordinates of the vertex
+    glm::vec4 m_tangent; // The direction of increasing U along the surface. W is +1 or -1 depending on
+                         // whether the bitangent is cross(normal, tangent) or its opposite.
 
-    Vertex(glm::vec4 p, glm::vec3 c, glm::vec4 n, glm::vec2 u)
-        : m_pos(p), m_color(c), m_normal(n), m_uv(u)
+    Vertex(glm::vec4 p, glm::vec3 c, glm::vec4 n, glm::vec2 u, glm::vec4 t = glm::vec4())
+        : m_pos(p), m_color(c), m_normal(n), m_uv(u), m_tangent(t)
     {}
 };
 
@@ -37,6 +46,15 @@ struct Triangle
     int yLower;
 };
 
+// Which triangles are thrown away before they are drawn, going by the way
+// they wind on screen. Front faces wind counter-clockwise as displayed.
+enum class CullMode
+{
+    None,
+    Back,
+    Front
+};
+
 class Polygon
 {
 public:
@@ -45,30 +63,59 @@ public:
     std::vector<Vertex> m_verts;
     // The name of this polygon, primarily to help you debug
     QString m_name;
-    // The image that can be read to determine pixel color when used in conjunction with UV coordinates
-    // Not used until homework 3.
-    QImage* mp_texture;
+    // The image that can be read to determine pixel color when used in conjunction with UV coordinates.
+    // Shared between copies of the Polygon; its texels live in a TextureCache.
+    std::shared_ptr<Texture> mp_texture;
     // The image that can be read to determine surface normal offset when used in conjunction with UV coordinates
-    // Not used until homework 3
-    QImage* mp_normalMap;
+    std::shared_ptr<Texture> mp_normalMap;
+    // Replaces the built in texturing and lighting when set
+    std::shared_ptr<Shader> mp_shader;
+    // World space box and sphere around the vertices, set by ComputeBounds
+    Bounds m_bounds;
+    // Hierarchy over clusters of m_tris for meshes too big to draw or cull
+    // as a whole. Shared between copies; may be null.
+    std::shared_ptr<MeshBVH> mp_bvh;
+    // Back for meshes loaded from OBJ files, None for 2D polygons, whose
+    // vertices may be listed in either order
+    CullMode m_cullMode;
+    // Whether all of this Polygon's triangles hide what is behind them in
+    // occlusion culling, not just its largest ones
+    bool m_occluder;
+    // Stands in for this Polygon when occluders are drawn, if set. It must lie
+    // within the Polygon, so that it never hides anything the Polygon does not.
+    std::shared_ptr<Polygon> mp_occluderProxy;
+    // Simplified versions drawn instead when the Polygon is small on screen.
+    // Shared between copies; may be null.
+    std::shared_ptr<LodChain> mp_lods;
 
     // Polygon class constructors
     Polygon(const QString& name, const std::vector<glm::vec4>& pos, const std::vector<glm::vec3> &col);
     Polygon(const QString& name, int sides, glm::vec3 color, glm::vec4 pos, float rot, glm::vec4 scale);
     Polygon(const QString& name);
     Polygon();
-    Polygon(const Polygon& p);
-    ~Polygon();
 
 
 
     void Triangulate();
 
-    // Copies the input QImage into this Polygon's texture
-    void SetTexture(QImage*);
+    // Calculates every vertex's tangent from the positions and UVs of the
+    // triangles around it. Done once at load so normal mapping costs no
+    // per-fragment tangent math.
+    void ComputeTangents();
 
-    // Copies the input QImage into this Polygon's normal map
-    void SetNormalMap(QImage*);
+    // Whether every vertex has a tangent. ComputeTangents sets each W to +1
+    // or -1, so a vertex whose W is still 0 has none.
+    bool HasTangents() const;
+
+    // Fits m_bounds around the vertices. Done once when the scene is loaded,
+    // so whole objects can be culled without touching their vertices.
+    void ComputeBounds();
+
+    // Sets this Polygon's texture
+    void SetTexture(std::shared_ptr<Texture>);
+
+    // Sets this Polygon's normal map
+    void SetNormalMap(std::shared_ptr<Texture>);
 
     // Various getter, setter, and adder functions
     void AddVertex(const Vertex&);
@@ -89,33 +136,32 @@ public:
 
     // Return a vector of influences of vectors on an interior point of
     // a triangle using Barycentric interpolation
-    std::vector<float> baryInterp2D(const Triangle& t, const glm::vec4& interiorPt);
+    glm::vec3 baryInterp2D(const Triangle& t, const glm::vec4& interiorPt) const;
 
+    // Returns the vertex depths along with the zDepth of the fragment being considered
+    glm::vec4 interpZDepth(const glm::vec3& vertWeights, const glm::vec3& vertDepths) const;
 
-    // Returns the zDepth of the fragment being considered
-    glm::vec4 interpZDepth(const std::vector<float>& vertWeights, const Triangle& t,
-                           const glm::vec4& worldPos0, const glm::vec4& worldPos1,
-                           const glm::vec4& worldPos2, const glm::vec4& interiorPt,
-                           const glm::vec4& camDepth);
+    // Returns the color corresponding to the appropriate UV value at this point,
+    // read from mip level lod of the texture
+    glm::vec3 baryInterpUVs(const glm::vec3& vertWeights, const glm::vec4& depthVec,
+                            const Vertex& v0, const Vertex& v1, const Vertex& V2,
+                            TextureSampler& texture, float lod);
 
-    // Returns the color corresponding to the appropriate UV value at this point
-    glm::vec3 baryInterpUVs(const std::vector<float>& vertWeights, const glm::vec4& depthVec,
-                            const Vertex& v0, const Vertex& v1, const Vertex& V2, QImage*);
+    // Returns the mip level to sample the given texture at for this triangle,
+    // given the screen space positions of its vertices
+    float calcTexLod(const Triangle& t, const glm::vec4& screenPos0,
+                     const glm::vec4& screenPos1, const glm::vec4& screenPos2,
+                     const Texture* texture) const;
 
-    // Returns a scalar multiple to attenuate color to simulate Lambertian lighting
-    float baryInterpNormals(const std::vector<float>& vertWeights, const glm::vec4& depthVec,
-                            const Vertex& v0, const Vertex& v1, const Vertex& v2,
-                            const glm::vec4& lookVec);
+    // Returns the perspective correct surface normal at this point
+    glm::vec4 baryInterpSurfaceNormal(const glm::vec3& vertWeights, const glm::vec4& depthVec,
+                                      const Vertex& v0, const Vertex& v1, const Vertex& v2);
 
     // Helper function to calculate the area of a triangle given three vectors
-    float tArea2D(const glm::vec4& pt1, const glm::vec4& pt2, const glm::vec4& pt3);
+    float tArea2D(const glm::vec4& pt1, const glm::vec4& pt2, const glm::vec4& pt3) const;
 
     // Helper function to calculate the area of a triangle given three vectors
-    float tArea3D(const glm::vec4& pt1, const glm::vec4& pt2, const glm::vec4& pt3);
+    float tArea3D(const glm::vec4& pt1, const glm::vec4& pt2, const glm::vec4& pt3) const;
 
 
 };
-
-// Returns the color of the pixel in the image at the specified texture coordinates.
-// Returns white if the image is a null pointer
-glm::vec3 GetImageColor(const glm::vec2 &uv_coord, const QImage* const image);
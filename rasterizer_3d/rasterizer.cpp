@@ -7,406 +7,1234 @@
 #include <iostream>
 #include <cmath>
 #include <array>
+#include <cfloat>
+#include <algorithm>
+#include <utility>
 #include "segment.h"
 #include "camera.h"
+#include "pipeline.h"
+#include "drawlist.h"
+#include "lod.h"
+#include "tiles.h"
+#include "jobs.h"
+#include "trace.h"
+#include "heatmap.h"
 
 using namespace glm;
 
 using namespace std;
 
 
-Rasterizer::Rasterizer(const std::vector<Polygon>& polygons)
-    : m_polygons(polygons), camera(Camera()), perspPovMat(camera.getPerspProjMat())
-{}
+// Fits the bounds of a Polygon, and builds its levels of detail and BVH if
+// it is large enough and was not loaded with them
+static void PreparePolygon(Polygon& p)
+{
+    // Before the levels of detail are built, so they get the tangents too
+    if(p.mp_normalMap != nullptr && !p.HasTangents())
+    {
+        p.ComputeTangents();
+    }
+    if(p.m_bounds.IsEmpty())
+    {
+        p.ComputeBounds();
+    }
+    if(p.mp_lods == nullptr && p.m_tris.size() >= 2 * LodChain::MIN_TRIANGLES)
+    {
+        p.mp_lods = LodChain::Build(p);
+    }
+    if(p.mp_bvh == nullptr && p.m_tris.size() > Meshlet::MAX_TRIANGLES)
+    {
+        p.mp_bvh = MeshBVH::Build(p);
+    }
+}
 
-QImage Rasterizer::RenderScene()
+
+// Draws each Polygon once, where it is
+Rasterizer::Rasterizer(std::vector<Polygon> polygons, TextureCache* textureCache)
+    : Rasterizer(std::move(polygons), SceneGraph(), textureCache)
 {
-    QImage result(512, 512, QImage::Format_RGB32);
-    // Fill the image with black pixels.
-    // Note that qRgb creates a QColor,
-    // and takes in values [0, 255] rather than [0, 1].
-    result.fill(qRgb(0.f, 0.f, 0.f));
+    for(unsigned int i = 0; i < m_polygons.size(); i++)
+    {
+        scene.AddNode(-1, mat4(1.f), i);
+    }
+    UpdateScene();
+}
 
-    // Set scene to be in 3D or in 2D
-    bool threeD = true;
+Rasterizer::Rasterizer(std::vector<Polygon> polygons, SceneGraph graph,
+                       TextureCache* textureCache)
+    : m_polygons(std::move(polygons)), mp_textureCache(textureCache), m_occluders(),
+      m_occlusion(), m_nodeOccluders(), scene(std::move(graph)),
+      camera(Camera()), perspPovMat(camera.getPerspProjMat()), projection(Projection::Pinhole),
+      lighting(Lighting::Lambert), outputFormat(OutputFormat::Color), focalLength(0.3f),
+      depthPrepass(false), sortFrontToBack(false), occlusionCulling(true), lights(),
+      ambient(0.2f), shadowMaps(), stats()
+{
+    // Each mesh's levels of detail and BVH are built on their own thread
+    ParallelFor(0, m_polygons.size(), 1, [this](int i)
+    {
+        PreparePolygon(m_polygons[i]);
+    });
 
-    // Use a fish eye or a normal pinhole lens
-    bool fishEye = false;
-    // Fractional focal length if a fish eye lens is used
-    double focalLength = 0.3;
+    UpdateScene();
+}
 
 
-    bool paint = false;
+// Adds a Polygon for scene graph nodes to draw
+int Rasterizer::AddPolygon(Polygon p)
+{
+    PreparePolygon(p);
+    m_polygons.push_back(p);
+    return m_polygons.size() - 1;
+}
 
-    // Render 2D scene
-    if(threeD == false)
+// Swaps in a new version of a Polygon under every node drawing it
+void Rasterizer::ReplacePolygon(int polygon, Polygon p)
+{
+    if(polygon < 0 || polygon >= int(m_polygons.size()))
     {
-        float red = 0.f;
-        float blue = 0.f;
-        float green = 0.f;
+        return;
+    }
 
-        std::array<float, 262144> currentScreen;
+    // An edited copy of the old Polygon still shares its BVH and levels of
+    // detail, which no longer fit it
+    const Polygon& old = m_polygons[polygon];
+    if(p.mp_bvh == old.mp_bvh)
+    {
+        p.mp_bvh = nullptr;
+    }
+    if(p.mp_lods == old.mp_lods)
+    {
+        p.mp_lods = nullptr;
+    }
+    p.ComputeBounds();
+    PreparePolygon(p);
+    m_polygons[polygon] = p;
+    scene.PolygonChanged(polygon);
+}
 
-        currentScreen.fill(1.f);
+// Stops every node drawing a Polygon and frees it, keeping its index
+void Rasterizer::RemovePolygon(int polygon)
+{
+    if(polygon < 0 || polygon >= int(m_polygons.size()))
+    {
+        return;
+    }
 
-        for(Polygon p : m_polygons)
+    for(int i = 0; i < scene.NumNodes(); i++)
+    {
+        if(scene.Node(i).instance.polygon == polygon)
         {
-            for(Triangle t : p.m_tris)
-            {
-                Vertex vert0 = p.m_verts[t.m_indices[0]];
-                Vertex vert1 = p.m_verts[t.m_indices[1]];
-                Vertex vert2 = p.m_verts[t.m_indices[2]];
+            scene.SetPolygon(i, -1);
+        }
+    }
+    m_polygons[polygon] = Polygon();
+}
 
-                Segment s0(vert0.m_pos, vert1.m_pos);
-                Segment s1(vert1.m_pos, vert2.m_pos);
-                Segment s2(vert2.m_pos, vert0.m_pos);
 
-                // Iterate through each pixel
-                for(int y = t.yUpper; y < t.yLower && y < 512; y++)
-                {
-                    float x0 = -1.f;
-                    float x1 = -1.f;
-                    float x2 = -1.f;
+// Whether anything within bounds can be in a light's shadow maps
+static bool LightReaches(const Light& l, const Bounds& bounds)
+{
+    return !bounds.IsEmpty() &&
+            length(vec3(l.position) - bounds.center) <= l.range + bounds.radius;
+}
 
-                    float enter = -1.f;
-                    float exit = -1.f;
+// Brings the scene graph up to date. If anything moved, picks the occluders
+// again and drops the shadow maps of the lights reaching it.
+void Rasterizer::UpdateScene()
+{
+    Bounds moved;
+    vector<int> changed;
+    if(!scene.Update(m_polygons, &moved, &changed))
+    {
+        return;
+    }
 
-                    int numIntersections = 0;
+    GatherOccluders(changed);
+    for(unsigned int i = 0; i < shadowMaps.size() && i < lights.size(); i++)
+    {
+        if(LightReaches(lights[i], moved))
+        {
+            shadowMaps[i].Clear();
+        }
+    }
+}
 
-                    if(s0.getIntersection((float)y, x0))
-                    {
-                        numIntersections++;
-                    }
-                    if(s1.getIntersection((float)y, x1))
-                    {
-                        numIntersections++;
-                    }
-                    if(s2.getIntersection((float)y, x2))
-                    {
-                        numIntersections++;
-                    }
 
-                    if(numIntersections < 1)
+// Places a node's candidate occluders in world space: every triangle of a
+// Polygon marked as an occluder, or of its proxy, or else only its largest,
+// since no more than MAX_OCCLUDERS of one node's triangles are ever picked
+void Rasterizer::PlaceOccluders(int node)
+{
+    NodeOccluders& candidates = m_nodeOccluders[node];
+    candidates.marked = false;
+    candidates.tris.clear();
+    candidates.areas.clear();
+
+    if(!scene.IsLive(node))
+    {
+        return;
+    }
+    const Instance& inst = scene.Node(node).instance;
+    if(inst.polygon < 0)
+    {
+        return;
+    }
+
+    // Vertex shaders move vertices every frame
+    const Polygon& original = m_polygons[inst.polygon];
+    if(original.mp_shader != nullptr && original.mp_shader->vertex)
+    {
+        return;
+    }
+
+    candidates.marked = original.m_occluder || original.mp_occluderProxy != nullptr;
+    const Polygon& p = original.mp_occluderProxy != nullptr ? *original.mp_occluderProxy
+                                                            : original;
+
+    CullMode cull = PlacedCullMode(original.m_cullMode, inst.transform);
+
+    vector<Occluder> placed;
+    vector<float> areas;
+    for(const Triangle& t : p.m_tris)
+    {
+        Occluder o;
+        o.v0 = vec3(inst.transform * p.m_verts[t.m_indices[0]].m_pos);
+        o.v1 = vec3(inst.transform * p.m_verts[t.m_indices[1]].m_pos);
+        o.v2 = vec3(inst.transform * p.m_verts[t.m_indices[2]].m_pos);
+        o.cull = cull;
+
+        placed.push_back(o);
+        areas.push_back(0.5f * length(cross(o.v1 - o.v0, o.v2 - o.v0)));
+    }
+
+    if(candidates.marked)
+    {
+        candidates.tris.swap(placed);
+        return;
+    }
+
+    vector<int> order(areas.size());
+    for(unsigned int i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    int kept = glm::min(int(order.size()), OcclusionBuffer::MAX_OCCLUDERS);
+    partial_sort(order.begin(), order.begin() + kept, order.end(), [&](int a, int b)
+    {
+        return areas[a] > areas[b];
+    });
+
+    for(int i = 0; i < kept; i++)
+    {
+        candidates.tris.push_back(placed[order[i]]);
+        candidates.areas.push_back(areas[order[i]]);
+    }
+}
+
+
+// Picks the triangles drawn into the occlusion buffer every frame: all of
+// those of Polygons marked as occluders, or of their proxies, and the
+// largest of the rest. Only the nodes that changed are placed again; the
+// others keep their candidates from before.
+void Rasterizer::GatherOccluders(const vector<int>& changed)
+{
+    m_nodeOccluders.resize(scene.NumNodes());
+    for(int node : changed)
+    {
+        if(node < int(m_nodeOccluders.size()))
+        {
+            PlaceOccluders(node);
+        }
+    }
+
+    m_occluders.clear();
+
+    Bounds all;
+    for(int i = 0; i < scene.NumNodes(); i++)
+    {
+        all.Add(scene.Node(i).instance.bounds);
+    }
+    all.UpdateSphere();
+    if(all.IsEmpty())
+    {
+        return;
+    }
+
+    // Smaller triangles cover too little of the screen to hide anything
+    float minArea = 3.14159f * all.radius * all.radius / 256.f;
+
+    vector<const Occluder*> large;
+    vector<float> areas;
+
+    for(const NodeOccluders& candidates : m_nodeOccluders)
+    {
+        if(candidates.marked)
+        {
+            m_occluders.insert(m_occluders.end(), candidates.tris.begin(),
+                               candidates.tris.end());
+            continue;
+        }
+
+        for(unsigned int i = 0; i < candidates.tris.size() && candidates.areas[i] >= minArea;
+            i++)
+        {
+            large.push_back(&candidates.tris[i]);
+            areas.push_back(candidates.areas[i]);
+        }
+    }
+
+    // Keep only the largest of the rest
+    vector<int> order(areas.size());
+    for(unsigned int i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    int kept = glm::min(int(order.size()), OcclusionBuffer::MAX_OCCLUDERS);
+    partial_sort(order.begin(), order.begin() + kept, order.end(), [&](int a, int b)
+    {
+        return areas[a] > areas[b];
+    });
+
+    for(int i = 0; i < kept; i++)
+    {
+        m_occluders.push_back(*large[order[i]]);
+    }
+}
+
+
+// Selects the output variant and draws the run's triangles
+template<class Proj, class Tex, class Light>
+static void DrawWithOutput(OutputFormat output, const TileDraw& d, FrameState& f)
+{
+    if(output == OutputFormat::Depth)
+    {
+        FixedShading<Proj, Tex, Light, DepthOutput> shading(f);
+        DrawTriangles<Proj>(*d.world, *d.screen, d.transform, d.tris, d.count, d.rect, f, shading);
+    }
+    else
+    {
+        FixedShading<Proj, Tex, Light, ColorOutput> shading(f);
+        DrawTriangles<Proj>(*d.world, *d.screen, d.transform, d.tris, d.count, d.rect, f, shading);
+    }
+}
+
+// Draws the triangles with a batched Shader
+template<class Proj>
+static void DrawWithShader(OutputFormat output, const TileDraw& d, FrameState& f,
+                           const Shader& shader)
+{
+    if(output == OutputFormat::Depth)
+    {
+        BatchedShading<Proj, DepthOutput> shading(f, shader);
+        DrawTriangles<Proj>(*d.world, *d.screen, d.transform, d.tris, d.count, d.rect, f, shading);
+    }
+    else
+    {
+        BatchedShading<Proj, ColorOutput> shading(f, shader);
+        DrawTriangles<Proj>(*d.world, *d.screen, d.transform, d.tris, d.count, d.rect, f, shading);
+    }
+}
+
+// The built in shader that lights normal mapped Polygons
+static const Shader& NormalMappedShader(Lighting lighting)
+{
+    static const shared_ptr<Shader> lambert = LambertShader();
+    static const shared_ptr<Shader> sceneLights = SceneLightShader();
+    return lighting == Lighting::SceneLights ? *sceneLights : *lambert;
+}
+
+// Selects the lighting variant from the settings
+template<class Proj, class Tex>
+static void DrawWithLighting(Lighting lighting, OutputFormat output, const TileDraw& d,
+                             FrameState& f)
+{
+    if(lighting == Lighting::Unlit)
+    {
+        DrawWithOutput<Proj, Tex, UnlitLighting>(output, d, f);
+    }
+    else if(lighting == Lighting::SceneLights)
+    {
+        DrawWithOutput<Proj, Tex, SceneLighting>(output, d, f);
+    }
+    else
+    {
+        DrawWithOutput<Proj, Tex, LambertLighting>(output, d, f);
+    }
+}
+
+// Selects the texturing variant from the Polygon's texture, unless the
+// Polygon brings its own Shader. Lit normal mapped Polygons go through the
+// batched shaders, which interpolate, sample the normal map and light a
+// batch of fragments at a time.
+template<class Proj>
+static void DrawWithTexturing(Lighting lighting, OutputFormat output, const TileDraw& d,
+                              FrameState& f)
+{
+    const Polygon& p = *d.world;
+
+    if(p.mp_shader != nullptr)
+    {
+        DrawWithShader<Proj>(output, d, f, *p.mp_shader);
+    }
+    else if(p.mp_normalMap != nullptr && lighting != Lighting::Unlit)
+    {
+        DrawWithShader<Proj>(output, d, f, NormalMappedShader(lighting));
+    }
+    else if(p.mp_texture != nullptr)
+    {
+        DrawWithLighting<Proj, TexturedTexturing>(lighting, output, d, f);
+    }
+    else
+    {
+        DrawWithLighting<Proj, UntexturedTexturing>(lighting, output, d, f);
+    }
+}
+
+// Draws every tile on its own thread, each tile's bin in order.
+// draw(run, f) draws a run of one DrawCall's triangles within its tile,
+// counting the fragments it tests and shades in f.stats. f.stats, if set,
+// is then given the totals, and f.tileNanos, if set, each tile's time.
+template<class Draw>
+static void DrawTiles(const DrawList& drawList, const TileBins& bins, const FrameState& f,
+                      Draw draw)
+{
+    std::array<RenderStats, TileBins::NUM_TILES> tileStats;
+
+    ParallelFor(0, TileBins::NUM_TILES, 1, [&](int tile)
+    {
+        long long start = f.tileNanos != nullptr ? Trace::Now() : 0;
+        FrameState tileState = f;
+        tileState.stats = &tileStats[tile];
+
+        const TileBin& bin = bins.Bin(tile);
+        for(const BinRun& run : bin.runs)
+        {
+            const DrawCall& call = drawList.Calls()[run.call];
+            TileDraw d = {call.world, call.screen, call.placed ? &call.transform : nullptr,
+                          &bin.tris[run.first], run.count, TileBins::Rect(tile)};
+            draw(d, tileState);
+        }
+
+        if(f.tileNanos != nullptr)
+        {
+            f.tileNanos[tile] += Trace::Now() - start;
+        }
+    });
+
+    if(f.stats != nullptr)
+    {
+        for(const RenderStats& stats : tileStats)
+        {
+            f.stats->AddFragments(stats);
+        }
+    }
+}
+
+// Draws every binned triangle into the depth buffer only
+template<class Proj>
+static void DrawDepthOnly(const DrawList& drawList, const TileBins& bins, const FrameState& f)
+{
+    DrawTiles(drawList, bins, f, [](const TileDraw& d, FrameState& tileState)
+    {
+        DepthOnlyShading shading;
+        DrawTriangles<Proj>(*d.world, *d.screen, d.transform, d.tris, d.count, d.rect,
+                            tileState, shading);
+    });
+}
+
+
+// Returns the Polygon an instance draws. A Polygon with a vertex shader gets
+// a world space copy in shaded for the shader to run on; any other is
+// returned as it is, shared by all its instances, for the transform step to
+// place as it projects the vertices.
+static const Polygon& WorldPolygon(const Polygon& original, const Instance& inst,
+                                   Polygon& shaded, const FrameState& f)
+{
+    bool deformed = original.mp_shader != nullptr && original.mp_shader->vertex;
+    if(!deformed)
+    {
+        return original;
+    }
+
+    shaded = original;
+    if(!inst.IsIdentity())
+    {
+        PlaceInstance(shaded, inst.transform);
+    }
+    ShadeVertices(shaded, *original.mp_shader, f);
+    return shaded;
+}
+
+
+// Readies a screen space slot for the transform step to write world's
+// vertices into. Slots are kept from frame to frame, so once they are big
+// enough nothing is allocated; only what the pipeline reads of the Polygon
+// itself is set, and the textures are shared, not copied.
+static void BeginScreen(const Polygon& world, const mat4* transform, Polygon& screen)
+{
+    if(!world.m_verts.empty())
+    {
+        screen.m_verts.resize(world.m_verts.size(), world.m_verts[0]);
+    }
+    screen.mp_texture = world.mp_texture;
+    screen.mp_normalMap = world.mp_normalMap;
+    screen.m_cullMode = transform != nullptr ? PlacedCullMode(world.m_cullMode, *transform)
+                                             : world.m_cullMode;
+}
+
+
+// Places, shades and projects every scene graph node that may be visible
+// and adds its triangles to the draw list, returning how many nodes drew
+// anything. Every vertex is placed and projected at most once. Whole
+// subtrees outside the frustum or hidden by the occluders are skipped at
+// their root. A mesh small enough on screen adds one of its simplified
+// levels of detail instead. A mesh with a BVH only adds, and only projects
+// the vertices of, the meshlets inside the frustum, not hidden by the
+// occluders and, if cullBackFaces is set and the mesh culls back faces,
+// facing the camera, nearest first. frustum and occlusion are null when
+// nothing can be culled by them.
+template<class Proj>
+static int BuildDrawList(const vector<Polygon>& polygons, const SceneGraph& scene,
+                         const Frustum* frustum, OcclusionBuffer* occlusion,
+                         bool cullBackFaces, const FrameState& f, vector<Polygon>& shaded,
+                         vector<Polygon>& screens, DrawList& drawList)
+{
+    vec3 eye = vec3(f.camPos);
+    int drawn = 0;
+
+    // The draw list points into screens, so it never grows once nodes are added
+    shaded.resize(scene.NumNodes());
+    if(int(screens.size()) < scene.NumNodes())
+    {
+        screens.resize(scene.NumNodes());
+    }
+
+    auto culled = [&](const Bounds& bounds)
+    {
+        return (frustum != nullptr && frustum->Excludes(bounds)) ||
+                (occlusion != nullptr && occlusion->Occludes(bounds));
+    };
+
+    scene.Traverse([&](int i, const SceneNode& sceneNode)
+    {
+        // A vertex shader may move vertices out of the bounds computed at
+        // load, so subtrees holding one are never culled as a whole
+        if(sceneNode.subtreeBounds.IsEmpty() || (!sceneNode.unbounded && culled(sceneNode.subtreeBounds)))
+        {
+            return false;
+        }
+
+        const Instance& inst = sceneNode.instance;
+        if(inst.polygon < 0)
+        {
+            return true;
+        }
+        const Polygon& original = polygons[inst.polygon];
+
+        // Meshes keep their BVHs and levels of detail in their own space
+        bool moved = !inst.IsIdentity();
+        vec3 localEye = moved ? vec3(inverse(inst.transform) * vec4(eye, 1.f)) : eye;
+
+        // Nor are Polygons with a vertex shader themselves
+        bool deformed = original.mp_shader != nullptr && original.mp_shader->vertex;
+        const Frustum* cull = deformed ? nullptr : frustum;
+        OcclusionBuffer* occlude = deformed ? nullptr : occlusion;
+
+        // Objects out of view or hidden are never copied or transformed.
+        // A leaf's own bounds are its subtree's, already tested above.
+        if(!deformed && !sceneNode.children.empty() && culled(inst.bounds))
+        {
+            return true;
+        }
+
+        // The mesh stays as it is, in its own space unless a vertex shader
+        // has made it a world space copy, and keeps both world and screen
+        // space coordinates at hand for the pipeline
+        const Polygon& p = WorldPolygon(original, inst, shaded[i], f);
+        const mat4* transform = moved && &p == &original ? &inst.transform : nullptr;
+        Placement placement(transform != nullptr ? *transform : mat4(1.f));
+        const Placement* place = transform != nullptr ? &placement : nullptr;
+
+        // The screen copy is only kept if the node adds a draw call; a mesh
+        // whose meshlets are all culled hands it on to the next node
+        Polygon& pCopy = screens[drawn];
+        BeginScreen(p, transform, pCopy);
+        size_t calls = drawList.Calls().size();
+
+        // Meshes far enough away are drawn with fewer, larger triangles
+        int lod = 0;
+        if(original.mp_lods != nullptr)
+        {
+            lod = original.mp_lods->Select(inst.bounds, eye, f.lodScale * inst.MaxScale());
+        }
+
+        if(lod > 0)
+        {
+            const LodLevel& level = original.mp_lods->Level(lod);
+            TransformVertices<Proj>(p, place, pCopy, level.vertices.data(),
+                                    level.vertices.size(), f);
+            drawList.Add(p, pCopy, level.tris.data(), 0, level.tris.size(), inst.bounds.center,
+                         transform);
+        }
+        else if(original.mp_bvh != nullptr && !deformed)
+        {
+            const MeshBVH& bvh = *original.mp_bvh;
+            const vector<unsigned int>& meshletVerts = bvh.MeshletVertices();
+
+            // Meshlets share the vertices along their borders, so the
+            // visible ones' vertices are gathered first and each transformed once
+            vector<bool> listed(p.m_verts.size(), false);
+            vector<unsigned int> visibleVerts;
+
+            bvh.Traverse(localEye, [&](const BVHNode& node)
+            {
+                Bounds bounds = moved ? node.bounds.Transformed(inst.transform) : node.bounds;
+                if((cull != nullptr && cull->Excludes(bounds)) ||
+                        (occlude != nullptr && occlude->Occludes(bounds)))
+                {
+                    return false;
+                }
+                if(node.IsLeaf())
+                {
+                    // Which side of a plane the eye is on survives any
+                    // transform, so the cone is tested in the mesh's space
+                    const Meshlet& m = bvh.Meshlets()[node.meshlet];
+                    if(cullBackFaces && original.m_cullMode == CullMode::Back &&
+                            m.IsBackFacing(localEye))
                     {
-                        continue;
+                        return false;
                     }
-                    else if(numIntersections == 1)
-                    {
-                        if(x0 == -1.f)
-                        {
-                            enter = x0;
-                        }
-                        else if(x1 != -1.f)
-                        {
-                            enter = x1;
-                        }
-                        else
-                        {
-                            enter = x2;
-                        }
-                    }
-                    else
+
+                    for(int v = m.firstVertex; v < m.firstVertex + m.vertexCount; v++)
                     {
-                        if(x0 == -1.f)
+                        if(!listed[meshletVerts[v]])
                         {
-                            enter = x1;
-                            exit = x2;
-                        }
-                        else
-                        {
-                            enter = x0;
-                            if(x1 == -1.f)
-                            {
-                                exit = x2;
-                            }
-                            else
-                            {
-                                exit = x1;
-                            }
+                            listed[meshletVerts[v]] = true;
+                            visibleVerts.push_back(meshletVerts[v]);
                         }
                     }
+                    drawList.Add(p, pCopy, p.m_tris.data(), m.firstTri,
+                                 m.firstTri + m.triCount, bounds.center, transform);
+                }
+                return true;
+            });
 
-                    if(exit < enter)
-                    {
-                        float temp = exit;
-                        exit = enter;
-                        enter = temp;
-                    }
+            TransformVertices<Proj>(p, place, pCopy, visibleVerts.data(), visibleVerts.size(),
+                                    f);
+        }
+        else
+        {
+            TransformVertices<Proj>(p, place, pCopy, nullptr, p.m_verts.size(), f);
+            drawList.Add(p, pCopy, p.m_tris.data(), 0, p.m_tris.size(), inst.bounds.center,
+                         transform);
+        }
 
-                    paint = false;
+        if(drawList.Calls().size() > calls)
+        {
+            drawn++;
+        }
+        return true;
+    });
+    return drawn;
+}
 
-                    for(int x = t.xLeft; x < t.xRight && x < 512; x++)
-                    {
-                        if(x >= enter)
-                        {
-                            paint = true;
-                        }
 
-                        if(x > exit)
-                        {
-                            paint = false;
-                        }
+QImage Rasterizer::RenderScene()
+{
+    // Place whatever was moved since the last frame
+    UpdateScene();
+    if(lighting == Lighting::SceneLights)
+    {
+        UpdateShadowMaps();
+    }
 
-                        if(paint == true)
-                        {
-                            vec4 intPt = vec4(float(x), float(y), vert0.m_pos[2], 1.0);
-                            vector<float> vertWeights = p.baryInterp2D(t, intPt);
+    Frame frame;
+    PrepareFrame(camera, frame);
+    DrawFrame(frame);
+    ReportFrame(frame);
 
-                            if(vert0.m_pos[2] <= currentScreen[x + 512 * y])
-                            {
-                                currentScreen[x + 512 * y] = vert0.m_pos[2];
+    return frame.image;
+}
 
-                                red = vert0.m_color[0] * vertWeights[0] +
-                                        vert1.m_color[0] * vertWeights[1] +
-                                        vert2.m_color[0] * vertWeights[2];
 
-                                green = vert0.m_color[1] * vertWeights[0] +
-                                        vert1.m_color[1] * vertWeights[1] +
-                                        vert2.m_color[1] * vertWeights[2];
+// Renders one frame per camera, three stages deep: in each step one frame is
+// prepared and the one before it drawn, both on the job system, while the
+// one before that is presented on the calling thread
+void Rasterizer::RenderPath(const vector<Camera>& cameras,
+                            function<void(int, const QImage&)> present)
+{
+    UpdateScene();
+    if(lighting == Lighting::SceneLights)
+    {
+        UpdateShadowMaps();
+    }
 
-                                blue = vert0.m_color[2] * vertWeights[0] +
-                                        vert1.m_color[2] * vertWeights[1] +
-                                        vert2.m_color[2] * vertWeights[2];
+    // Frame i is prepared in step i, drawn in step i + 1 and presented in
+    // step i + 2, so no slot is reused before its frame has been presented
+    array<Frame, FRAMES_IN_FLIGHT> frames;
+    int numFrames = cameras.size();
 
-                                result.setPixel(x, y, qRgb(red, green, blue));
-                            }
-                        }
-                    }
-                }
-            }
+    for(int step = 0; step < numFrames + FRAMES_IN_FLIGHT - 1; step++)
+    {
+        TaskGroup stages;
+        if(step < numFrames)
+        {
+            stages.Run([this, &cameras, &frames, step]()
+            {
+                PrepareFrame(cameras[step], frames[step % FRAMES_IN_FLIGHT]);
+            });
+        }
+        if(step >= 1 && step <= numFrames)
+        {
+            stages.Run([this, &frames, step]()
+            {
+                DrawFrame(frames[(step - 1) % FRAMES_IN_FLIGHT]);
+            });
         }
+        if(step >= 2)
+        {
+            const Frame& shown = frames[(step - 2) % FRAMES_IN_FLIGHT];
+            ReportFrame(shown);
+            TraceScope span("present");
+            present(step - 2, shown.image);
+        }
+        stages.Wait();
+    }
+}
+
+
+// Works out what view sees: culls and places the scene graph's nodes,
+// projects their vertices and bins their triangles into screen tiles
+void Rasterizer::PrepareFrame(Camera view, Frame& frame)
+{
+    if(mp_textureCache != nullptr)
+    {
+        mp_textureCache->BeginFrame();
+    }
+
+    frame.stats = RenderStats();
+
+    // Calculate the Camera's Matrix
+    FrameState& f = frame.state;
+    f.viewMat = view.getViewMat();
+    f.compositionMat = perspPovMat * f.viewMat;
+    f.camPos = view.position;
+    f.camForward = view.forward;
+    f.focalLength = focalLength;
+    f.nearDepth = 1.f;
+    f.depth = &currentScreen;
+
+    // How large a unit appears one unit away: the pinhole's projection scale,
+    // or the fish eye's pixels per radian near the center
+    f.lodScale = 0.f;
+    if(projection == Projection::Pinhole)
+    {
+        f.lodScale = 256.f / std::tan(glm::radians(view.fov) / 2.f);
+    }
+    else if(projection == Projection::FishEye)
+    {
+        f.lodScale = focalLength * 512.f;
+    }
+    f.image = &frame.image;
+    f.lights = &lights;
+    f.lightGrid = &frame.lightGrid;
+    f.ambient = ambient;
+    f.shadowMaps = &shadowMaps;
+    f.stats = &frame.stats;
+
+    // The heat map views count where the frame's work goes
+    f.depthTests = nullptr;
+    f.shadeCounts = nullptr;
+    f.tileNanos = nullptr;
+    if(outputFormat == OutputFormat::DepthTests)
+    {
+        frame.depthTests.assign(512 * 512, 0);
+        f.depthTests = frame.depthTests.data();
+    }
+    else if(outputFormat == OutputFormat::Shading)
+    {
+        frame.shadeCounts.assign(512 * 512, 0);
+        f.shadeCounts = frame.shadeCounts.data();
+    }
+    else if(outputFormat == OutputFormat::TileTime)
+    {
+        frame.tileNanos.fill(0);
+        f.tileNanos = frame.tileNanos.data();
+    }
+
+    // Cull the lights against each screen tile once per frame
+    if(lighting == Lighting::SceneLights)
+    {
+        frame.lightGrid.Build(lights, view, f.viewMat, perspPovMat,
+                              projection != Projection::Pinhole);
     }
 
+    // 2D scenes keep their file order, which decides which polygon is on top
+    bool sorted = sortFrontToBack && projection != Projection::Flat2D;
 
-    // Render 3D Scene
-    if(threeD == true)
-    {   
-        // Calculate the Camera's Matrix
-        mat4 viewMat = camera.getViewMat();
-        mat4 compositionMat = perspPovMat * viewMat;
+    // Reuse the last frame's vertex shader copies' and screen space slots' memory
+    frame.shaded.clear();
+    frame.drawList = DrawList();
 
-        currentScreen.fill(1000.f);
+    // Only the pinhole lens has a frustum; the fish eye sees all around
+    Frustum frustum(view);
 
-         for(Polygon p : m_polygons)
+    // The occluders go first, so the objects and clusters behind them are
+    // skipped before any of their vertices are touched
+    OcclusionBuffer* occlusion = nullptr;
+    if(occlusionCulling && projection == Projection::Pinhole && !m_occluders.empty())
+    {
+        m_occlusion.Begin(view, f.compositionMat, f.nearDepth);
+        for(const Occluder& o : m_occluders)
         {
-             // Make a copy so we retain access to both world
-             // and screen space coordinates
-            Polygon pCopy = p;
-
-             for(Vertex& v : pCopy.m_verts)
-             {
-                 vec4 pos = v.m_pos;
+            m_occlusion.AddOccluder(o);
+        }
+        occlusion = &m_occlusion;
+    }
 
-                 if(fishEye == false)
-                 {
-                     // Normal Pinhole camera
+    int drawn = 0;
+    {
+        TraceScope span("vertex transform");
+        switch(projection)
+        {
+        case Projection::Flat2D:
+            drawn = BuildDrawList<Flat2DProjection>(m_polygons, scene, nullptr, nullptr, false,
+                                                    f, frame.shaded, frame.screens,
+                                                    frame.drawList);
+            break;
+        case Projection::Pinhole:
+            drawn = BuildDrawList<PinholeProjection>(m_polygons, scene, &frustum, occlusion,
+                                                     true, f, frame.shaded, frame.screens,
+                                                     frame.drawList);
+            break;
+        case Projection::FishEye:
+            drawn = BuildDrawList<FishEyeProjection>(m_polygons, scene, nullptr, nullptr,
+                                                     true, f, frame.shaded, frame.screens,
+                                                     frame.drawList);
+            break;
+        }
+    }
 
-                     // Multiply verts by the matrices
-                     pos = compositionMat * pos;
+    frame.stats.occludedBounds = occlusion != nullptr ? occlusion->NumOccluded() : 0;
 
-                     // Divide by W
-                     pos /= pos[3];
+    // Every object drawing a Polygon that was not transformed to be drawn was culled
+    int objects = 0;
+    scene.Traverse([&objects](int, const SceneNode& sceneNode)
+    {
+        objects += sceneNode.instance.polygon >= 0;
+        return true;
+    });
+    frame.stats.objectsCulled = objects - drawn;
 
-                     // Convert to Pixel Space
-                     pos[0] = (pos[0] + 1.f) * 256;
-                     pos[1] = (1 - pos[1]) * 256;
-                 }
-                 else
-                 {
-                     // Fish Eye lens (Equidistant F Theta camera)
+    // Nearest first, so the depth test rejects as much of the rest as it can
+    if(sorted)
+    {
+        frame.drawList.SortFrontToBack(f.camPos);
+    }
 
-                     vec4 camSpace = viewMat * v.m_pos;
+    // Sort the triangles into screen tiles, each then drawn on its own thread
+    TraceScope span("triangle setup");
+    switch(projection)
+    {
+    case Projection::Flat2D:
+        frame.bins.Build<Flat2DProjection>(frame.drawList, f);
+        break;
+    case Projection::Pinhole:
+        frame.bins.Build<PinholeProjection>(frame.drawList, f);
+        break;
+    case Projection::FishEye:
+        frame.bins.Build<FishEyeProjection>(frame.drawList, f);
+        break;
+    }
+}
 
-                     camSpace = normalize(camSpace);
 
-                     double phi = atan2(camSpace.y, camSpace.x);
-                     double length = std::sqrt(camSpace.x * camSpace.x + camSpace.y * camSpace.y);
-                     double theta = asin(length);
+// Draws a prepared frame into its image and currentScreen, then counts the
+// pixels it covered
+void Rasterizer::DrawFrame(Frame& frame)
+{
+    const FrameState& f = frame.state;
 
-                     //Equidistant projection
-                     double r = focalLength * theta;
+    if(frame.image.isNull())
+    {
+        frame.image = QImage(512, 512, QImage::Format_RGB32);
+    }
+    // Fill the image with black pixels.
+    // Note that qRgb creates a QColor,
+    // and takes in values [0, 255] rather than [0, 1].
+    frame.image.fill(qRgb(0.f, 0.f, 0.f));
 
-                     double x = -r * cos(phi);
-                     double y = -r * sin(phi);
+    float clearDepth = projection == Projection::Flat2D ? Flat2DProjection::ClearDepth()
+                                                        : CameraProjection::ClearDepth();
+    currentScreen.fill(clearDepth);
 
-                     // Convert to pixel space
-                     x += 0.5;
-                     y += 0.5;
-                     pos[0] = x * 512.0;
-                     pos[1] = y * 512.0;
-                 }
+    // Once every pixel holds its nearest depth, the depth test below only
+    // passes fragments equal to it, so nothing hidden gets shaded
+    if(depthPrepass)
+    {
+        TraceScope span("raster");
+        switch(projection)
+        {
+        case Projection::Flat2D:
+            DrawDepthOnly<Flat2DProjection>(frame.drawList, frame.bins, f);
+            break;
+        case Projection::Pinhole:
+            DrawDepthOnly<PinholeProjection>(frame.drawList, frame.bins, f);
+            break;
+        case Projection::FishEye:
+            DrawDepthOnly<FishEyeProjection>(frame.drawList, frame.bins, f);
+            break;
+        }
+    }
 
-                 // Set the Vertex to the newly calculated position
-                 v.m_pos = pos;
-             }
+    // Fragments are found and shaded in the same loop, so without the
+    // pre-pass this span holds the rasterizing as well
+    {
+        TraceScope span("shade");
+        DrawTiles(frame.drawList, frame.bins, f, [this](const TileDraw& d, FrameState& tileState)
+        {
+            switch(projection)
+            {
+            case Projection::Flat2D:
+                // 2D scenes are drawn with their vertex colors and no lighting
+                if(d.world->mp_shader != nullptr)
+                {
+                    DrawWithShader<Flat2DProjection>(outputFormat, d, tileState,
+                                                     *d.world->mp_shader);
+                }
+                else
+                {
+                    DrawWithOutput<Flat2DProjection, VertexColorTexturing, UnlitLighting>(
+                                outputFormat, d, tileState);
+                }
+                break;
+            case Projection::Pinhole:
+                DrawWithTexturing<PinholeProjection>(lighting, outputFormat, d, tileState);
+                break;
+            case Projection::FishEye:
+                DrawWithTexturing<FishEyeProjection>(lighting, outputFormat, d, tileState);
+                break;
+            }
+        });
+    }
 
-            for(Triangle t : pCopy.m_tris)
+    // Resolve: count the pixels drawn, a tile at a time
+    TraceScope span("resolve");
+    std::array<int, TileBins::NUM_TILES> covered;
+    ParallelFor(0, TileBins::NUM_TILES, 1, [&](int tile)
+    {
+        ScreenRect rect = TileBins::Rect(tile);
+        covered[tile] = 0;
+        for(int y = rect.y0; y < rect.y1; y++)
+        {
+            for(int x = rect.x0; x < rect.x1; x++)
             {
-                Vertex vert0 = pCopy.m_verts[t.m_indices[0]];
-                Vertex vert1 = pCopy.m_verts[t.m_indices[1]];
-                Vertex vert2 = pCopy.m_verts[t.m_indices[2]];
-
-                // Back-face Culling
-                if(dot(camera.forward, vert0.m_normal) > 0.f &&
-                        dot(camera.forward, vert1.m_normal) > 0.f &&
-                        dot(camera.forward, vert2.m_normal) > 0.f)
+                if(currentScreen[x + 512 * y] != clearDepth)
                 {
-                    continue;
+                    covered[tile]++;
                 }
+            }
+        }
+    });
 
-                // World Space positions
-                vec4 worldPos0 = p.m_verts[t.m_indices[0]].m_pos;
-                vec4 worldPos1 = p.m_verts[t.m_indices[1]].m_pos;
-                vec4 worldPos2 = p.m_verts[t.m_indices[2]].m_pos;
+    frame.stats.pixelsCovered = 0;
+    for(int count : covered)
+    {
+        frame.stats.pixelsCovered += count;
+    }
 
-                pCopy.calcBoundingBox(t);
+    // The heat maps replace the shaded image
+    if(f.depthTests != nullptr)
+    {
+        DrawCountHeatMap(frame.depthTests, frame.image);
+    }
+    else if(f.shadeCounts != nullptr)
+    {
+        DrawCountHeatMap(frame.shadeCounts, frame.image);
+    }
+    else if(f.tileNanos != nullptr)
+    {
+        DrawTileHeatMap(frame.tileNanos, frame.image);
+    }
+}
 
-                Segment s0(vert0.m_pos, vert1.m_pos);
-                Segment s1(vert1.m_pos, vert2.m_pos);
-                Segment s2(vert2.m_pos, vert0.m_pos);
 
-                // Iterate through each pixel
-                for(int y = t.yUpper; y < t.yLower && y < 512; y++)
+// Copies a finished frame's counts into stats
+void Rasterizer::ReportFrame(const Frame& frame)
+{
+    stats = frame.stats;
+}
+
+
+// Shadow map views clip triangles reaching behind the light against its near
+// plane instead of dropping them whole, so an occluder straddling the plane
+// still casts. Each such triangle becomes the one or two triangles of its part
+// in front of the plane, added to the draw list from new Polygons in clipped,
+// in world and screen space in turn; PinholeProjection::IsClipped still drops
+// the original. Only depth is drawn, so a new corner takes its other
+// attributes from the end of its edge in front of the plane.
+static void ClipNearPlane(DrawList& drawList, const FrameState& f, vector<Polygon>& clipped)
+{
+    int numCalls = drawList.Calls().size();
+
+    // The draw list points into clipped, so it never grows past this
+    clipped.reserve(2 * numCalls);
+
+    for(int c = 0; c < numCalls; c++)
+    {
+        // Copied, as adding to the draw list may move its calls
+        DrawCall d = drawList.Calls()[c];
+        Polygon* world = nullptr;
+        Polygon* screen = nullptr;
+
+        for(int i = d.firstTri; i < d.lastTri; i++)
+        {
+            // Triangles the pipeline keeps drop their fragments nearer than
+            // the plane one at a time, so only those it drops are clipped
+            const Triangle& tri = d.tris[i];
+            const Vertex& v0 = d.screen->m_verts[tri.m_indices[0]];
+            const Vertex& v1 = d.screen->m_verts[tri.m_indices[1]];
+            const Vertex& v2 = d.screen->m_verts[tri.m_indices[2]];
+            int behind = 0;
+            for(unsigned int index : tri.m_indices)
+            {
+                behind += d.screen->m_verts[index].m_pos[2] < f.nearDepth;
+            }
+            if(behind == 0 || behind == 3 || !PinholeProjection::IsClipped(v0, v1, v2, f))
+            {
+                continue;
+            }
+
+            // Walk the edges, keeping each corner in front of the plane and
+            // adding one wherever an edge crosses it, so the winding is kept
+            vector<Vertex> kept;
+            for(int k = 0; k < 3; k++)
+            {
+                const Vertex& a = d.world->m_verts[tri.m_indices[k]];
+                const Vertex& b = d.world->m_verts[tri.m_indices[(k + 1) % 3]];
+                vec4 posA = d.placed ? d.transform * a.m_pos : a.m_pos;
+                vec4 posB = d.placed ? d.transform * b.m_pos : b.m_pos;
+                float zA = d.screen->m_verts[tri.m_indices[k]].m_pos[2];
+                float zB = d.screen->m_verts[tri.m_indices[(k + 1) % 3]].m_pos[2];
+
+                if(zA >= f.nearDepth)
+                {
+                    kept.push_back(a);
+                    kept.back().m_pos = posA;
+                }
+                if((zA < f.nearDepth) != (zB < f.nearDepth))
                 {
-                    float x0 = -1.f;
-                    float x1 = -1.f;
-                    float x2 = -1.f;
+                    kept.push_back(zA >= f.nearDepth ? a : b);
+                    kept.back().m_pos = mix(posA, posB, (f.nearDepth - zA) / (zB - zA));
+                }
+            }
+            if(kept.size() < 3)
+            {
+                continue;
+            }
 
-                    float enter = -1.f;
-                    float exit = -1.f;
+            if(world == nullptr)
+            {
+                clipped.push_back(Polygon());
+                clipped.push_back(Polygon());
+                world = &clipped[clipped.size() - 2];
+                screen = &clipped[clipped.size() - 1];
+                screen->m_cullMode = d.screen->m_cullMode;
+            }
 
-                    int numIntersections = 0;
+            unsigned int first = world->m_verts.size();
+            for(const Vertex& v : kept)
+            {
+                world->m_verts.push_back(v);
+                screen->m_verts.push_back(v);
+                screen->m_verts.back().m_pos = PinholeProjection::Project(v.m_pos, f);
+            }
+            for(unsigned int k = 1; k + 1 < kept.size(); k++)
+            {
+                Triangle t = Triangle();
+                t.m_indices[0] = first;
+                t.m_indices[1] = first + k;
+                t.m_indices[2] = first + k + 1;
+                screen->m_tris.push_back(t);
+            }
+        }
 
-                    if(s0.getIntersection((float)y, x0))
-                    {
-                        numIntersections++;
-                    }
-                    if(s1.getIntersection((float)y, x1))
-                    {
-                        numIntersections++;
-                    }
-                    if(s2.getIntersection((float)y, x2))
-                    {
-                        numIntersections++;
-                    }
+        if(world != nullptr)
+        {
+            drawList.Add(*world, *screen, screen->m_tris.data(), 0, screen->m_tris.size(),
+                         d.center, nullptr);
+        }
+    }
+}
 
-                    if(numIntersections < 1)
-                    {
-                        continue;
-                    }
-                    else if(numIntersections == 1)
-                    {
-                        if(x0 == -1.f)
-                        {
-                            enter = x0;
-                        }
-                        else if(x1 != -1.f)
-                        {
-                            enter = x1;
-                        }
-                        else
-                        {
-                            enter = x2;
-                        }
-                    }
-                    else
-                    {
-                        if(x0 == -1.f)
-                        {
-                            enter = x1;
-                            exit = x2;
-                        }
-                        else
-                        {
-                            enter = x0;
-                            if(x1 == -1.f)
-                            {
-                                exit = x2;
-                            }
-                            else
-                            {
-                                exit = x1;
-                            }
-                        }
-                    }
 
-                    if(exit < enter)
-                    {
-                        float temp = exit;
-                        exit = enter;
-                        enter = temp;
-                    }
+// Renders only the depth of the scene as seen through view
+void Rasterizer::RenderDepth(Camera view, array<float, 262144>& depth)
+{
+    UpdateScene();
+
+    // Nothing is lit, so no light reaches any tile
+    LightGrid noLights;
+
+    FrameState f = FrameState();
+    f.viewMat = view.getViewMat();
+    f.compositionMat = view.getPerspProjMat() * f.viewMat;
+    f.camPos = view.position;
+    f.camForward = view.forward;
+    f.nearDepth = view.nearClip;
+    f.lodScale = 256.f / std::tan(glm::radians(view.fov) / 2.f);
+    f.depth = &depth;
+    f.image = nullptr;
+    f.lights = &lights;
+    f.lightGrid = &noLights;
+    f.ambient = ambient;
+    f.shadowMaps = &shadowMaps;
+    f.stats = nullptr;
+
+    depth.fill(PinholeProjection::ClearDepth());
+
+    vector<Polygon> shaded;
+    vector<Polygon> screens;
+    DrawList drawList;
+
+    Frustum frustum(view);
+    BuildDrawList<PinholeProjection>(m_polygons, scene, &frustum, nullptr, true, f, shaded,
+                                     screens, drawList);
+
+    vector<Polygon> clipped;
+    ClipNearPlane(drawList, f, clipped);
+
+    TileBins bins;
+    bins.Build<PinholeProjection>(drawList, f);
+    DrawDepthOnly<PinholeProjection>(drawList, bins, f);
+}
 
-                    paint = false;
 
-                    for(int x = t.xLeft; x < t.xRight && x < 512; x++)
-                    {
-                        if(x >= enter)
-                        {
-                            paint = true;
-                        }
-                        if(x > exit)
-                        {
-                            paint = false;
-                        }
+// Re-renders the shadow maps of lights that cast shadows and have moved
+void Rasterizer::UpdateShadowMaps()
+{
+    shadowMaps.resize(lights.size());
 
-                        if(paint == true)
-                        {
-                            vec4 intPt = vec4(float(x), float(y), 0.f, 1.0);
-
-                            vector<float> vertWeights = pCopy.baryInterp2D(t, intPt);
-
-                            vec4 depthVec = pCopy.interpZDepth(vertWeights, t, worldPos0, worldPos1,
-                                                              worldPos2, intPt, camera.position);
-                            float zDepth = depthVec[3];
-
-                            // Too close to camera
-                            if(zDepth < 1.f)
-                            {
-                                continue;
-                            }
-
-                            if(zDepth <= currentScreen[x + 512 * y])
-                            {
-                                currentScreen[x + 512 * y] = zDepth;
-
-                                // Get Texture per pixel
-                                vec3 color = pCopy.baryInterpUVs(vertWeights, depthVec,
-                                                  vert0, vert1, vert2, pCopy.mp_texture);
-
-                                // Lighting
-                                float scaleFactor = pCopy.baryInterpNormals(vertWeights, depthVec,
-                                                            vert0, vert1, vert2, camera.forward);
-                                color *= scaleFactor;
-
-                                // Color Clamping
-                                if(color[0] > 255.f)
-                                {
-                                    color /= (color[0] / 255.f);
-                                }
-                                if(color[1] > 255.f)
-                                {
-                                    color /= (color[1] / 255.f);
-                                }
-                                if(color[2] > 255.f)
-                                {
-                                    color /= (color[2] / 255.f);
-                                }
-
-                                result.setPixel(x, y, qRgb(color[0], color[1], color[2]));
-                            }
-                        }
-                    }
+    for(unsigned int i = 0; i < lights.size(); i++)
+    {
+        const Light& l = lights[i];
+        ShadowMap& map = shadowMaps[i];
+
+        if(!l.castsShadows)
+        {
+            map.Clear();
+            continue;
+        }
+
+        if(map.Matches(l))
+        {
+            continue;
+        }
+
+        map.Setup(l);
+        for(int v = 0; v < map.NumViews(); v++)
+        {
+            RenderDepth(map.ViewCamera(v), map.ViewDepth(v));
+        }
+    }
+}
+
+
+// Finds the node and triangle seen at pixel (x, y) through the pinhole camera
+bool Rasterizer::Pick(int x, int y, int& node, int& triangle)
+{
+    // The inverse of PinholeProjection's mapping to pixel space
+    float s = 1.f / std::tan(glm::radians(camera.fov) / 2.f);
+    float ndcX = x / 256.f - 1.f;
+    float ndcY = 1.f - y / 256.f;
+
+    vec3 origin = vec3(camera.position);
+    vec3 dir = vec3(camera.forward) + vec3(camera.right) * (ndcX / s) +
+            vec3(camera.up) * (ndcY / s);
+    vec3 invDir = 1.f / dir;
+
+    float nearest = FLT_MAX;
+    node = -1;
+    triangle = -1;
+
+    scene.Traverse([&](int i, const SceneNode& sceneNode)
+    {
+        float enter = RayEntersBox(sceneNode.subtreeBounds, origin, invDir);
+        if(sceneNode.subtreeBounds.IsEmpty() || enter < 0.f || enter > nearest)
+        {
+            return false;
+        }
+
+        const Instance& inst = sceneNode.instance;
+        if(inst.polygon < 0)
+        {
+            return true;
+        }
+        const Polygon& p = m_polygons[inst.polygon];
+
+        enter = RayEntersBox(inst.bounds, origin, invDir);
+        if(enter < 0.f || enter > nearest)
+        {
+            return true;
+        }
+
+        // The ray is taken into the Polygon's space instead of the Polygon
+        // into world space. Distances along dir are the same in both.
+        vec3 localOrigin = origin;
+        vec3 localDir = dir;
+        if(!inst.IsIdentity())
+        {
+            mat4 toLocal = inverse(inst.transform);
+            localOrigin = vec3(toLocal * vec4(origin, 1.f));
+            localDir = vec3(toLocal * vec4(dir, 0.f));
+        }
+
+        float t;
+        int tri;
+        bool hit = false;
+
+        if(p.mp_bvh != nullptr)
+        {
+            hit = p.mp_bvh->Raycast(p, localOrigin, localDir, t, tri);
+        }
+        else
+        {
+            t = FLT_MAX;
+            for(unsigned int j = 0; j < p.m_tris.size(); j++)
+            {
+                const Triangle& candidate = p.m_tris[j];
+                float tHit;
+                if(RayHitsTriangle(localOrigin, localDir,
+                                   vec3(p.m_verts[candidate.m_indices[0]].m_pos),
+                                   vec3(p.m_verts[candidate.m_indices[1]].m_pos),
+                                   vec3(p.m_verts[candidate.m_indices[2]].m_pos), tHit) &&
+                        tHit < t)
+                {
+                    t = tHit;
+                    tri = j;
+                    hit = true;
                 }
             }
         }
-    }
 
-    return result;
+        if(hit && t < nearest)
+        {
+            nearest = t;
+            node = i;
+            triangle = tri;
+        }
+        return true;
+    });
+
+    return node >= 0;
 }
 
 
 void Rasterizer::ClearScene()
 {
     m_polygons.clear();
+    scene = SceneGraph();
+    m_occluders.clear();
+    m_nodeOccluders.clear();
+    shadowMaps.clear();
 }
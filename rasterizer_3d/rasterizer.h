@@ -7,21 +7,205 @@
 
 #include <array>
 #include "camera.h"
+#include "texture.h"
+#include "light.h"
+#include "shadowmap.h"
+#include "occlusion.h"
+#include "scenegraph.h"
+#include "drawlist.h"
+#include "tiles.h"
+#include "renderstats.h"
+#include <functional>
+
+// How vertices are taken to pixel space
+enum class Projection
+{
+    Flat2D,     // Vertices are already in pixel space
+    Pinhole,    // Normal perspective camera
+    FishEye     // Equidistant fish eye lens
+};
+
+// How fragments are lit. Polygons with a normal map use it when lit.
+enum class Lighting
+{
+    Unlit,
+    Lambert,        // A single light shining from the camera
+    SceneLights     // The point and spot lights in Rasterizer::lights
+};
+
+// What RenderScene writes into the image
+enum class OutputFormat
+{
+    Color,      // The shaded scene
+    Depth,      // The depth buffer as shades of gray
+    DepthTests, // Heat map of the depth tests made at each pixel
+    Shading,    // Heat map of the fragments shaded at each pixel
+    TileTime    // Heat map of the time each screen tile took to draw
+};
 
 class Rasterizer
 {
 private:
     //This is the set of Polygons loaded from a JSON scene file
     std::vector<Polygon> m_polygons;
+    // The cache the Polygons' textures were loaded into, told when a new frame starts
+    TextureCache* mp_textureCache;
+
+    // The triangles drawn into m_occlusion every frame
+    std::vector<Occluder> m_occluders;
+    OcclusionBuffer m_occlusion;
+
+    // One scene graph node's candidate occluders, in world space. Kept from
+    // one edit to the next and placed again only when the node moves.
+    struct NodeOccluders
+    {
+        // Whether its Polygon is marked as an occluder, so all of tris are drawn
+        bool marked;
+        std::vector<Occluder> tris;
+
+        // Of an unmarked node's triangles, largest first
+        std::vector<float> areas;
+    };
+    std::vector<NodeOccluders> m_nodeOccluders;
+
+    // Re-renders the shadow maps of lights that cast shadows and have moved
+    void UpdateShadowMaps();
+
+    // Picks the triangles that hide what is behind them in occlusion
+    // culling, placing only those of the nodes in changed again
+    void GatherOccluders(const std::vector<int>& changed);
+
+    // Places a node's candidate occluders
+    void PlaceOccluders(int node);
+
+    // Brings the scene graph's world transforms and bounds up to date, picks
+    // the occluders again if anything moved, and drops the shadow maps of
+    // the lights reaching what moved so they are rendered again
+    void UpdateScene();
+
+    // Everything one frame needs from working out what it shows until it
+    // is presented, so consecutive frames can be worked on at once
+    struct Frame
+    {
+        FrameState state;
+        QImage image;
+
+        // The lights reaching each screen tile
+        LightGrid lightGrid;
+
+        // World space copies of the visible Polygons with vertex shaders, and
+        // screen space slots for all the visible Polygons, kept across frames
+        std::vector<Polygon> shaded;
+        std::vector<Polygon> screens;
+        DrawList drawList;
+        TileBins bins;
+
+        RenderStats stats;
+
+        // Counted for the heat map output formats only
+        std::vector<int> depthTests;
+        std::vector<int> shadeCounts;
+        std::array<long long, TileBins::NUM_TILES> tileNanos;
+    };
+
+    // Frames RenderPath works on at once: one prepared, one drawn and one presented
+    static const int FRAMES_IN_FLIGHT = 3;
+
+    // The geometry half of a frame: culls, places and projects the scene as
+    // view sees it and bins its triangles. Only writes to frame and
+    // m_occlusion, so it may run while another frame is drawn.
+    void PrepareFrame(Camera view, Frame& frame);
+
+    // The raster half of a frame: draws a prepared frame into its image and
+    // currentScreen and counts the pixels covered
+    void DrawFrame(Frame& frame);
+
+    // Makes a finished frame's counts the ones stats shows
+    void ReportFrame(const Frame& frame);
 public:
-    Rasterizer(const std::vector<Polygon>& polygons);
+    // Draws each Polygon once, where it is
+    Rasterizer(std::vector<Polygon> polygons, TextureCache* textureCache = nullptr);
+    // Draws the Polygons only where the scene graph's nodes place them
+    Rasterizer(std::vector<Polygon> polygons, SceneGraph graph,
+               TextureCache* textureCache = nullptr);
     QImage RenderScene();
     void ClearScene();
 
+    // Renders one image per camera, working out the geometry of each frame
+    // while the one before it is rasterized and the one before that is
+    // presented. present(i, image) is called on the calling thread for
+    // every frame in order, and the image may be kept. Only the camera
+    // changes along the path: the scene, lights and settings must be left
+    // alone until RenderPath returns, which is once every frame is presented.
+    void RenderPath(const std::vector<Camera>& cameras,
+                    std::function<void(int, const QImage&)> present);
+
+    // Edit the scene's Polygons in place, between frames; nodes are added,
+    // moved and removed through scene. Only what an edit touches is rebuilt:
+    // the edited Polygon's bounds, levels of detail and BVH, and the shadow
+    // maps of lights within reach of it. The other Polygons, the textures,
+    // the camera and the lights are left alone.
+
+    // Adds a Polygon for nodes to draw and returns its index
+    int AddPolygon(Polygon p);
+    // Replaces a Polygon under every node drawing it
+    void ReplacePolygon(int polygon, Polygon p);
+    // Frees a Polygon and stops every node drawing it. The index is not reused.
+    // Both ignore an index no Polygon has.
+    void RemovePolygon(int polygon);
+
+    // Renders only the depth of the scene as seen through view into depth,
+    // skipping all shading and color writes. Used for shadow maps and any
+    // other depth pre-pass.
+    void RenderDepth(Camera view, std::array<float, 262144>& depth);
+
+    // Finds the scene graph node, and the triangle of its Polygon, seen at
+    // pixel (x, y) through the pinhole camera, using each mesh's BVH. Returns
+    // false if the pixel shows nothing. Vertex shaders are not taken into account.
+    bool Pick(int x, int y, int& node, int& triangle);
+
+    // Where the Polygons are drawn. Each node draws at most one Polygon and
+    // shares its vertices; a Polygon may be drawn by any number of nodes, or
+    // none. Nodes moved with SetLocal are placed at the next render.
+    SceneGraph scene;
+
     // Added Member variables
     Camera camera;
     glm::mat4 perspPovMat;
 
+    // Pipeline variant to render with. Chosen once per draw, never per fragment.
+    Projection projection;
+    Lighting lighting;
+    OutputFormat outputFormat;
+
+    // Fractional focal length if a fish eye lens is used
+    float focalLength;
+
+    // Rasterize the whole scene into currentScreen before shading anything,
+    // so each pixel's texturing and lighting run only for its nearest fragment.
+    // Pays off when the scene has a lot of overdraw.
+    bool depthPrepass;
+
+    // Draw objects, and clusters of triangles within large meshes, nearest
+    // first so the depth test rejects more hidden fragments before shading
+    bool sortFrontToBack;
+
+    // Draw a few large occluders into a low resolution depth buffer first, and
+    // skip the objects and clusters hidden behind them. Pinhole camera only.
+    bool occlusionCulling;
+
+    // Lights used when lighting is SceneLights, and the light reaching
+    // every fragment regardless of them
+    std::vector<Light> lights;
+    float ambient;
+
+    // One per light, kept until the light moves or the scene changes
+    std::vector<ShadowMap> shadowMaps;
+
+    // Counted by every RenderScene, and by RenderPath for each frame as it
+    // is presented
+    RenderStats stats;
+
     std::array<float, 262144> currentScreen;
 
 };
@@ -2,28 +2,16 @@ QT       += core gui
 
 CONFIG += c++11
 
-INCLUDEPATH += include
-INCLUDEPATH += $$PWD
-
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = Rasterize
 TEMPLATE = app
 
+include(renderer.pri)
 
 SOURCES += main.cpp\
-        mainwindow.cpp \
-    polygon.cpp \
-    rasterizer.cpp \
-    tiny_obj_loader.cc \
-    segment.cpp \
-    camera.cpp
+        mainwindow.cpp
 
-HEADERS  += mainwindow.h \
-    polygon.h \
-    rasterizer.h \
-    tiny_obj_loader.h \
-    segment.h \
-    camera.h
+HEADERS  += mainwindow.h
 
 FORMS    += mainwindow.ui
@@ -0,0 +1,56 @@
+# Everything but the viewer's window, shared by the viewer, the benchmark and the
+# determinism check
+
+INCLUDEPATH += $$PWD/include
+INCLUDEPATH += $$PWD
+
+SOURCES += $$PWD/polygon.cpp \
+    $$PWD/rasterizer.cpp \
+    $$PWD/tiny_obj_loader.cc \
+    $$PWD/segment.cpp \
+    $$PWD/camera.cpp \
+    $$PWD/texture.cpp \
+    $$PWD/shader.cpp \
+    $$PWD/light.cpp \
+    $$PWD/shadowmap.cpp \
+    $$PWD/drawlist.cpp \
+    $$PWD/bounds.cpp \
+    $$PWD/bvh.cpp \
+    $$PWD/meshlet.cpp \
+    $$PWD/occlusion.cpp \
+    $$PWD/lod.cpp \
+    $$PWD/meshopt.cpp \
+    $$PWD/instance.cpp \
+    $$PWD/scenegraph.cpp \
+    $$PWD/jobs.cpp \
+    $$PWD/tiles.cpp \
+    $$PWD/scenefile.cpp \
+    $$PWD/trace.cpp \
+    $$PWD/renderstats.cpp \
+    $$PWD/heatmap.cpp
+
+HEADERS += $$PWD/polygon.h \
+    $$PWD/rasterizer.h \
+    $$PWD/tiny_obj_loader.h \
+    $$PWD/segment.h \
+    $$PWD/camera.h \
+    $$PWD/texture.h \
+    $$PWD/pipeline.h \
+    $$PWD/shader.h \
+    $$PWD/light.h \
+    $$PWD/shadowmap.h \
+    $$PWD/drawlist.h \
+    $$PWD/bounds.h \
+    $$PWD/bvh.h \
+    $$PWD/meshlet.h \
+    $$PWD/occlusion.h \
+    $$PWD/lod.h \
+    $$PWD/meshopt.h \
+    $$PWD/instance.h \
+    $$PWD/scenegraph.h \
+    $$PWD/jobs.h \
+    $$PWD/tiles.h \
+    $$PWD/scenefile.h \
+    $$PWD/trace.h \
+    $$PWD/renderstats.h \
+    $$PWD/heatmap.h
@@ -0,0 +1,41 @@
+// Counts of the work done at every stage of drawing a frame
+
+#include "renderstats.h"
+
+using namespace std;
+
+
+RenderStats::RenderStats()
+    : objectsCulled(0), occludedBounds(0), trianglesSubmitted(0), trianglesCulled(0),
+      trianglesClipped(0), trianglesRasterized(0), fragmentsTested(0), fragmentsPassed(0),
+      fragmentsShaded(0), textureFetches(0), pixelsCovered(0)
+{}
+
+
+double RenderStats::Overdraw() const
+{
+    return pixelsCovered > 0 ? double(fragmentsShaded) / pixelsCovered : 0.0;
+}
+
+
+void RenderStats::AddFragments(const RenderStats& part)
+{
+    fragmentsTested += part.fragmentsTested;
+    fragmentsPassed += part.fragmentsPassed;
+    fragmentsShaded += part.fragmentsShaded;
+    textureFetches += part.textureFetches;
+}
+
+
+QString RenderStats::Summary() const
+{
+    return QString("objects culled %1, bounds occluded %2\n"
+                   "triangles submitted %3, culled %4, clipped %5, rasterized %6\n"
+                   "fragments tested %7, passed %8, shaded %9\n"
+                   "texture fetches %10, overdraw %11")
+            .arg(objectsCulled).arg(occludedBounds)
+            .arg(trianglesSubmitted).arg(trianglesCulled).arg(trianglesClipped)
+            .arg(trianglesRasterized)
+            .arg(fragmentsTested).arg(fragmentsPassed).arg(fragmentsShaded)
+            .arg(textureFetches).arg(Overdraw(), 0, 'f', 2);
+}
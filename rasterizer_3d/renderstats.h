@@ -0,0 +1,50 @@
+// Counts of the work done at every stage of drawing a frame
+
+#pragma once
+#include <QString>
+
+// Kept for every frame whatever the settings. Each stage counts into its
+// own locals and adds them up once per triangle, tile or chunk, so keeping
+// count costs next to nothing.
+struct RenderStats
+{
+    // Objects skipped whole by frustum or occlusion culling
+    int objectsCulled;
+
+    // Objects and BVH nodes occlusion culling skipped
+    int occludedBounds;
+
+    // Triangles handed to triangle setup, after culling objects and
+    // meshlets and picking levels of detail
+    long long trianglesSubmitted;
+
+    // Of those, the ones rejected at setup for facing away or covering no
+    // pixel center, the ones dropped for reaching behind the camera (they
+    // are not clipped, but dropped whole), and the ones left to rasterize
+    long long trianglesCulled;
+    long long trianglesClipped;
+    long long trianglesRasterized;
+
+    // Depth tests made, in every pass, and how many of them passed
+    long long fragmentsTested;
+    long long fragmentsPassed;
+
+    // Fragments textured and lit, and the texels looked up for them, one
+    // per fragment from each texture or normal map read
+    long long fragmentsShaded;
+    long long textureFetches;
+
+    // Pixels holding a fragment once the frame is drawn
+    int pixelsCovered;
+
+    RenderStats();
+
+    // Fragments shaded per covered pixel; 1 means nothing hidden was shaded
+    double Overdraw() const;
+
+    // Adds the fragment counts of one part of the frame, such as a tile
+    void AddFragments(const RenderStats& part);
+
+    // One line per group of counters, for showing over the image
+    QString Summary() const;
+};
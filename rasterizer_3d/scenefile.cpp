@@ -0,0 +1,391 @@
+// Reading JSON scene files and the OBJ meshes they name, shared by the
+// viewer and the benchmark
+
+#include "scenefile.h"
+#include <QFile>
+#include <QJsonObject>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QDebug>
+#include <iostream>
+#include <cmath>
+#include <tiny_obj_loader.h>
+#include <glm/gtx/transform.hpp>
+#include "lod.h"
+#include "meshopt.h"
+#include "trace.h"
+
+using namespace std;
+
+//Reads where an instance is placed: "pos", "rot" in degrees about x, then y,
+//then z, and "scale", either one number or one per axis. Anything left out
+//leaves the mesh as it is.
+static glm::mat4 ReadTransform(const QJsonObject &obj)
+{
+    glm::vec3 pos(0.f);
+    glm::vec3 rot(0.f);
+    glm::vec3 scale(1.f);
+    if(obj.contains(QString("pos")))
+    {
+        QJsonArray posA = obj["pos"].toArray();
+        pos = glm::vec3(posA[0].toDouble(), posA[1].toDouble(), posA[2].toDouble());
+    }
+    if(obj.contains(QString("rot")))
+    {
+        QJsonArray rotA = obj["rot"].toArray();
+        rot = glm::vec3(rotA[0].toDouble(), rotA[1].toDouble(), rotA[2].toDouble());
+    }
+    if(obj["scale"].isArray())
+    {
+        QJsonArray scaleA = obj["scale"].toArray();
+        scale = glm::vec3(scaleA[0].toDouble(), scaleA[1].toDouble(), scaleA[2].toDouble());
+    }
+    else if(obj.contains(QString("scale")))
+    {
+        scale = glm::vec3(obj["scale"].toDouble(1.0));
+    }
+
+    return glm::translate(pos)
+            * glm::rotate(rot.z, glm::vec3(0.f, 0.f, 1.f))
+            * glm::rotate(rot.y, glm::vec3(0.f, 1.f, 0.f))
+            * glm::rotate(rot.x, glm::vec3(1.f, 0.f, 0.f))
+            * glm::scale(scale);
+}
+
+//Loads one object of a scene file, and its children, under the scene graph
+//node parent
+static void LoadSceneObject(const QJsonObject &obj, const QString &localPath, int parent,
+                            std::vector<Polygon> &polygons, SceneGraph &scene,
+                            Projection &projection, TextureCache &textureCache)
+{
+    std::vector<glm::vec4> vert_pos;
+    std::vector<glm::vec3> vert_col;
+    QString type = obj["type"].toString();
+    unsigned int numPolygons = polygons.size();
+    int node = -1;
+    //Instance case: another placement of an object loaded earlier in the
+    //file, sharing its vertices rather than loading them again
+    if(QString::compare(type, QString("instance")) == 0)
+    {
+        QString meshName = obj["mesh"].toString();
+        int mesh = -1;
+        for(int j = polygons.size() - 1; j >= 0 && mesh < 0; j--)
+        {
+            if(QString::compare(polygons[j].m_name, meshName) == 0)
+            {
+                mesh = j;
+            }
+        }
+        if(mesh < 0)
+        {
+            qWarning("Unknown mesh %s", meshName.toStdString().c_str());
+        }
+        node = scene.AddNode(parent, ReadTransform(obj), mesh);
+    }
+    //Group case: draws nothing itself, only moves its children together
+    else if(QString::compare(type, QString("group")) == 0)
+    {
+        node = scene.AddNode(parent, ReadTransform(obj));
+    }
+    //Custom Polygon case
+    else if(QString::compare(type, QString("custom")) == 0)
+    {
+        QString name = obj["name"].toString();
+        QJsonArray pos = obj["vertexPos"].toArray();
+        for(int j = 0; j < pos.size(); j++)
+        {
+            QJsonArray arr = pos[j].toArray();
+            glm::vec4 p(arr[0].toDouble(), arr[1].toDouble(), arr[2].toDouble(), 1);
+            vert_pos.push_back(p);
+        }
+        QJsonArray col = obj["vertexCol"].toArray();
+        for(int j = 0; j < col.size(); j++)
+        {
+            QJsonArray arr = col[j].toArray();
+            glm::vec3 c(arr[0].toDouble(), arr[1].toDouble(), arr[2].toDouble());
+            vert_col.push_back(c);
+        }
+        Polygon p(name, vert_pos, vert_col);
+        polygons.push_back(p);
+    }
+    //Regular Polygon case
+    else if(QString::compare(type, QString("regular")) == 0)
+    {
+        QString name = obj["name"].toString();
+        int sides = obj["sides"].toInt();
+        QJsonArray colorA = obj["color"].toArray();
+        glm::vec3 color(colorA[0].toDouble(), colorA[1].toDouble(), colorA[2].toDouble());
+        QJsonArray posA = obj["pos"].toArray();
+        glm::vec4 pos(posA[0].toDouble(), posA[1].toDouble(), posA[2].toDouble(),1);
+        float rot = obj["rot"].toDouble();
+        QJsonArray scaleA = obj["scale"].toArray();
+        glm::vec4 scale(scaleA[0].toDouble(), scaleA[1].toDouble(), scaleA[2].toDouble(),1);
+        Polygon p(name, sides, color, pos, rot, scale);
+        polygons.push_back(p);
+    }
+    //OBJ file case
+    else if(QString::compare(type, QString("obj")) == 0)
+    {
+        projection = Projection::Pinhole;
+        QString name = obj["name"].toString();
+        QString filename = QString(localPath).append(obj["filename"].toString());
+        Polygon p = LoadOBJ(filename, name);
+        //Simplified levels of detail are cached next to the obj file
+        if(p.m_tris.size() >= 2 * LodChain::MIN_TRIANGLES)
+        {
+            p.mp_lods = LodChain::Load(p, filename);
+        }
+        p.SetTexture(textureCache.Load(QString(localPath).append(obj["texture"].toString())));
+        if(obj.contains(QString("normalMap")))
+        {
+            p.SetNormalMap(textureCache.Load(QString(localPath).append(obj["normalMap"].toString())));
+            if(p.mp_normalMap != nullptr)
+            {
+                p.ComputeTangents();
+            }
+        }
+        polygons.push_back(p);
+    }
+
+    //Objects are drawn where they are, unless they are hidden and only
+    //drawn through their instances. Meshes and custom polygons may be moved
+    //like instances; regular polygons already place themselves.
+    bool loaded = polygons.size() > numPolygons;
+    if(loaded)
+    {
+        glm::mat4 local = QString::compare(type, QString("regular")) == 0 ? glm::mat4(1.f)
+                                                                           : ReadTransform(obj);
+        int polygon = obj["hidden"].toBool(false) ? -1 : int(polygons.size()) - 1;
+        node = scene.AddNode(parent, local, polygon);
+    }
+
+    //Any object can choose which faces are culled: "none", "back" or "front"
+    if(obj.contains(QString("cull")) && loaded)
+    {
+        QString cull = obj["cull"].toString();
+        if(QString::compare(cull, QString("none")) == 0)
+        {
+            polygons.back().m_cullMode = CullMode::None;
+        }
+        else if(QString::compare(cull, QString("back")) == 0)
+        {
+            polygons.back().m_cullMode = CullMode::Back;
+        }
+        else if(QString::compare(cull, QString("front")) == 0)
+        {
+            polygons.back().m_cullMode = CullMode::Front;
+        }
+        else
+        {
+            qWarning("Unknown cull mode %s", cull.toStdString().c_str());
+        }
+    }
+
+    //Any object can hide what is behind it in occlusion culling, either with
+    //all of its own triangles (true) or with a simpler mesh lying inside it
+    if(obj.contains(QString("occluder")) && loaded)
+    {
+        QJsonValue occluder = obj["occluder"];
+        if(occluder.isString())
+        {
+            QString proxyName = QString(localPath).append(occluder.toString());
+            polygons.back().mp_occluderProxy =
+                    std::make_shared<Polygon>(LoadOBJ(proxyName, polygons.back().m_name));
+        }
+        else
+        {
+            polygons.back().m_occluder = occluder.toBool(false);
+        }
+    }
+
+    //Any object can name a registered shader to replace the built in shading
+    if(obj.contains(QString("shader")) && loaded)
+    {
+        QString shaderName = obj["shader"].toString();
+        polygons.back().mp_shader = FindShader(shaderName);
+        if(polygons.back().mp_shader == nullptr)
+        {
+            qWarning("Unknown shader %s", shaderName.toStdString().c_str());
+        }
+    }
+
+    //Any object can carry children, placed relative to it and moving with it
+    if(node >= 0)
+    {
+        QJsonArray children = obj["children"].toArray();
+        for(int i = 0; i < children.size(); i++)
+        {
+            LoadSceneObject(children[i].toObject(), localPath, node, polygons, scene, projection,
+                            textureCache);
+        }
+    }
+}
+
+//Reads a scene file into rasterizer, replacing whatever it drew before.
+//Returns false if the file could not be opened.
+bool LoadScene(const QString &filename, TextureCache &textureCache, Rasterizer &rasterizer)
+{
+    TraceScope span("scene load");
+    std::vector<Polygon> polygons;
+    SceneGraph scene;
+
+    int i = filename.length() - 1;
+    while(i >= 0 && QString::compare(filename.at(i), QChar('/')) != 0)
+    {
+        i--;
+    }
+    QStringRef local_path = filename.leftRef(i+1);
+
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly)){
+        qWarning("Could not open the JSON file.");
+        return false;
+    }
+    QByteArray file_data = file.readAll();
+
+    QJsonDocument jdoc(QJsonDocument::fromJson(file_data));
+
+    //The texture cache outlives the scene, so keys left out restore the defaults
+    double budgetMB = jdoc.object()["textureBudgetMB"].toDouble(
+                TextureCache::DEFAULT_BUDGET / (1024.0 * 1024.0));
+    textureCache.SetBudget(size_t(glm::max(budgetMB, 0.0) * 1024 * 1024));
+    textureCache.SetMaxIdleFrames(jdoc.object()["textureIdleFrames"].toInt(
+                TextureCache::DEFAULT_MAX_IDLE_FRAMES));
+
+    //Read the mesh data in the file
+    QJsonArray objects = jdoc.object()["objects"].toArray();
+    //Scenes made only of custom and regular polygons are in pixel space
+    Projection projection = Projection::Flat2D;
+    for(int i = 0; i < objects.size(); i++)
+    {
+        LoadSceneObject(objects[i].toObject(), local_path.toString(), -1, polygons, scene,
+                        projection, textureCache);
+    }
+
+    //A scene can also name its projection explicitly
+    QString projName = jdoc.object()["projection"].toString();
+    if(QString::compare(projName, QString("2D")) == 0)
+    {
+        projection = Projection::Flat2D;
+    }
+    else if(QString::compare(projName, QString("pinhole")) == 0)
+    {
+        projection = Projection::Pinhole;
+    }
+    else if(QString::compare(projName, QString("fisheye")) == 0)
+    {
+        projection = Projection::FishEye;
+    }
+
+    //Point and spot lights
+    std::vector<Light> lights;
+    QJsonArray lightsA = jdoc.object()["lights"].toArray();
+    for(int i = 0; i < lightsA.size(); i++)
+    {
+        QJsonObject obj = lightsA[i].toObject();
+        Light l;
+        QJsonArray posA = obj["pos"].toArray();
+        l.position = glm::vec4(posA[0].toDouble(), posA[1].toDouble(), posA[2].toDouble(), 1);
+        if(obj.contains(QString("color")))
+        {
+            QJsonArray colorA = obj["color"].toArray();
+            l.color = glm::vec3(colorA[0].toDouble(), colorA[1].toDouble(), colorA[2].toDouble());
+        }
+        l.intensity = obj["intensity"].toDouble(1.0);
+        l.range = obj["range"].toDouble(10.0);
+        l.castsShadows = obj["shadows"].toBool(false);
+        if(QString::compare(obj["type"].toString(), QString("spot")) == 0)
+        {
+            l.type = LightType::Spot;
+            QJsonArray dirA = obj["dir"].toArray();
+            l.direction = glm::normalize(glm::vec4(dirA[0].toDouble(), dirA[1].toDouble(),
+                                                   dirA[2].toDouble(), 0));
+            float angle = obj["angle"].toDouble(30.0);
+            float softness = obj["softness"].toDouble(0.2);
+            l.outerCos = std::cos(glm::radians(angle));
+            l.innerCos = std::cos(glm::radians(angle * (1.f - softness)));
+        }
+        lights.push_back(l);
+    }
+
+    rasterizer = Rasterizer(std::move(polygons), std::move(scene), &textureCache);
+    rasterizer.projection = projection;
+    rasterizer.lights = lights;
+    rasterizer.depthPrepass = jdoc.object()["depthPrepass"].toBool(false);
+    rasterizer.sortFrontToBack = jdoc.object()["sortFrontToBack"].toBool(false);
+    rasterizer.occlusionCulling = jdoc.object()["occlusionCulling"].toBool(true);
+    if(lights.size() > 0)
+    {
+        rasterizer.lighting = Lighting::SceneLights;
+    }
+
+    return true;
+}
+
+
+//Reads an OBJ file into one Polygon, sharing and reordering its corners
+Polygon LoadOBJ(const QString &file, const QString &polyName)
+{
+    TraceScope span("obj parse");
+    Polygon p(polyName);
+    QString filepath = file;
+    std::vector<tinyobj::shape_t> shapes; std::vector<tinyobj::material_t> materials;
+    std::string errors = tinyobj::LoadObj(shapes, materials, filepath.toStdString().c_str());
+    std::cout << errors << std::endl;
+    if(errors.size() == 0)
+    {
+        int min_idx = 0;
+        //Read the information from the vector of shape_ts
+        for(unsigned int i = 0; i < shapes.size(); i++)
+        {
+            std::vector<glm::vec4> pos, nor;
+            std::vector<glm::vec2> uv;
+            std::vector<float> &positions = shapes[i].mesh.positions;
+            std::vector<float> &normals = shapes[i].mesh.normals;
+            std::vector<float> &uvs = shapes[i].mesh.texcoords;
+            for(unsigned int j = 0; j < positions.size()/3; j++)
+            {
+                pos.push_back(glm::vec4(positions[j*3], positions[j*3+1], positions[j*3+2],1));
+            }
+            for(unsigned int j = 0; j < normals.size()/3; j++)
+            {
+                nor.push_back(glm::vec4(normals[j*3], normals[j*3+1], normals[j*3+2],0));
+            }
+            for(unsigned int j = 0; j < uvs.size()/2; j++)
+            {
+                uv.push_back(glm::vec2(uvs[j*2], uvs[j*2+1]));
+            }
+            for(unsigned int j = 0; j < pos.size(); j++)
+            {
+                p.AddVertex(Vertex(pos[j], glm::vec3(255,255,255), nor[j], uv[j]));
+
+                /* Add vertex coloration for debugging purposes
+                p.AddVertex(Vertex(pos[j], glm::vec3(((float)rand() / RAND_MAX) * 255,
+                                                     (float)rand() / RAND_MAX * 255,
+                                   (float)rand() / RAND_MAX * 255), nor[j], uv[j])); */
+
+            }
+
+            std::vector<unsigned int> indices = shapes[i].mesh.indices;
+            for(unsigned int j = 0; j < indices.size(); j += 3)
+            {
+                Triangle t;
+                t.m_indices[0] = indices[j] + min_idx;
+                t.m_indices[1] = indices[j+1] + min_idx;
+                t.m_indices[2] = indices[j+2] + min_idx;
+                p.AddTriangle(t);
+            }
+
+            min_idx += pos.size();
+        }
+
+        //Share corners between triangles and order them for the vertex cache
+        OptimizeMesh(p);
+    }
+    else
+    {
+        //An error loading the OBJ occurred!
+        std::cout << errors << std::endl;
+    }
+    return p;
+}
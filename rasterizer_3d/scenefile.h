@@ -0,0 +1,18 @@
+// Reading JSON scene files and the OBJ meshes they name, shared by the
+// viewer and the benchmark
+
+#pragma once
+#include <QString>
+#include "polygon.h"
+#include "rasterizer.h"
+#include "texture.h"
+
+// Reads the scene file at filename into rasterizer, replacing whatever it
+// drew before, with its textures loaded into textureCache. Sets the
+// projection, lights and render options the file asks for. Returns false if
+// the file could not be opened.
+bool LoadScene(const QString &filename, TextureCache &textureCache, Rasterizer &rasterizer);
+
+// Reads an OBJ file into one Polygon named polyName, sharing corners between
+// triangles and ordering them for the vertex cache
+Polygon LoadOBJ(const QString &file, const QString &polyName);
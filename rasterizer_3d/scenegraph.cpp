@@ -0,0 +1,235 @@
+// Hierarchy of transforms placing the Polygons of a scene
+
+#include "scenegraph.h"
+#include "shader.h"
+#include <algorithm>
+
+using namespace glm;
+
+using namespace std;
+
+
+SceneNode::SceneNode(int parent, const mat4& local, int polygon)
+    : parent(parent), children(), local(local), instance(polygon), subtreeBounds(),
+      unbounded(false)
+{}
+
+
+SceneGraph::SceneGraph()
+    : m_nodes(), m_live(), m_roots(), m_free(), m_moved(), m_placed(), m_changed(),
+      m_changedBelow(), m_anyChanged(false)
+{}
+
+
+// Adds a node under parent, to be placed by the next Update
+int SceneGraph::AddNode(int parent, const mat4& local, int polygon)
+{
+    int index = m_nodes.size();
+    if(!m_free.empty())
+    {
+        index = m_free.back();
+        m_free.pop_back();
+        m_nodes[index] = SceneNode(parent, local, polygon);
+    }
+    else
+    {
+        m_nodes.push_back(SceneNode(parent, local, polygon));
+        m_live.push_back(false);
+        m_changed.push_back(false);
+        m_changedBelow.push_back(false);
+    }
+    m_live[index] = true;
+
+    if(parent < 0)
+    {
+        m_roots.push_back(index);
+    }
+    else
+    {
+        m_nodes[parent].children.push_back(index);
+    }
+
+    MarkChanged(index);
+    return index;
+}
+
+
+// Detaches a node from its parent and frees it and its descendants. Nodes
+// already removed are left alone, as their slots may be free or reused.
+void SceneGraph::RemoveNode(int node)
+{
+    if(!IsLive(node))
+    {
+        return;
+    }
+
+    int parent = m_nodes[node].parent;
+    vector<int>& siblings = parent < 0 ? m_roots : m_nodes[parent].children;
+    siblings.erase(std::find(siblings.begin(), siblings.end(), node));
+
+    // The parent's subtree bounds shrink
+    MarkAbove(node);
+    m_anyChanged = true;
+
+    vector<int> stack(1, node);
+    while(!stack.empty())
+    {
+        int index = stack.back();
+        stack.pop_back();
+
+        SceneNode& removed = m_nodes[index];
+        stack.insert(stack.end(), removed.children.begin(), removed.children.end());
+
+        m_moved.Add(removed.instance.bounds);
+        m_placed.push_back(index);
+        removed = SceneNode(-1, mat4(1.f), -1);
+        m_changed[index] = false;
+        m_changedBelow[index] = false;
+        m_live[index] = false;
+        m_free.push_back(index);
+    }
+}
+
+
+// Moves a node and marks the path to it for the next Update
+void SceneGraph::SetLocal(int node, const mat4& local)
+{
+    m_nodes[node].local = local;
+    MarkChanged(node);
+}
+
+
+void SceneGraph::SetPolygon(int node, int polygon)
+{
+    m_nodes[node].instance.polygon = polygon;
+    MarkChanged(node);
+}
+
+
+// Marks every node drawing polygon so its bounds are fitted again
+void SceneGraph::PolygonChanged(int polygon)
+{
+    for(unsigned int i = 0; i < m_nodes.size(); i++)
+    {
+        if(m_nodes[i].instance.polygon == polygon)
+        {
+            MarkChanged(i);
+        }
+    }
+}
+
+
+// Marks a node and the path to it for the next Update
+void SceneGraph::MarkChanged(int node)
+{
+    m_changed[node] = true;
+    m_anyChanged = true;
+    MarkAbove(node);
+}
+
+// Marks the ancestors of a node as far up as they are not marked already
+void SceneGraph::MarkAbove(int node)
+{
+    for(int a = m_nodes[node].parent; a >= 0 && !m_changedBelow[a]; a = m_nodes[a].parent)
+    {
+        m_changedBelow[a] = true;
+    }
+}
+
+
+bool SceneGraph::IsLive(int node) const
+{
+    return node >= 0 && node < int(m_nodes.size()) && m_live[node];
+}
+
+
+const SceneNode& SceneGraph::Node(int node) const
+{
+    return m_nodes[node];
+}
+
+int SceneGraph::NumNodes() const
+{
+    return m_nodes.size();
+}
+
+
+// Updates the marked nodes, their descendants and their ancestors' bounds
+bool SceneGraph::Update(const vector<Polygon>& polygons, Bounds* moved, vector<int>* changed)
+{
+    if(!m_anyChanged)
+    {
+        return false;
+    }
+
+    for(int root : m_roots)
+    {
+        UpdateNode(root, mat4(1.f), false, polygons);
+    }
+    m_anyChanged = false;
+
+    m_moved.UpdateSphere();
+    if(moved != nullptr)
+    {
+        *moved = m_moved;
+    }
+    m_moved = Bounds();
+
+    if(changed != nullptr)
+    {
+        changed->swap(m_placed);
+    }
+    m_placed.clear();
+    return true;
+}
+
+
+// Updates the subtree under node if it or anything above it moved
+void SceneGraph::UpdateNode(int index, const mat4& parentWorld, bool parentMoved,
+                            const vector<Polygon>& polygons)
+{
+    bool moved = parentMoved || m_changed[index];
+    if(!moved && !m_changedBelow[index])
+    {
+        return;
+    }
+    m_changed[index] = false;
+    m_changedBelow[index] = false;
+
+    SceneNode& node = m_nodes[index];
+    const Polygon* p = node.instance.polygon >= 0 ? &polygons[node.instance.polygon] : nullptr;
+    if(moved)
+    {
+        m_moved.Add(node.instance.bounds);
+        m_placed.push_back(index);
+        node.instance.transform = parentWorld * node.local;
+        if(p != nullptr)
+        {
+            node.instance.UpdateBounds(*p);
+        }
+        else
+        {
+            node.instance.bounds = Bounds();
+        }
+        m_moved.Add(node.instance.bounds);
+    }
+
+    for(int child : node.children)
+    {
+        UpdateNode(child, node.instance.transform, moved, polygons);
+    }
+
+    // A leaf keeps its Polygon's tight sphere; anything more gets the one
+    // around the combined box
+    node.subtreeBounds = p != nullptr ? node.instance.bounds : Bounds();
+    node.unbounded = p != nullptr && p->mp_shader != nullptr && p->mp_shader->vertex;
+    if(!node.children.empty())
+    {
+        for(int child : node.children)
+        {
+            node.subtreeBounds.Add(m_nodes[child].subtreeBounds);
+            node.unbounded = node.unbounded || m_nodes[child].unbounded;
+        }
+        node.subtreeBounds.UpdateSphere();
+    }
+}
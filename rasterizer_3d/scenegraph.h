@@ -0,0 +1,130 @@
+// Hierarchy of transforms placing the Polygons of a scene
+
+#pragma once
+#include <glm/glm.hpp>
+#include <vector>
+#include "bounds.h"
+#include "instance.h"
+#include "polygon.h"
+
+// One node of a SceneGraph. It may draw a Polygon, and it carries its
+// children with it wherever it moves.
+struct SceneNode
+{
+    // -1 for a root
+    int parent;
+    std::vector<int> children;
+
+    // Places the node relative to its parent
+    glm::mat4 local;
+
+    // The Polygon the node draws, if instance.polygon is not -1.
+    // instance.transform is the node's cached world transform.
+    Instance instance;
+
+    // Around everything the node and its descendants draw, in world space
+    Bounds subtreeBounds;
+
+    // Whether the node or a descendant draws a Polygon with a vertex
+    // shader, which may move it out of any bounds, so the subtree must not
+    // be culled as a whole
+    bool unbounded;
+
+    SceneNode(int parent, const glm::mat4& local, int polygon);
+};
+
+// Nodes are kept in the order they are added, and the Rasterizer draws
+// them in that order, parents before children, so 2D scenes keep the order
+// of their file. World transforms and bounds are cached; changing a node
+// only marks it, and Update redoes the work for the marked nodes, their
+// descendants and their ancestors' bounds. A node's index stays the same
+// until it is removed, after which a new node may reuse it.
+class SceneGraph
+{
+public:
+    SceneGraph();
+
+    // Adds a node under parent, or a root if parent is -1, drawing polygon
+    // if it is not -1. Returns the new node's index.
+    int AddNode(int parent, const glm::mat4& local, int polygon = -1);
+
+    // Removes a node and all of its descendants. Does nothing if node was
+    // never added or has already been removed.
+    void RemoveNode(int node);
+
+    // Moves a node relative to its parent, taking its descendants along
+    void SetLocal(int node, const glm::mat4& local);
+
+    // Makes a node draw another Polygon, or nothing if polygon is -1
+    void SetPolygon(int node, int polygon);
+
+    // Marks every node drawing polygon, after the Polygon itself has changed
+    void PolygonChanged(int polygon);
+
+    // Whether node was added and has not been removed since
+    bool IsLive(int node) const;
+
+    const SceneNode& Node(int node) const;
+    int NumNodes() const;
+
+    // Brings the cached world transforms and bounds up to date with the
+    // nodes changed since the last Update, given the Polygons the nodes
+    // draw. Returns whether anything moved, and if moved is given, fits it
+    // around where everything that moved or was removed was and now is. If
+    // changed is given, it lists the nodes placed again or removed, each at
+    // least once.
+    bool Update(const std::vector<Polygon>& polygons, Bounds* moved = nullptr,
+                std::vector<int>* changed = nullptr);
+
+    // Visits nodes depth first, parents before children and siblings in
+    // order. visit(index, node) returns false to skip the node's children.
+    template<class Visitor>
+    void Traverse(Visitor visit) const
+    {
+        std::vector<int> stack(m_roots.rbegin(), m_roots.rend());
+
+        while(!stack.empty())
+        {
+            int index = stack.back();
+            stack.pop_back();
+
+            const SceneNode& node = m_nodes[index];
+            if(!visit(index, node))
+            {
+                continue;
+            }
+            stack.insert(stack.end(), node.children.rbegin(), node.children.rend());
+        }
+    }
+
+private:
+    // Marks a node, and the path to it, for the next Update
+    void MarkChanged(int node);
+    void MarkAbove(int node);
+
+    // Updates the subtree under node if it or anything above it moved, or
+    // anything below it changed
+    void UpdateNode(int node, const glm::mat4& parentWorld, bool parentMoved,
+                    const std::vector<Polygon>& polygons);
+
+    std::vector<SceneNode> m_nodes;
+
+    // Whether each slot of m_nodes holds a node, rather than a removed one
+    std::vector<bool> m_live;
+    std::vector<int> m_roots;
+
+    // Indices of removed nodes, reused by AddNode
+    std::vector<int> m_free;
+
+    // Around everything moved or removed since the last Update
+    Bounds m_moved;
+
+    // The nodes placed again or removed since the last Update
+    std::vector<int> m_placed;
+
+    // Nodes whose local transform changed since the last Update, and the
+    // ancestors of such nodes, so Update only descends where it must
+    std::vector<bool> m_changed;
+    std::vector<bool> m_changedBelow;
+    bool m_anyChanged;
+};
@@ -0,0 +1,213 @@
+// User supplied vertex and fragment shaders.
+
+#include "shader.h"
+#include <map>
+#include <mutex>
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Samples the texture at count UVs, writing colors in [0, 255]. The tiles
+// the batch needs are pinned once for the whole batch.
+void SampleTextureBatch(const Texture* texture, float lod, int count,
+                        const float* u, const float* v, float* r, float* g, float* b)
+{
+    TextureSampler sampler(texture);
+    sampler.SampleBatch(lod, count, u, v, r, g, b);
+}
+
+
+// Every shader that can be named by a scene file. Scenes load on the job
+// system, so shaders are registered and looked up under the lock.
+struct ShaderRegistry
+{
+    mutex lock;
+    map<QString, shared_ptr<Shader>> shaders;
+
+    ShaderRegistry()
+        : lock(), shaders()
+    {
+        shaders[QString("lambert")] = LambertShader();
+        shaders[QString("normals")] = NormalShader();
+    }
+};
+
+// Made the first time it is used; C++11 makes that safe from any thread
+static ShaderRegistry& Shaders()
+{
+    static ShaderRegistry registry;
+    return registry;
+}
+
+void RegisterShader(const QString& name, shared_ptr<Shader> shader)
+{
+    ShaderRegistry& registry = Shaders();
+    lock_guard<mutex> lock(registry.lock);
+    registry.shaders[name] = shader;
+}
+
+shared_ptr<Shader> FindShader(const QString& name)
+{
+    ShaderRegistry& registry = Shaders();
+    lock_guard<mutex> lock(registry.lock);
+
+    auto found = registry.shaders.find(name);
+    if(found == registry.shaders.end())
+    {
+        return nullptr;
+    }
+    return found->second;
+}
+
+
+// Samples the batch's texture into outR, outG and outB. Like the built in
+// pipeline, UVs outside a texture are black and untextured surfaces white.
+static void SampleBaseColor(FragmentBatch& b, const ShaderUniforms& uniforms)
+{
+    SampleTextureBatch(uniforms.texture, uniforms.texLod, b.count, b.u, b.v,
+                       b.outR, b.outG, b.outB);
+
+    if(uniforms.texture == nullptr)
+    {
+        return;
+    }
+
+    for(int i = 0; i < b.count; i++)
+    {
+        float inside = (b.u[i] >= 0.f && b.v[i] >= 0.f && b.u[i] <= 1.f && b.v[i] <= 1.f)
+                ? 1.f : 0.f;
+        b.outR[i] *= inside;
+        b.outG[i] *= inside;
+        b.outB[i] *= inside;
+    }
+}
+
+// Normalizes the batch's normals into nx, ny and nz, perturbed by the
+// normal map if there is one. The map is sampled for the whole batch first.
+static void SurfaceNormals(const FragmentBatch& b, const ShaderUniforms& uniforms,
+                           float* nx, float* ny, float* nz)
+{
+    float nmR[FragmentBatch::SIZE], nmG[FragmentBatch::SIZE], nmB[FragmentBatch::SIZE];
+    if(uniforms.normalMap != nullptr)
+    {
+        SampleTextureBatch(uniforms.normalMap, uniforms.normLod, b.count, b.u, b.v,
+                           nmR, nmG, nmB);
+    }
+
+    for(int i = 0; i < b.count; i++)
+    {
+        vec3 normal = normalize(vec3(b.nx[i], b.ny[i], b.nz[i]));
+
+        if(uniforms.normalMap != nullptr)
+        {
+            vec3 tangent = vec3(b.tx[i], b.ty[i], b.tz[i]);
+            tangent = normalize(tangent - normal * dot(normal, tangent));
+            vec3 bitangent = cross(normal, tangent) * (b.tw[i] < 0.f ? -1.f : 1.f);
+            vec3 mapped = vec3(nmR[i], nmG[i], nmB[i]) / 127.5f - vec3(1.f);
+            normal = normalize(tangent * mapped[0] + bitangent * mapped[1] + normal * mapped[2]);
+        }
+
+        nx[i] = normal[0];
+        ny[i] = normal[1];
+        nz[i] = normal[2];
+    }
+}
+
+// Scales down colors brighter than 255 in any channel, keeping their hue
+static vec3 ClampToWhite(vec3 color)
+{
+    float maxChannel = glm::max(glm::max(color[0], color[1]), color[2]);
+    if(maxChannel > 255.f)
+    {
+        color *= 255.f / maxChannel;
+    }
+    return color;
+}
+
+
+// Textured Lambertian lighting from the camera, matching the built in pipeline
+shared_ptr<Shader> LambertShader()
+{
+    shared_ptr<Shader> shader = make_shared<Shader>();
+
+    shader->fragment = [](FragmentBatch& b, const ShaderUniforms& uniforms)
+    {
+        SampleBaseColor(b, uniforms);
+
+        float nx[FragmentBatch::SIZE], ny[FragmentBatch::SIZE], nz[FragmentBatch::SIZE];
+        SurfaceNormals(b, uniforms, nx, ny, nz);
+
+        for(int i = 0; i < b.count; i++)
+        {
+            float scaleFactor = CameraLight(vec3(nx[i], ny[i], nz[i]), vec3(uniforms.camForward));
+
+            vec3 color = ClampToWhite(vec3(b.outR[i], b.outG[i], b.outB[i]) * scaleFactor);
+
+            b.outR[i] = color[0];
+            b.outG[i] = color[1];
+            b.outB[i] = color[2];
+        }
+    };
+
+    return shader;
+}
+
+
+// Textured lighting from the scene's point and spot lights, with their
+// shadows, matching the built in pipeline
+shared_ptr<Shader> SceneLightShader()
+{
+    shared_ptr<Shader> shader = make_shared<Shader>();
+
+    shader->fragment = [](FragmentBatch& b, const ShaderUniforms& uniforms)
+    {
+        SampleBaseColor(b, uniforms);
+
+        float nx[FragmentBatch::SIZE], ny[FragmentBatch::SIZE], nz[FragmentBatch::SIZE];
+        SurfaceNormals(b, uniforms, nx, ny, nz);
+
+        for(int i = 0; i < b.count; i++)
+        {
+            vec3 normal = vec3(nx[i], ny[i], nz[i]);
+            vec3 worldPos = vec3(b.px[i], b.py[i], b.pz[i]);
+
+            vec3 light = AccumulateLights(worldPos, normal, vec3(uniforms.camPos),
+                                          uniforms.ambient, *uniforms.lights,
+                                          *uniforms.lightGrid, *uniforms.shadowMaps,
+                                          b.x[i], b.y[i]);
+
+            vec3 color = ClampToWhite(vec3(b.outR[i], b.outG[i], b.outB[i]) * light);
+
+            b.outR[i] = color[0];
+            b.outG[i] = color[1];
+            b.outB[i] = color[2];
+        }
+    };
+
+    return shader;
+}
+
+
+// Shows the surface normal as a color
+shared_ptr<Shader> NormalShader()
+{
+    shared_ptr<Shader> shader = make_shared<Shader>();
+
+    shader->fragment = [](FragmentBatch& b, const ShaderUniforms&)
+    {
+        for(int i = 0; i < b.count; i++)
+        {
+            float len = std::sqrt(b.nx[i] * b.nx[i] + b.ny[i] * b.ny[i] + b.nz[i] * b.nz[i]);
+            float inv = len > 0.f ? 1.f / len : 0.f;
+
+            b.outR[i] = (b.nx[i] * inv + 1.f) * 127.5f;
+            b.outG[i] = (b.ny[i] * inv + 1.f) * 127.5f;
+            b.outB[i] = (b.nz[i] * inv + 1.f) * 127.5f;
+        }
+    };
+
+    return shader;
+}
@@ -0,0 +1,109 @@
+// User supplied vertex and fragment shaders.
+//
+// Shaders are called on batches of up to SIZE vertices or fragments whose
+// attributes are laid out as structure of arrays, so a shader written as
+// plain loops over the batch can be vectorized by the compiler.
+
+#pragma once
+#include <glm/glm.hpp>
+#include <QString>
+#include <functional>
+#include <memory>
+#include "texture.h"
+#include "light.h"
+#include "shadowmap.h"
+
+// Values that stay the same for every vertex and fragment of a draw
+struct ShaderUniforms
+{
+    glm::mat4 viewMat;
+    glm::vec4 camPos;
+    glm::vec4 camForward;
+
+    // The Polygon's texture and normal map, either may be null
+    const Texture* texture;
+    const Texture* normalMap;
+
+    // Mip levels picked for the triangle a fragment batch comes from
+    float texLod;
+    float normLod;
+
+    // The scene's lights; lightGrid->LightsAt gives the ones reaching a fragment.
+    // The grid is only rebuilt while the Rasterizer's lighting is SceneLights.
+    const std::vector<Light>* lights;
+    const LightGrid* lightGrid;
+    float ambient;
+
+    // One per light; ShadowMap::Visibility tells how much of a light reaches a point
+    const std::vector<ShadowMap>* shadowMaps;
+};
+
+// World space vertices handed to a vertex shader. The shader may change any
+// attribute in place; positions are projected afterwards.
+struct VertexBatch
+{
+    static const int SIZE = 16;
+
+    int count;
+
+    float px[SIZE], py[SIZE], pz[SIZE];
+    float nx[SIZE], ny[SIZE], nz[SIZE];
+    float u[SIZE], v[SIZE];
+    float r[SIZE], g[SIZE], b[SIZE];
+};
+
+// Fragments that passed the depth test, all from the same triangle.
+// Inputs are perspective correct; the shader fills in outR, outG and outB
+// with colors in [0, 255].
+struct FragmentBatch
+{
+    static const int SIZE = 16;
+
+    int count;
+
+    int x[SIZE], y[SIZE];
+    float depth[SIZE];
+
+    float px[SIZE], py[SIZE], pz[SIZE];     // World space position
+    float u[SIZE], v[SIZE];
+    float nx[SIZE], ny[SIZE], nz[SIZE];
+    float tx[SIZE], ty[SIZE], tz[SIZE], tw[SIZE];
+    float r[SIZE], g[SIZE], b[SIZE];
+
+    float outR[SIZE], outG[SIZE], outB[SIZE];
+};
+
+typedef std::function<void(VertexBatch&, const ShaderUniforms&)> VertexShader;
+typedef std::function<void(FragmentBatch&, const ShaderUniforms&)> FragmentShader;
+
+// A pair of shaders a Polygon is drawn with. Either may be empty; without a
+// fragment shader fragments take their interpolated vertex color.
+struct Shader
+{
+    VertexShader vertex;
+    FragmentShader fragment;
+};
+
+
+// Samples the texture at count UVs, writing colors in [0, 255].
+// A null texture gives white, like TextureSampler::Sample.
+void SampleTextureBatch(const Texture* texture, float lod, int count,
+                        const float* u, const float* v, float* r, float* g, float* b);
+
+// Makes a name usable as the "shader" of an object in a scene file
+void RegisterShader(const QString& name, std::shared_ptr<Shader> shader);
+
+// Returns the shader registered under name, or nullptr if there is none.
+// "lambert" and "normals" are always available.
+std::shared_ptr<Shader> FindShader(const QString& name);
+
+// Textured Lambertian lighting from the camera, matching the built in pipeline
+std::shared_ptr<Shader> LambertShader();
+
+// Textured lighting from the scene's lights, matching the built in pipeline.
+// Only usable while the Rasterizer's lighting is SceneLights, as the light
+// grid is not kept up to date otherwise.
+std::shared_ptr<Shader> SceneLightShader();
+
+// Shows the surface normal as a color, useful for checking normals and tangents
+std::shared_ptr<Shader> NormalShader();
@@ -0,0 +1,208 @@
+// Depth rendered from a light's point of view, used to find what the light cannot reach
+
+#include "shadowmap.h"
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+ShadowMap::ShadowMap() : m_light(), m_views(), m_depths(), m_texelSize(0.f)
+{}
+
+
+// Aims the views at everything the light can reach
+void ShadowMap::Setup(const Light& light)
+{
+    m_light = light;
+
+    vector<vec3> forwards;
+    vector<vec3> ups;
+    float fov = 90.f;
+
+    if(light.type == LightType::Point)
+    {
+        // Cube faces in the order FaceOf returns them: +X, -X, +Y, -Y, +Z, -Z
+        forwards = {vec3(1.f, 0.f, 0.f), vec3(-1.f, 0.f, 0.f), vec3(0.f, 1.f, 0.f),
+                    vec3(0.f, -1.f, 0.f), vec3(0.f, 0.f, 1.f), vec3(0.f, 0.f, -1.f)};
+        ups = {vec3(0.f, 1.f, 0.f), vec3(0.f, 1.f, 0.f), vec3(0.f, 0.f, 1.f),
+               vec3(0.f, 0.f, 1.f), vec3(0.f, 1.f, 0.f), vec3(0.f, 1.f, 0.f)};
+    }
+    else
+    {
+        vec3 forward = normalize(vec3(light.direction));
+        vec3 up = std::abs(forward[1]) < 0.99f ? vec3(0.f, 1.f, 0.f) : vec3(0.f, 0.f, 1.f);
+        forwards = {forward};
+        ups = {normalize(up - forward * dot(forward, up))};
+
+        // Cover the outer cone, plus a little for the filter taps at its edge
+        float halfAngle = glm::degrees(std::acos(glm::clamp(light.outerCos, -1.f, 1.f)));
+        fov = glm::clamp(2.f * halfAngle + 2.f, 1.f, 170.f);
+    }
+
+    m_views.resize(forwards.size());
+    m_depths.resize(forwards.size());
+
+    for(unsigned int i = 0; i < forwards.size(); i++)
+    {
+        Camera& c = m_views[i].camera;
+        c.position = light.position;
+        c.forward = vec4(forwards[i], 0.f);
+        c.up = vec4(ups[i], 0.f);
+        c.right = vec4(cross(forwards[i], ups[i]), 0.f);
+        c.fov = fov;
+        c.nearClip = 0.05f;
+        c.farClip = glm::max(light.range, 1.f);
+
+        m_views[i].compositionMat = c.getPerspProjMat() * c.getViewMat();
+    }
+
+    m_texelSize = 2.f * std::tan(glm::radians(fov) / 2.f) / 512.f;
+}
+
+
+// Forgets the light; Visibility then reports every point as lit
+void ShadowMap::Clear()
+{
+    m_views.clear();
+    m_depths.clear();
+}
+
+
+// Whether the maps were set up for a light with this position, direction and cone
+bool ShadowMap::Matches(const Light& light) const
+{
+    if(m_views.empty() || light.type != m_light.type || light.position != m_light.position ||
+            light.range != m_light.range)
+    {
+        return false;
+    }
+
+    return light.type == LightType::Point ||
+            (light.direction == m_light.direction && light.outerCos == m_light.outerCos);
+}
+
+
+int ShadowMap::NumViews() const
+{
+    return m_views.size();
+}
+
+
+Camera& ShadowMap::ViewCamera(int i)
+{
+    return m_views[i].camera;
+}
+
+array<float, 262144>& ShadowMap::ViewDepth(int i)
+{
+    return m_depths[i];
+}
+
+
+// Index of the cube face of a point light that sees pos
+int ShadowMap::FaceOf(const vec3& pos) const
+{
+    vec3 d = pos - vec3(m_light.position);
+    vec3 a = abs(d);
+
+    if(a[0] >= a[1] && a[0] >= a[2])
+    {
+        return d[0] >= 0.f ? 0 : 1;
+    }
+    if(a[1] >= a[2])
+    {
+        return d[1] >= 0.f ? 2 : 3;
+    }
+    return d[2] >= 0.f ? 4 : 5;
+}
+
+
+// Returns the fraction of the 3x3 texels around pos's projection that the light reaches
+float ShadowMap::Visibility(const vec3& pos) const
+{
+    if(m_views.empty())
+    {
+        return 1.f;
+    }
+
+    int i = m_light.type == LightType::Point ? FaceOf(pos) : 0;
+
+    vec4 clip = m_views[i].compositionMat * vec4(pos, 1.f);
+
+    // Behind a spot light, where its cone never reaches anyway
+    if(clip[3] <= 0.f)
+    {
+        return 1.f;
+    }
+
+    // Convert to Pixel Space, the same way the depth was rendered
+    float px = (clip[0] / clip[3] + 1.f) * 256.f;
+    float py = (1.f - clip[1] / clip[3]) * 256.f;
+
+    if(px < 0.f || py < 0.f || px >= 512.f || py >= 512.f)
+    {
+        return 1.f;
+    }
+
+    // Depths are distances from the light. Texels cover more of the surface
+    // further away, so the bias grows with distance.
+    float dist = length(pos - vec3(m_light.position));
+    float biased = dist - (m_light.shadowBias + 2.f * m_texelSize * dist);
+
+    int cx = int(px + 0.5f);
+    int cy = int(py + 0.5f);
+
+    const array<float, 262144>& depth = m_depths[i];
+
+    int lit = 0;
+    for(int dy = -1; dy <= 1; dy++)
+    {
+        int y = glm::clamp(cy + dy, 0, 511);
+        for(int dx = -1; dx <= 1; dx++)
+        {
+            int x = glm::clamp(cx + dx, 0, 511);
+            if(biased <= depth[x + 512 * y])
+            {
+                lit++;
+            }
+        }
+    }
+
+    return lit / 9.f;
+}
+
+
+// Returns the light reaching pos from the ambient light and the lights
+// binned at pixel (x, y), lighting the side of the surface facing camPos
+vec3 AccumulateLights(const vec3& pos, vec3 normal, const vec3& camPos, float ambient,
+                      const vector<Light>& lights, const LightGrid& grid,
+                      const vector<ShadowMap>& shadowMaps, int x, int y)
+{
+    // Light both sides of the surface, like the camera light does
+    if(dot(normal, camPos - pos) < 0.f)
+    {
+        normal = -normal;
+    }
+
+    vec3 light = vec3(ambient);
+
+    const int* indices;
+    int numLights = grid.LightsAt(x, y, indices);
+    for(int i = 0; i < numLights; i++)
+    {
+        const Light& l = lights[indices[i]];
+        float attenuation = l.Attenuate(pos, normal);
+
+        // Only look up the shadow map where the light would otherwise reach
+        if(attenuation > 0.f && l.castsShadows)
+        {
+            attenuation *= shadowMaps[indices[i]].Visibility(pos);
+        }
+
+        light += l.color * (l.intensity * attenuation);
+    }
+
+    return light;
+}
@@ -0,0 +1,62 @@
+// Depth rendered from a light's point of view, used to find what the light cannot reach
+
+#pragma once
+#include <glm/glm.hpp>
+#include <array>
+#include <vector>
+#include "camera.h"
+#include "light.h"
+
+// A spot light is seen through a single view along its cone. A point light
+// needs the six 90 degree views of a cube around it.
+class ShadowMap
+{
+public:
+    ShadowMap();
+
+    // Aims the views at everything the light can reach
+    void Setup(const Light& light);
+
+    // Forgets the light; Visibility then reports every point as lit
+    void Clear();
+
+    // Whether the maps were set up for a light with this position, direction and cone
+    bool Matches(const Light& light) const;
+
+    int NumViews() const;
+
+    // The camera of view i and the depth buffer it is rendered into
+    Camera& ViewCamera(int i);
+    std::array<float, 262144>& ViewDepth(int i);
+
+    // Returns the fraction of the 3x3 texels around pos's projection that
+    // the light reaches, so shadow edges are softened by one texel
+    float Visibility(const glm::vec3& pos) const;
+
+private:
+    struct View
+    {
+        Camera camera;
+        glm::mat4 compositionMat;
+    };
+
+    // Index of the cube face of a point light that sees pos
+    int FaceOf(const glm::vec3& pos) const;
+
+    Light m_light;
+    std::vector<View> m_views;
+
+    // One per view, on the heap; a point light's six take 6MB
+    std::vector<std::array<float, 262144>> m_depths;
+
+    // Width of a texel one unit from the light, scales the bias with distance
+    float m_texelSize;
+};
+
+// Returns the light reaching pos, on the side of the surface facing camPos:
+// the ambient light plus every light the grid binned at pixel (x, y),
+// attenuated and, where the light casts shadows, shadowed by its ShadowMap
+glm::vec3 AccumulateLights(const glm::vec3& pos, glm::vec3 normal, const glm::vec3& camPos,
+                           float ambient, const std::vector<Light>& lights,
+                           const LightGrid& grid, const std::vector<ShadowMap>& shadowMaps,
+                           int x, int y);
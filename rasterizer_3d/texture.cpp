@@ -0,0 +1,606 @@
+// Tiled, mipmapped textures and the cache that keeps them within a memory budget
+
+#include "texture.h"
+#include "jobs.h"
+#include "trace.h"
+#include <QColor>
+#include <iostream>
+#include <cmath>
+
+using namespace glm;
+
+using namespace std;
+
+
+// Texture
+
+Texture::Texture(TextureCache* cache, int id, const vector<MipLevel>& levels)
+    : mp_cache(cache), m_id(id), m_levels(levels)
+{}
+
+Texture::~Texture()
+{
+    const MipLevel& last = m_levels.back();
+    mp_cache->Release(m_id, last.firstTile + last.tilesX * last.tilesY);
+}
+
+int Texture::Width() const
+{
+    return m_levels[0].width;
+}
+
+int Texture::Height() const
+{
+    return m_levels[0].height;
+}
+
+int Texture::NumLevels() const
+{
+    return m_levels.size();
+}
+
+
+// Returns the mip level for a triangle covering texelArea texels of
+// level 0 in screenArea pixels
+float Texture::CalcLod(float texelArea, float screenArea) const
+{
+    if(screenArea <= 0.f || texelArea <= screenArea)
+    {
+        return 0.f;
+    }
+
+    // Each level halves both dimensions, so a quarter of the texels
+    return glm::min(0.5f * std::log2(texelArea / screenArea), NumLevels() - 1.f);
+}
+
+
+// Finds the tile holding the texel nearest to uv in the mip level lod
+// picks, and the texel's index within it. Returns false for UVs below 0.
+bool Texture::Locate(const vec2& uv, float lod, int& tile, int& texel) const
+{
+    int level = glm::clamp(int(lod + 0.5f), 0, NumLevels() - 1);
+    const MipLevel& mip = m_levels[level];
+
+    int X = glm::min(mip.width * uv.x, mip.width - 1.0f);
+    int Y = glm::min(mip.height * (1.0f - uv.y), mip.height - 1.0f);
+
+    if(X < 0 || Y < 0)
+    {
+        return false;
+    }
+
+    tile = mip.firstTile + (Y / TextureCache::TILE_SIZE) * mip.tilesX
+            + (X / TextureCache::TILE_SIZE);
+    texel = (Y % TextureCache::TILE_SIZE) * TextureCache::TILE_SIZE
+            + (X % TextureCache::TILE_SIZE);
+    return true;
+}
+
+
+// TextureCache
+
+TextureCache::TextureCache(size_t budgetBytes, const QString& cachePath)
+    : m_budget(budgetBytes), m_residentBytes(0), m_numFaults(0), m_frame(0),
+      m_maxIdleFrames(DEFAULT_MAX_IDLE_FRAMES), m_nextId(0), m_lru(), m_resident(), m_fileOffsets(),
+      m_fileEnd(0), m_freeOffsets(), m_cachePath(cachePath), m_file(), m_tempFile(),
+      mp_backing(nullptr)
+{
+    if(m_cachePath.isEmpty())
+    {
+        if(m_tempFile.open())
+        {
+            mp_backing = &m_tempFile;
+        }
+    }
+    else
+    {
+        m_file.setFileName(m_cachePath);
+        if(m_file.open(QIODevice::ReadWrite | QIODevice::Truncate))
+        {
+            mp_backing = &m_file;
+        }
+    }
+
+    if(mp_backing == nullptr)
+    {
+        cout << "Could not open the texture cache file; textures will stay resident" << endl;
+    }
+}
+
+TextureCache::~TextureCache()
+{}
+
+
+// Decodes the image file at path into a tiled, mipmapped Texture.
+// Returns nullptr if the image could not be read.
+shared_ptr<Texture> TextureCache::Load(const QString& path)
+{
+    TraceScope span("texture decode");
+    QImage image(path);
+
+    if(image.isNull())
+    {
+        return nullptr;
+    }
+
+    return Load(image);
+}
+
+
+// Builds a Texture from an already decoded image
+shared_ptr<Texture> TextureCache::Load(const QImage& image)
+{
+    if(image.isNull())
+    {
+        return nullptr;
+    }
+
+    int id;
+    {
+        lock_guard<mutex> lock(m_mutex);
+        id = m_nextId++;
+    }
+
+    // Level 0 is the decoded image; this is the only time the whole
+    // level is held in memory. Copying, cutting and filtering run on the
+    // job system outside the lock, which is only taken to store the tiles.
+    int width = image.width();
+    int height = image.height();
+    vector<QRgb> texels(width * height);
+    ParallelFor(0, height, ROW_GRAIN, [&](int y)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            texels[x + width * y] = image.pixel(x, y);
+        }
+    });
+
+    vector<MipLevel> levels;
+    int firstTile = 0;
+
+    while(true)
+    {
+        MipLevel mip;
+        mip.width = width;
+        mip.height = height;
+        mip.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        mip.tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        mip.firstTile = firstTile;
+        levels.push_back(mip);
+
+        // Cut the level into tiles and send them to the cache file
+        int numTiles = mip.tilesX * mip.tilesY;
+        vector<vector<QRgb>> tiles(numTiles);
+        ParallelFor(0, numTiles, TILE_GRAIN, [&](int t)
+        {
+            int tx = t % mip.tilesX;
+            int ty = t / mip.tilesX;
+            vector<QRgb>& tile = tiles[t];
+            tile.resize(TILE_SIZE * TILE_SIZE);
+            for(int y = 0; y < TILE_SIZE; y++)
+            {
+                int srcY = glm::min(ty * TILE_SIZE + y, height - 1);
+                for(int x = 0; x < TILE_SIZE; x++)
+                {
+                    int srcX = glm::min(tx * TILE_SIZE + x, width - 1);
+                    tile[x + TILE_SIZE * y] = texels[srcX + width * srcY];
+                }
+            }
+        });
+        {
+            lock_guard<mutex> lock(m_mutex);
+            for(int t = 0; t < numTiles; t++)
+            {
+                StoreTile(TileKey(id, firstTile + t), tiles[t]);
+            }
+        }
+        firstTile += numTiles;
+
+        if(width == 1 && height == 1)
+        {
+            break;
+        }
+
+        // Box filter down to the next level
+        int nextWidth = glm::max(width / 2, 1);
+        int nextHeight = glm::max(height / 2, 1);
+        vector<QRgb> next(nextWidth * nextHeight);
+        ParallelFor(0, nextHeight, ROW_GRAIN, [&](int y)
+        {
+            int y0 = glm::min(2 * y, height - 1);
+            int y1 = glm::min(2 * y + 1, height - 1);
+            for(int x = 0; x < nextWidth; x++)
+            {
+                int x0 = glm::min(2 * x, width - 1);
+                int x1 = glm::min(2 * x + 1, width - 1);
+
+                QRgb c0 = texels[x0 + width * y0];
+                QRgb c1 = texels[x1 + width * y0];
+                QRgb c2 = texels[x0 + width * y1];
+                QRgb c3 = texels[x1 + width * y1];
+
+                next[x + nextWidth * y] = qRgb(
+                            (qRed(c0) + qRed(c1) + qRed(c2) + qRed(c3) + 2) / 4,
+                            (qGreen(c0) + qGreen(c1) + qGreen(c2) + qGreen(c3) + 2) / 4,
+                            (qBlue(c0) + qBlue(c1) + qBlue(c2) + qBlue(c3) + 2) / 4);
+            }
+        });
+
+        texels.swap(next);
+        width = nextWidth;
+        height = nextHeight;
+    }
+
+    return make_shared<Texture>(this, id, levels);
+}
+
+
+// Set or get the memory budget for resident tiles
+void TextureCache::SetBudget(size_t budgetBytes)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_budget = budgetBytes;
+    EvictToBudget(0);
+}
+
+size_t TextureCache::Budget() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_budget;
+}
+
+
+// Set or get the number of frames a tile may go unsampled before BeginFrame drops it
+void TextureCache::SetMaxIdleFrames(unsigned int frames)
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_maxIdleFrames = frames;
+}
+
+unsigned int TextureCache::MaxIdleFrames() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_maxIdleFrames;
+}
+
+size_t TextureCache::ResidentBytes() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_residentBytes;
+}
+
+size_t TextureCache::NumFaults() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_numFaults;
+}
+
+
+// Marks the start of a new frame and drops tiles left idle too long
+void TextureCache::BeginFrame()
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    m_frame++;
+
+    if(m_maxIdleFrames == 0 || mp_backing == nullptr)
+    {
+        return;
+    }
+
+    // The least recently used tiles are at the back. Pinned ones are
+    // being sampled, so they stay.
+    auto it = m_lru.end();
+    while(it != m_lru.begin())
+    {
+        --it;
+        if(m_frame - it->lastFrame <= m_maxIdleFrames)
+        {
+            break;
+        }
+        if(it->pins > 0)
+        {
+            continue;
+        }
+
+        m_resident.erase(it->key);
+        it = m_lru.erase(it);
+        m_residentBytes -= TILE_BYTES;
+    }
+}
+
+
+// Makes a tile resident, if it is not, and keeps it so until it is
+// unpinned. Its texels can be read without the lock in the meantime.
+TextureCache::Tile* TextureCache::Pin(int textureId, int tile)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    list<Tile>::iterator it = Lookup(TileKey(textureId, tile));
+    it->pins++;
+    return &*it;
+}
+
+void TextureCache::Unpin(Tile* tile)
+{
+    tile->pins--;
+}
+
+
+// Finds a tile, faulting it in if it is not resident, and marks it the
+// most recently used
+list<TextureCache::Tile>::iterator TextureCache::Lookup(unsigned long long key)
+{
+    auto found = m_resident.find(key);
+    list<Tile>::iterator it;
+    if(found != m_resident.end())
+    {
+        it = found->second;
+        m_lru.splice(m_lru.begin(), m_lru, it);
+    }
+    else
+    {
+        it = FaultIn(key);
+    }
+
+    it->lastFrame = m_frame;
+    return it;
+}
+
+
+unsigned long long TextureCache::TileKey(int textureId, int tile)
+{
+    return ((unsigned long long)textureId << 32) | (unsigned int)tile;
+}
+
+
+// Writes a tile to the end of the cache file and remembers its offset
+void TextureCache::StoreTile(unsigned long long key, const vector<QRgb>& texels)
+{
+    // Without a cache file the tile has nowhere else to live
+    if(mp_backing == nullptr)
+    {
+        AddResident(key)->texels = texels;
+        return;
+    }
+
+    qint64 offset = m_fileEnd;
+    if(!m_freeOffsets.empty())
+    {
+        offset = m_freeOffsets.back();
+        m_freeOffsets.pop_back();
+    }
+    else
+    {
+        m_fileEnd += TILE_BYTES;
+    }
+
+    mp_backing->seek(offset);
+    mp_backing->write(reinterpret_cast<const char*>(texels.data()), TILE_BYTES);
+    m_fileOffsets[key] = offset;
+}
+
+
+// Reads a tile back from the cache file and makes it resident
+list<TextureCache::Tile>::iterator TextureCache::FaultIn(unsigned long long key)
+{
+    EvictToBudget(TILE_BYTES);
+
+    list<Tile>::iterator it = AddResident(key);
+    it->texels.resize(TILE_SIZE * TILE_SIZE);
+
+    mp_backing->seek(m_fileOffsets.at(key));
+    mp_backing->read(reinterpret_cast<char*>(it->texels.data()), TILE_BYTES);
+    m_numFaults++;
+
+    return it;
+}
+
+
+// Makes a tile resident that was not, most recently used
+list<TextureCache::Tile>::iterator TextureCache::AddResident(unsigned long long key)
+{
+    m_lru.emplace_front();
+    Tile& t = m_lru.front();
+    t.key = key;
+    t.lastFrame = m_frame;
+    t.pins = 0;
+
+    m_resident[key] = m_lru.begin();
+    m_residentBytes += TILE_BYTES;
+    return m_lru.begin();
+}
+
+
+// Evicts least recently used tiles until residentBytes fits the budget
+void TextureCache::EvictToBudget(size_t reserveBytes)
+{
+    // Tiles can't be evicted if there is no file to fault them back in from
+    if(mp_backing == nullptr)
+    {
+        return;
+    }
+
+    // Least recently used first, skipping tiles pinned by a sampler
+    auto it = m_lru.end();
+    while(it != m_lru.begin() && m_residentBytes + reserveBytes > m_budget)
+    {
+        --it;
+        if(it->pins > 0)
+        {
+            continue;
+        }
+
+        m_resident.erase(it->key);
+        it = m_lru.erase(it);
+        m_residentBytes -= TILE_BYTES;
+    }
+}
+
+
+// Forgets every tile of a Texture that is being destroyed
+void TextureCache::Release(int textureId, int numTiles)
+{
+    lock_guard<mutex> lock(m_mutex);
+
+    for(int i = 0; i < numTiles; i++)
+    {
+        unsigned long long key = TileKey(textureId, i);
+
+        auto found = m_resident.find(key);
+        if(found != m_resident.end())
+        {
+            m_lru.erase(found->second);
+            m_resident.erase(found);
+            m_residentBytes -= TILE_BYTES;
+        }
+
+        auto offset = m_fileOffsets.find(key);
+        if(offset != m_fileOffsets.end())
+        {
+            m_freeOffsets.push_back(offset->second);
+            m_fileOffsets.erase(offset);
+        }
+    }
+}
+
+
+// TextureSampler
+
+TextureSampler::TextureSampler(const Texture* texture)
+    : mp_texture(texture), m_numPinned(0), m_next(0), m_last(0), m_tiles(), mp_pinned()
+{}
+
+TextureSampler::~TextureSampler()
+{
+    UnpinAll();
+}
+
+
+// Samples texture from now on, unpinning the tiles of any other
+void TextureSampler::Reset(const Texture* texture)
+{
+    if(texture != mp_texture)
+    {
+        UnpinAll();
+        mp_texture = texture;
+    }
+}
+
+const Texture* TextureSampler::Get() const
+{
+    return mp_texture;
+}
+
+
+// Returns the color (in [0, 255]) of the texel nearest to uv in the given
+// mip level. Without a texture this is white.
+vec3 TextureSampler::Sample(const vec2& uv, float lod)
+{
+    if(mp_texture == nullptr)
+    {
+        return vec3(255.f, 255.f, 255.f);
+    }
+
+    int tile;
+    int texel;
+    if(!mp_texture->Locate(uv, lod, tile, texel))
+    {
+        return vec3(128.f, 128.f, 128.f);
+    }
+
+    QRgb color = Fetch(tile, texel);
+    return vec3(qRed(color), qGreen(color), qBlue(color));
+}
+
+
+// Samples count UVs, working out the tile and texel of each before reading
+// any of them
+void TextureSampler::SampleBatch(float lod, int count, const float* u, const float* v,
+                                 float* r, float* g, float* b)
+{
+    if(mp_texture == nullptr)
+    {
+        for(int i = 0; i < count; i++)
+        {
+            r[i] = 255.f;
+            g[i] = 255.f;
+            b[i] = 255.f;
+        }
+        return;
+    }
+
+    int tiles[BATCH_SIZE];
+    int texels[BATCH_SIZE];
+
+    for(int first = 0; first < count; first += BATCH_SIZE)
+    {
+        int n = glm::min(BATCH_SIZE, count - first);
+
+        for(int i = 0; i < n; i++)
+        {
+            if(!mp_texture->Locate(vec2(u[first + i], v[first + i]), lod, tiles[i], texels[i]))
+            {
+                tiles[i] = -1;
+            }
+        }
+
+        for(int i = 0; i < n; i++)
+        {
+            QRgb color = tiles[i] < 0 ? qRgb(128, 128, 128) : Fetch(tiles[i], texels[i]);
+            r[first + i] = qRed(color);
+            g[first + i] = qGreen(color);
+            b[first + i] = qBlue(color);
+        }
+    }
+}
+
+
+// Returns the texel at index texel of the given tile, pinning the tile in
+// place of the one pinned longest ago if it is not pinned yet
+QRgb TextureSampler::Fetch(int tile, int texel)
+{
+    // Neighbouring fragments nearly always read the tile read last
+    if(m_numPinned > 0 && m_tiles[m_last] == tile)
+    {
+        return mp_pinned[m_last]->texels[texel];
+    }
+
+    for(int i = 0; i < m_numPinned; i++)
+    {
+        if(m_tiles[i] == tile)
+        {
+            m_last = i;
+            return mp_pinned[i]->texels[texel];
+        }
+    }
+
+    int slot;
+    if(m_numPinned < MAX_PINNED)
+    {
+        slot = m_numPinned++;
+    }
+    else
+    {
+        slot = m_next;
+        m_next = (m_next + 1) % MAX_PINNED;
+        TextureCache::Unpin(mp_pinned[slot]);
+    }
+
+    m_tiles[slot] = tile;
+    mp_pinned[slot] = mp_texture->mp_cache->Pin(mp_texture->m_id, tile);
+    m_last = slot;
+    return mp_pinned[slot]->texels[texel];
+}
+
+
+void TextureSampler::UnpinAll()
+{
+    for(int i = 0; i < m_numPinned; i++)
+    {
+        TextureCache::Unpin(mp_pinned[i]);
+    }
+    m_numPinned = 0;
+    m_next = 0;
+    m_last = 0;
+}
@@ -0,0 +1,229 @@
+// Tiled, mipmapped textures and the cache that keeps them within a memory budget
+
+#pragma once
+#include <glm/glm.hpp>
+#include <QString>
+#include <QImage>
+#include <QFile>
+#include <QTemporaryFile>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+class TextureCache;
+class TextureSampler;
+
+// One level of a Texture's mip chain. Each level is split into square
+// tiles of TextureCache::TILE_SIZE texels; the tiles of all levels are
+// numbered consecutively starting at firstTile.
+struct MipLevel
+{
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    int firstTile;
+};
+
+// A Texture does not hold any texels itself. It knows the layout of its
+// mip chain and asks its TextureCache for the tiles it needs while sampling,
+// so only the parts of the image recent frames actually looked at stay in memory.
+class Texture
+{
+public:
+    Texture(TextureCache* cache, int id, const std::vector<MipLevel>& levels);
+    ~Texture();
+
+    int Width() const;
+    int Height() const;
+    int NumLevels() const;
+
+    // Returns the mip level for a triangle covering texelArea texels of
+    // level 0 in screenArea pixels
+    float CalcLod(float texelArea, float screenArea) const;
+
+private:
+    friend class TextureSampler;
+
+    // Finds the tile holding the texel nearest to uv in the mip level lod
+    // picks, and the texel's index within it. Returns false for UVs below 0.
+    bool Locate(const glm::vec2& uv, float lod, int& tile, int& texel) const;
+
+    TextureCache* mp_cache;
+    int m_id;
+    std::vector<MipLevel> m_levels;
+};
+
+
+// Keeps the tiles of every loaded Texture within a fixed memory budget.
+// On Load the image is decoded once, its mip chain is built and every tile is
+// written to a cache file; after that tiles are faulted back in when sampled
+// and the least recently used ones are evicted once the budget is exceeded.
+class TextureCache
+{
+public:
+    // Width and height of one tile in texels
+    static const int TILE_SIZE = 32;
+    static const size_t TILE_BYTES = TILE_SIZE * TILE_SIZE * sizeof(QRgb);
+
+    // Budget and idle limit a new cache starts with
+    static const size_t DEFAULT_BUDGET = 128 * 1024 * 1024;
+    static const unsigned int DEFAULT_MAX_IDLE_FRAMES = 120;
+
+    // budgetBytes is the most memory resident tiles may use. If cachePath is
+    // empty, an anonymous temporary file is used to back evicted tiles.
+    TextureCache(size_t budgetBytes = DEFAULT_BUDGET, const QString& cachePath = QString());
+    ~TextureCache();
+
+    // Decodes the image file at path into a tiled, mipmapped Texture.
+    // Returns nullptr if the image could not be read.
+    std::shared_ptr<Texture> Load(const QString& path);
+
+    // Builds a Texture from an already decoded image
+    std::shared_ptr<Texture> Load(const QImage& image);
+
+    // Set or get the memory budget for resident tiles
+    void SetBudget(size_t budgetBytes);
+    size_t Budget() const;
+
+    // Tiles that have not been sampled for this many frames are dropped by
+    // BeginFrame even when the budget is not exceeded; 0 keeps them
+    void SetMaxIdleFrames(unsigned int frames);
+    unsigned int MaxIdleFrames() const;
+
+    // Bytes currently used by resident tiles
+    size_t ResidentBytes() const;
+
+    // Number of tiles read back from the cache file since construction
+    size_t NumFaults() const;
+
+    // Marks the start of a new frame and drops tiles left idle too long
+    void BeginFrame();
+
+private:
+    friend class Texture;
+    friend class TextureSampler;
+
+    // Rows copied or filtered, and tiles cut, by one task while loading
+    static const int ROW_GRAIN = 64;
+    static const int TILE_GRAIN = 16;
+
+    // A resident tile, the last frame it was sampled in, and the number of
+    // TextureSamplers holding it. Pinned tiles are never evicted, and only
+    // the pin count may change without the lock.
+    struct Tile
+    {
+        unsigned long long key;
+        unsigned int lastFrame;
+        std::vector<QRgb> texels;
+        std::atomic<int> pins;
+    };
+
+    static unsigned long long TileKey(int textureId, int tile);
+
+    // Writes a tile to the end of the cache file and remembers its offset
+    void StoreTile(unsigned long long key, const std::vector<QRgb>& texels);
+
+    // Reads a tile back from the cache file and makes it resident
+    std::list<Tile>::iterator FaultIn(unsigned long long key);
+
+    // Makes a tile resident, if it is not, and keeps it so until it is
+    // unpinned. Its texels can be read without the lock in the meantime.
+    Tile* Pin(int textureId, int tile);
+    static void Unpin(Tile* tile);
+
+    // Finds a tile, faulting it in if it is not resident, and marks it the
+    // most recently used
+    std::list<Tile>::iterator Lookup(unsigned long long key);
+
+    // Makes a tile resident that was not, most recently used
+    std::list<Tile>::iterator AddResident(unsigned long long key);
+
+    // Evicts least recently used tiles until residentBytes fits the budget
+    void EvictToBudget(size_t reserveBytes);
+
+    // Forgets every tile of a Texture that is being destroyed
+    void Release(int textureId, int numTiles);
+
+    size_t m_budget;
+    size_t m_residentBytes;
+    size_t m_numFaults;
+    unsigned int m_frame;
+    unsigned int m_maxIdleFrames;
+    int m_nextId;
+
+    // Resident tiles, most recently used at the front
+    std::list<Tile> m_lru;
+    std::unordered_map<unsigned long long, std::list<Tile>::iterator> m_resident;
+
+    // Location of every tile in the cache file
+    std::unordered_map<unsigned long long, qint64> m_fileOffsets;
+    qint64 m_fileEnd;
+
+    // Slots in the cache file left behind by released Textures
+    std::vector<qint64> m_freeOffsets;
+
+    QString m_cachePath;
+    QFile m_file;
+    QTemporaryFile m_tempFile;
+    QFile* mp_backing;
+
+    mutable std::mutex m_mutex;
+};
+
+
+// Samples one Texture through tiles it pins in the cache, so only the first
+// lookup of each tile takes the cache's lock and the rest read its texels
+// directly. Meant to be kept for a triangle or a batch of fragments; it holds
+// a few tiles at a time and unpins them when reset or destroyed, which must
+// happen before the Texture is destroyed.
+class TextureSampler
+{
+public:
+    explicit TextureSampler(const Texture* texture = nullptr);
+    ~TextureSampler();
+
+    // Samples texture from now on, unpinning the tiles of any other
+    void Reset(const Texture* texture);
+
+    const Texture* Get() const;
+
+    // Returns the color (in [0, 255]) of the texel nearest to uv in the given
+    // mip level, or gray for UVs below 0. Without a texture this is white.
+    glm::vec3 Sample(const glm::vec2& uv, float lod);
+
+    // Samples count UVs the same way, writing colors in [0, 255]. Every
+    // texel's tile is worked out before any is read, so each tile the batch
+    // touches is pinned once.
+    void SampleBatch(float lod, int count, const float* u, const float* v,
+                     float* r, float* g, float* b);
+
+private:
+    // Not copyable, since the pins are released on destruction
+    TextureSampler(const TextureSampler&);
+    TextureSampler& operator=(const TextureSampler&);
+
+    // Returns the texel at index texel of the given tile, pinning the tile
+    // in place of the one pinned longest ago if it is not pinned yet
+    QRgb Fetch(int tile, int texel);
+
+    void UnpinAll();
+
+    static const int MAX_PINNED = 8;
+
+    // UVs located at a time by SampleBatch
+    static const int BATCH_SIZE = 16;
+
+    const Texture* mp_texture;
+
+    // Tiles pinned, the slot to pin in next once all are used, and the
+    // slot of the tile read last
+    int m_numPinned;
+    int m_next;
+    int m_last;
+    int m_tiles[MAX_PINNED];
+    TextureCache::Tile* mp_pinned[MAX_PINNED];
+};
@@ -0,0 +1,86 @@
+// Screen tiles the triangles of a frame are sorted into, so each tile can be
+// rasterized on its own thread
+
+#include "tiles.h"
+
+using namespace glm;
+
+using namespace std;
+
+
+// Adds a triangle, extending the last run if it belongs to the same call
+void TileBin::Add(int call, const TriangleSetup& tri)
+{
+    if(runs.empty() || runs.back().call != call)
+    {
+        BinRun run = {call, int(tris.size()), 0};
+        runs.push_back(run);
+    }
+    runs.back().count++;
+    tris.push_back(tri);
+}
+
+// Adds another bin's runs after this one's, joining runs of the same call
+void TileBin::Append(const TileBin& other)
+{
+    int offset = tris.size();
+    tris.insert(tris.end(), other.tris.begin(), other.tris.end());
+
+    for(const BinRun& run : other.runs)
+    {
+        if(!runs.empty() && runs.back().call == run.call)
+        {
+            runs.back().count += run.count;
+            continue;
+        }
+        BinRun moved = {run.call, run.first + offset, run.count};
+        runs.push_back(moved);
+    }
+}
+
+void TileBin::Clear()
+{
+    tris.clear();
+    runs.clear();
+}
+
+
+TileBins::TileBins()
+    : m_bins(NUM_TILES), m_chunkBins()
+{}
+
+
+ScreenRect TileBins::Rect(int tile)
+{
+    int x = (tile % TILES_X) * TILE_SIZE;
+    int y = (tile / TILES_X) * TILE_SIZE;
+    ScreenRect rect = {x, y, x + TILE_SIZE, y + TILE_SIZE};
+    return rect;
+}
+
+
+const TileBin& TileBins::Bin(int tile) const
+{
+    return m_bins[tile];
+}
+
+
+// Adds a set up triangle to the bins of the tiles its box overlaps. The box
+// holds the rows and columns of the pixels RasterizeTriangle may visit.
+void TileBins::AddToTiles(const TriangleSetup& tri, int call, TileBin* bins)
+{
+    const Triangle& t = tri.t;
+
+    int x0 = glm::max(t.xLeft, 0) / TILE_SIZE;
+    int x1 = (glm::min(t.xRight, 512) - 1) / TILE_SIZE;
+    int y0 = glm::max(t.yUpper, 0) / TILE_SIZE;
+    int y1 = (glm::min(t.yLower, 512) - 1) / TILE_SIZE;
+
+    for(int y = y0; y <= y1; y++)
+    {
+        for(int x = x0; x <= x1; x++)
+        {
+            bins[x + TILES_X * y].Add(call, tri);
+        }
+    }
+}
@@ -0,0 +1,172 @@
+// Screen tiles the triangles of a frame are sorted into, so each tile can be
+// rasterized on its own thread
+
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "drawlist.h"
+#include "pipeline.h"
+#include "jobs.h"
+
+// Consecutive triangles of one DrawCall in a tile's bin
+struct BinRun
+{
+    int call;       // Index of the DrawCall in the DrawList
+    int first;      // Index of the run's first triangle in the bin's list
+    int count;
+};
+
+// The triangles overlapping one tile, in the order they were submitted,
+// each kept with its setup so the tile does not set it up again
+struct TileBin
+{
+    std::vector<TriangleSetup> tris;
+    std::vector<BinRun> runs;
+
+    // Adds a triangle of DrawCall call after everything already binned
+    void Add(int call, const TriangleSetup& tri);
+
+    // Adds everything in other after everything already binned
+    void Append(const TileBin& other);
+
+    void Clear();
+};
+
+// A run of one DrawCall's triangles, drawn only within one tile
+struct TileDraw
+{
+    const Polygon* world;
+    Polygon* screen;
+    const glm::mat4* transform;     // The DrawCall's, if placed
+    const TriangleSetup* tris;
+    int count;
+    ScreenRect rect;
+};
+
+// Each tile's pixels, depth included, are only ever touched by the thread
+// drawing that tile, so tiles are drawn in parallel without any locking, and
+// since each bin keeps the submission order the image is the same byte for
+// byte whatever the number of threads or the order the tiles are taken in.
+class TileBins
+{
+public:
+    static const int TILE_SIZE = 64;
+    static const int TILES_X = 512 / TILE_SIZE;
+    static const int NUM_TILES = TILES_X * TILES_X;
+
+    // Triangles set up and binned by one task. Fixed rather than worked out
+    // from the number of threads, so the bins come out the same for any pool.
+    static const int BIN_GRAIN = 1024;
+
+    TileBins();
+
+    // The pixels of tile
+    static ScreenRect Rect(int tile);
+
+    // Sets up every triangle of the draw list and adds those that survive
+    // to the bins of the tiles their bounding boxes overlap. Counts the
+    // triangles submitted, culled, clipped and rasterized in f.stats, if set.
+    template<class Proj>
+    void Build(const DrawList& drawList, const FrameState& f);
+
+    const TileBin& Bin(int tile) const;
+
+private:
+    // Adds a set up triangle to every bin in bins its box overlaps
+    static void AddToTiles(const TriangleSetup& tri, int call, TileBin* bins);
+
+    std::vector<TileBin> m_bins;
+
+    // NUM_TILES bins per task, kept so their memory is reused
+    std::vector<TileBin> m_chunkBins;
+};
+
+
+// Bins fixed size chunks of the triangles in parallel, then joins each
+// tile's bins from every chunk in chunk order, so that every bin holds its
+// triangles in the order they were submitted
+template<class Proj>
+void TileBins::Build(const DrawList& drawList, const FrameState& f)
+{
+    const std::vector<DrawCall>& calls = drawList.Calls();
+
+    // Where each call's triangles start when all of them are numbered in order
+    std::vector<int> starts(calls.size() + 1, 0);
+    for(unsigned int c = 0; c < calls.size(); c++)
+    {
+        starts[c + 1] = starts[c] + calls[c].lastTri - calls[c].firstTri;
+    }
+    int numTris = starts.back();
+    int numChunks = (numTris + BIN_GRAIN - 1) / BIN_GRAIN;
+
+    if(int(m_chunkBins.size()) < numChunks * NUM_TILES)
+    {
+        m_chunkBins.resize(numChunks * NUM_TILES);
+    }
+    std::vector<RenderStats> chunkStats(numChunks);
+
+    ParallelFor(0, numChunks, 1, [&](int chunk)
+    {
+        TileBin* bins = &m_chunkBins[chunk * NUM_TILES];
+        RenderStats& stats = chunkStats[chunk];
+        for(int tile = 0; tile < NUM_TILES; tile++)
+        {
+            bins[tile].Clear();
+        }
+
+        int first = chunk * BIN_GRAIN;
+        int last = std::min(first + BIN_GRAIN, numTris);
+        int c = std::upper_bound(starts.begin(), starts.end(), first) - starts.begin() - 1;
+
+        for(int n = first; n < last; n++)
+        {
+            while(n >= starts[c + 1])
+            {
+                c++;
+            }
+
+            const DrawCall& d = calls[c];
+            int i = d.firstTri + n - starts[c];
+
+            TriangleSetup setup;
+            if(SetupTriangle<Proj>(*d.screen, d.tris[i], f, setup.t, setup.signedArea))
+            {
+                AddToTiles(setup, c, bins);
+                stats.trianglesRasterized++;
+                continue;
+            }
+
+            const std::vector<Vertex>& verts = d.screen->m_verts;
+            const Triangle& tri = d.tris[i];
+            if(Proj::IsClipped(verts[tri.m_indices[0]], verts[tri.m_indices[1]],
+                               verts[tri.m_indices[2]], f))
+            {
+                stats.trianglesClipped++;
+            }
+            else
+            {
+                stats.trianglesCulled++;
+            }
+        }
+    });
+
+    if(f.stats != nullptr)
+    {
+        f.stats->trianglesSubmitted += numTris;
+        for(const RenderStats& stats : chunkStats)
+        {
+            f.stats->trianglesCulled += stats.trianglesCulled;
+            f.stats->trianglesClipped += stats.trianglesClipped;
+            f.stats->trianglesRasterized += stats.trianglesRasterized;
+        }
+    }
+
+    ParallelFor(0, NUM_TILES, 1, [&](int tile)
+    {
+        m_bins[tile].Clear();
+        for(int chunk = 0; chunk < numChunks; chunk++)
+        {
+            m_bins[tile].Append(m_chunkBins[chunk * NUM_TILES + tile]);
+        }
+    });
+}
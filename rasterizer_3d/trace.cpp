@@ -0,0 +1,198 @@
+// Timed spans of the renderer's stages on every thread, saved as a trace
+// that chrome://tracing and Perfetto open
+
+#include "trace.h"
+#include <QFile>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+std::atomic<bool> Trace::s_enabled(false);
+
+struct TraceSpan
+{
+    const char* name;
+    long long start;
+    long long end;
+};
+
+// One thread's spans. Only the owning thread writes spans and count; count
+// is published after the span it counts is written.
+struct TraceBuffer
+{
+    vector<TraceSpan> spans;
+    atomic<long long> count;
+    int id;
+    QString name;
+
+    // Whether a running thread records into the buffer
+    bool owned;
+};
+
+// Every thread's buffer, kept after the thread exits so its spans can
+// still be saved, until a new thread takes the buffer over
+struct TraceRegistry
+{
+    mutex lock;
+    vector<unique_ptr<TraceBuffer>> buffers;
+    atomic<long long> enabledAt;
+};
+
+static TraceRegistry& Buffers()
+{
+    static TraceRegistry registry;
+    return registry;
+}
+
+// The calling thread's name, kept apart from its buffer so naming a thread
+// costs nothing while tracing is off
+static thread_local QString t_name;
+
+// Hands the thread's buffer back to the registry when the thread exits
+struct TraceBufferOwner
+{
+    TraceBuffer* buffer;
+
+    ~TraceBufferOwner()
+    {
+        if(buffer != nullptr)
+        {
+            lock_guard<mutex> lock(Buffers().lock);
+            buffer->owned = false;
+        }
+    }
+};
+
+static thread_local TraceBufferOwner t_owner = {nullptr};
+
+// The calling thread's buffer, taken the first time the thread records a
+// span. The buffer of a thread that has exited is reused before a new one is
+// made, so restarting the job system's workers does not add buffers.
+static TraceBuffer& OwnBuffer()
+{
+    if(t_owner.buffer == nullptr)
+    {
+        TraceRegistry& registry = Buffers();
+        lock_guard<mutex> lock(registry.lock);
+
+        TraceBuffer* buffer = nullptr;
+        for(const unique_ptr<TraceBuffer>& unowned : registry.buffers)
+        {
+            if(!unowned->owned)
+            {
+                buffer = unowned.get();
+                break;
+            }
+        }
+        if(buffer == nullptr)
+        {
+            registry.buffers.push_back(unique_ptr<TraceBuffer>(new TraceBuffer()));
+            buffer = registry.buffers.back().get();
+            buffer->spans.resize(Trace::BUFFER_SPANS);
+            buffer->id = registry.buffers.size();
+        }
+
+        buffer->count = 0;
+        buffer->owned = true;
+        buffer->name = t_name.isEmpty() ? QString("thread ") + QString::number(buffer->id)
+                                        : t_name;
+        t_owner.buffer = buffer;
+    }
+    return *t_owner.buffer;
+}
+
+
+void Trace::Enable(bool on)
+{
+    if(on)
+    {
+        Buffers().enabledAt = Now();
+    }
+    s_enabled = on;
+}
+
+
+void Trace::NameThread(const QString& name)
+{
+    t_name = name;
+    if(t_owner.buffer != nullptr)
+    {
+        lock_guard<mutex> lock(Buffers().lock);
+        t_owner.buffer->name = name;
+    }
+}
+
+
+long long Trace::Now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+void Trace::Record(const char* name, long long start, long long end)
+{
+    TraceBuffer& buffer = OwnBuffer();
+    long long n = buffer.count.load(memory_order_relaxed);
+
+    TraceSpan& span = buffer.spans[n % BUFFER_SPANS];
+    span.name = name;
+    span.start = start;
+    span.end = end;
+
+    buffer.count.store(n + 1, memory_order_release);
+}
+
+
+// Writes each thread's name, then its spans as complete events with their
+// times in microseconds since tracing was enabled
+bool Trace::Save(const QString& filename)
+{
+    TraceRegistry& registry = Buffers();
+    lock_guard<mutex> lock(registry.lock);
+    long long enabledAt = registry.enabledAt;
+
+    string json("{\"traceEvents\":[\n");
+    bool first = true;
+    char event[256];
+
+    for(const unique_ptr<TraceBuffer>& buffer : registry.buffers)
+    {
+        snprintf(event, sizeof(event), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                 "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buffer->id,
+                 buffer->name.toStdString().c_str());
+        json += event;
+        first = false;
+
+        long long count = buffer->count.load(memory_order_acquire);
+        long long oldest = count > BUFFER_SPANS ? count - BUFFER_SPANS : 0;
+        for(long long n = oldest; n < count; n++)
+        {
+            const TraceSpan& span = buffer->spans[n % BUFFER_SPANS];
+            if(span.start < enabledAt)
+            {
+                continue;
+            }
+
+            snprintf(event, sizeof(event), ",\n{\"name\":\"%s\",\"cat\":\"renderer\",\"ph\":\"X\","
+                     "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", span.name,
+                     (span.start - enabledAt) / 1000.0, (span.end - span.start) / 1000.0,
+                     buffer->id);
+            json += event;
+        }
+    }
+    json += "\n]}\n";
+
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    return file.write(json.data(), json.size()) == qint64(json.size());
+}
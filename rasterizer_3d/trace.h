@@ -0,0 +1,68 @@
+// Timed spans of the renderer's stages on every thread, saved as a trace
+// that chrome://tracing and Perfetto open
+
+#pragma once
+#include <atomic>
+#include <QString>
+
+// Every thread records its spans into a ring buffer of its own, so recording
+// takes no lock and threads never wait on each other; once a thread's buffer
+// is full its oldest spans are overwritten. A thread only gets a buffer when
+// it first records a span, and takes over the buffer of a thread that has
+// exited if there is one, dropping that thread's spans. While tracing is off
+// a span costs one relaxed atomic load and no memory.
+class Trace
+{
+public:
+    // Starts recording spans, dropping any recorded before, or stops
+    static void Enable(bool on);
+    static bool Enabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    // Names the calling thread in saved traces
+    static void NameThread(const QString& name);
+
+    // Writes the spans recorded since tracing was last enabled as Chrome
+    // trace event JSON. Spans recorded while saving may come out torn, so
+    // save once the frames of interest are done. Returns false if the file
+    // could not be written.
+    static bool Save(const QString& filename);
+
+    // Nanoseconds on a monotonic clock
+    static long long Now();
+
+    // Records a span of the calling thread. name must outlive the trace,
+    // as string literals do.
+    static void Record(const char* name, long long start, long long end);
+
+    // Spans kept per thread recording any, about 1.5MB of them
+    static const int BUFFER_SPANS = 65536;
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+
+// Times its own lifetime as a span named name, if tracing was on when it
+// was made
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name)
+        : m_name(name), m_start(Trace::Enabled() ? Trace::Now() : -1)
+    {}
+
+    ~TraceScope()
+    {
+        if(m_start >= 0)
+        {
+            Trace::Record(m_name, m_start, Trace::Now());
+        }
+    }
+
+private:
+    const char* m_name;
+    long long m_start;
+};